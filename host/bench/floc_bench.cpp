@@ -0,0 +1,564 @@
+/*
+ * Host microbenchmarks for the FLOC hot paths.
+ *
+ * Arduino and NMv3 are replaced by the link-time stubs in host/stubs, so the
+ * numbers reflect the protocol code alone. Every benchmark prints one JSON
+ * object per line on stdout:
+ *
+ *   {"name":"...","iterations":N,"ns_per_op":X,"allocs_per_op":Y}
+ *
+ * Usage: floc_bench [name-filter]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <chrono>
+
+#include <Arduino.h>
+#include <nmv3_api.hpp>
+
+#include "floc.hpp"
+#include "floc_buffer.hpp"
+#include "floc_utils.hpp"
+#include "bloomfilter.hpp"
+#include "floc_dispatch.hpp"
+#include "floc_event.hpp"
+#include "floc_fec.hpp"
+#include "floc_serial.hpp"
+#include "floc_trace.hpp"
+
+// The application normally owns this.
+void
+act_upon(
+    void
+){
+    /* Do Nothing */
+}
+
+// ----- Allocation accounting -----
+
+static uint64_t alloc_count = 0;
+
+void*
+operator new(
+    size_t size
+){
+    alloc_count++;
+
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void*
+operator new[](
+    size_t size
+){
+    return operator new(size);
+}
+
+void
+operator delete(
+    void* p
+) noexcept {
+    free(p);
+}
+
+void
+operator delete[](
+    void* p
+) noexcept {
+    free(p);
+}
+
+void
+operator delete(
+    void* p,
+    size_t size
+) noexcept {
+    (void) size;
+    free(p);
+}
+
+void
+operator delete[](
+    void* p,
+    size_t size
+) noexcept {
+    (void) size;
+    free(p);
+}
+
+// ----- Harness -----
+
+#define BENCH_LOCAL_ID   0x0001
+#define BENCH_PEER_ID    0x0002
+#define BENCH_NETWORK_ID 0x1234
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const char* bench_filter = nullptr;
+
+template <typename T>
+static inline void
+keep(
+    T const& value
+){
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+static bool
+selected(
+    const char* name
+){
+    return bench_filter == nullptr || strstr(name, bench_filter) != nullptr;
+}
+
+static void
+report(
+    const char* name,
+    uint64_t iterations,
+    uint64_t elapsed_ns,
+    uint64_t allocs
+){
+    printf("{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f}\n",
+        name,
+        (unsigned long long) iterations,
+        (double) elapsed_ns / (double) iterations,
+        (double) allocs / (double) iterations);
+    fflush(stdout);
+}
+
+// Runs `op` in timed batches of `batch` calls; `reset` runs untimed between
+// batches so queues and filters can be brought back to a known state.
+template <typename Op, typename Reset>
+static void
+run_batched(
+    const char* name,
+    uint32_t batches,
+    uint32_t batch,
+    Op op,
+    Reset reset
+){
+    if (!selected(name)) {
+        return;
+    }
+
+    uint64_t elapsed_ns = 0;
+    uint64_t allocs = 0;
+
+    for (uint32_t b = 0; b < batches; b++) {
+        reset();
+
+        uint64_t allocs_before = alloc_count;
+        bench_clock::time_point start = bench_clock::now();
+
+        for (uint32_t i = 0; i < batch; i++) {
+            op(i);
+        }
+
+        bench_clock::time_point end = bench_clock::now();
+        allocs += alloc_count - allocs_before;
+        elapsed_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    report(name, (uint64_t) batches * batch, elapsed_ns, allocs);
+}
+
+template <typename Op>
+static void
+run(
+    const char* name,
+    uint32_t iterations,
+    Op op
+){
+    run_batched(name, 1, iterations, op, [](){});
+}
+
+// ----- Fixtures -----
+
+static void
+drain_global_buffer(
+    void
+){
+    while (flocBuffer.checkQueueStatus() != 0) {
+        flocBuffer.queueHandler();
+    }
+
+    floc_event_clear();
+}
+
+static uint8_t
+build_rx_frame(
+    uint8_t* buf,
+    FlocPacketType_e type
+){
+    FlocPacket_t packet;
+    memset(&packet, 0, sizeof(packet));
+
+    floc_build_header(&packet, TTL_START, type, BENCH_LOCAL_ID, false);
+    packet.header.src_addr = htons(BENCH_PEER_ID);
+    packet.header.last_hop_addr = htons(BENCH_PEER_ID);
+
+    // 32 bytes of data, or as much as the profile's frames hold
+    uint8_t data_size = MAX_DATA_PAYLOAD_SIZE < 32 ? MAX_DATA_PAYLOAD_SIZE : 32;
+
+    uint8_t size = 0;
+    switch (type) {
+        case FLOC_DATA_TYPE:
+            packet.payload.data.header.size = data_size;
+            memset(packet.payload.data.payload, 0xA5, data_size);
+            size = DATA_PACKET_ACTUAL_SIZE(&packet);
+            break;
+        case FLOC_COMMAND_TYPE:
+            packet.payload.command.header.command_type = COMMAND_TYPE_1;
+            packet.payload.command.header.size = 8;
+            memset(packet.payload.command.payload, 0x5A, 8);
+            size = COMMAND_PACKET_ACTUAL_SIZE(&packet);
+            break;
+        case FLOC_ACK_TYPE:
+            packet.payload.ack.header.ack_pid = 7;
+            size = ACK_PACKET_ACTUAL_SIZE(&packet);
+            break;
+        case FLOC_RESPONSE_TYPE:
+            packet.payload.response.header.request_pid = 7;
+            packet.payload.response.header.size = 5;
+            size = RESPONSE_PACKET_ACTUAL_SIZE(&packet);
+            break;
+    }
+
+    memcpy(buf, &packet, size);
+
+    return size;
+}
+
+static FlocPacket_t
+build_queued_packet(
+    FlocPacketType_e type,
+    uint8_t pid
+){
+    FlocPacket_t packet;
+    memset(&packet, 0, sizeof(packet));
+
+    packet.header.type = type;
+    packet.header.ttl = TTL_START;
+    packet.header.nid = htons(BENCH_NETWORK_ID);
+    packet.header.pid = pid & 0x3F;
+    packet.header.dest_addr = htons(BENCH_PEER_ID);
+    packet.header.src_addr = htons(BENCH_LOCAL_ID);
+    packet.header.last_hop_addr = htons(BENCH_LOCAL_ID);
+
+    if (type == FLOC_COMMAND_TYPE) {
+        packet.payload.command.header.command_type = COMMAND_TYPE_1;
+        packet.payload.command.header.size = 8;
+    } else if (type == FLOC_RESPONSE_TYPE) {
+        packet.payload.response.header.size = 5;
+    }
+
+    return packet;
+}
+
+// ----- Benchmarks -----
+
+static void
+bench_build_header(
+    void
+){
+    FlocPacket_t packet;
+
+    run("floc_build_header", 2000000, [&](uint32_t){
+        floc_build_header(&packet, TTL_START, FLOC_COMMAND_TYPE, BENCH_PEER_ID, false);
+        keep(packet);
+    });
+}
+
+static void
+bench_broadcast_received(
+    void
+){
+    static const struct {
+        const char* name;
+        FlocPacketType_e type;
+    } cases[] = {
+        { "floc_broadcast_received/data",     FLOC_DATA_TYPE },
+        { "floc_broadcast_received/command",  FLOC_COMMAND_TYPE },
+        { "floc_broadcast_received/ack",      FLOC_ACK_TYPE },
+        { "floc_broadcast_received/response", FLOC_RESPONSE_TYPE },
+    };
+
+    for (const auto& c : cases) {
+        uint8_t frame[FLOC_MAX_SIZE];
+        uint8_t size = build_rx_frame(frame, c.type);
+
+        // The Bloom filter is cleared before every frame (an 8-byte memset)
+        // so each one takes the full parse path instead of the duplicate drop.
+        run_batched(c.name, 2000, 64,
+            [&](uint32_t){
+                bloom_reset();
+                floc_broadcast_received(frame, size);
+            },
+            [](){
+                drain_global_buffer();
+            });
+    }
+
+    drain_global_buffer();
+}
+
+static void
+bench_add_packet(
+    void
+){
+    static const uint32_t depths[] = { 1, 8, 32, 128 };
+    char name[64];
+
+    for (uint32_t depth : depths) {
+        FLOCBufferManager* mgr = nullptr;
+        FlocPacket_t packet = build_queued_packet(FLOC_COMMAND_TYPE, 1);
+
+        snprintf(name, sizeof(name), "FLOCBufferManager::addPacket/depth=%u", depth);
+        run_batched(name, 20000 / depth + 1, depth,
+            [&](uint32_t i){
+                packet.header.pid = i & 0x3F;
+                mgr->addPacket(packet);
+            },
+            [&](){
+                delete mgr;
+                mgr = new FLOCBufferManager();
+            });
+
+        delete mgr;
+    }
+}
+
+static void
+bench_queue_handler(
+    void
+){
+    static const uint32_t depths[] = { 1, 8, 32, 128 };
+    char name[64];
+
+    for (uint32_t depth : depths) {
+        FLOCBufferManager* mgr = nullptr;
+        FlocPacket_t ack = build_queued_packet(FLOC_ACK_TYPE, 0);
+
+        // Drains `depth` queued ACKs through the response path.
+        snprintf(name, sizeof(name), "FLOCBufferManager::queueHandler/response/depth=%u", depth);
+        run_batched(name, 20000 / depth + 1, depth,
+            [&](uint32_t){
+                mgr->queueHandler();
+            },
+            [&](){
+                delete mgr;
+                mgr = new FLOCBufferManager();
+                for (uint32_t i = 0; i < depth; i++) {
+                    ack.header.pid = i & 0x3F;
+                    mgr->addPacket(ack);
+                }
+            });
+
+        delete mgr;
+        mgr = nullptr;
+
+        FlocPacket_t cmd = build_queued_packet(FLOC_COMMAND_TYPE, 0);
+
+        // Transmits the head of a command queue of `depth` entries, staying
+        // below the retry limit so nothing is dequeued.
+        snprintf(name, sizeof(name), "FLOCBufferManager::queueHandler/command/depth=%u", depth);
+        run_batched(name, 20000, 4,
+            [&](uint32_t){
+                mgr->queueHandler();
+            },
+            [&](){
+                delete mgr;
+                mgr = new FLOCBufferManager();
+                for (uint32_t i = 0; i < depth; i++) {
+                    cmd.header.pid = i & 0x3F;
+                    mgr->addPacket(cmd);
+                }
+            });
+
+        delete mgr;
+    }
+}
+
+static void
+bench_bloom(
+    void
+){
+    run("bloom_check_packet", 5000000, [](uint32_t i){
+        bool hit = bloom_check_packet(i & 0x3F, BENCH_LOCAL_ID, (uint16_t) (i >> 6));
+        keep(hit);
+    });
+
+    run_batched("bloom_add_packet", 50000, 64,
+        [](uint32_t i){
+            bloom_add_packet(i & 0x3F, BENCH_LOCAL_ID, BENCH_PEER_ID);
+        },
+        [](){
+            bloom_reset();
+        });
+}
+
+static void
+bench_noop_handler(
+    const FlocCommandContext_t* ctx
+){
+    keep(ctx->size);
+}
+
+// Dispatch cost should not depend on how many command types exist.
+static void
+bench_dispatch(
+    void
+){
+    for (int type = 0x10; type < 0x10 + 40; type++) {
+        floc_dispatch_register((CommandType_e) type, bench_noop_handler, 0, 0, MAX_COMMAND_PAYLOAD_SIZE, 0);
+    }
+
+    run("floc_dispatch_lookup/40_types", 5000000, [](uint32_t i){
+        const FlocCommandEntry_t* entry = floc_dispatch_lookup(0x10 + (i % 40));
+        keep(entry->flags);
+    });
+
+    for (int type = 0x10; type < 0x10 + 40; type++) {
+        floc_dispatch_unregister((CommandType_e) type);
+    }
+}
+
+static void
+bench_trace(
+    void
+){
+    run("floc_trace_write", 5000000, [](uint32_t i){
+        FLOC_TRACE(FLOC_TRACE_USER, i, i >> 8);
+    });
+}
+
+// A full group at the largest configuration, and a decode with two data shards lost.
+static void
+bench_fec(
+    void
+){
+    static uint8_t shards[FLOC_FEC_MAX_K + 2][FLOC_FEC_MAX_SHARD];
+    uint8_t* ptrs[FLOC_FEC_MAX_K + 2];
+
+    for (int i = 0; i < FLOC_FEC_MAX_K + 2; i++) {
+        ptrs[i] = shards[i];
+    }
+
+    for (int i = 0; i < FLOC_FEC_MAX_K; i++) {
+        for (int b = 0; b < FLOC_FEC_MAX_SHARD; b++) {
+            shards[i][b] = (uint8_t) (i * 31 + b * 7 + 1);
+        }
+    }
+
+    run("floc_fec_encode/k8_m2", 200000, [&](uint32_t i){
+        floc_fec_encode(ptrs, FLOC_FEC_MAX_K, 2, FLOC_FEC_MAX_SHARD, ptrs + FLOC_FEC_MAX_K);
+        keep(shards[FLOC_FEC_MAX_K][i % FLOC_FEC_MAX_SHARD]);
+    });
+
+    uint16_t present = (uint16_t) (((1 << (FLOC_FEC_MAX_K + 2)) - 1) & ~0x0012);
+
+    run("floc_fec_decode/k8_m2_2_lost", 200000, [&](uint32_t i){
+        bool ok = floc_fec_decode(ptrs, present, FLOC_FEC_MAX_K, 2, FLOC_FEC_MAX_SHARD);
+        keep(ok);
+        keep(shards[1][i % FLOC_FEC_MAX_SHARD]);
+    });
+}
+
+static void
+bench_serial_write(
+    void* ctx,
+    const uint8_t* frame,
+    uint16_t size
+){
+    memcpy(ctx, frame, size);
+}
+
+// A burst of three full packets, sent on their own and as one batch, and
+// splitting the batch on the other side.
+static void
+bench_serial(
+    void
+){
+    static uint8_t frame[SERIAL_FLOC_FRAME_MAX_SIZE];
+    uint8_t packet[FLOC_MAX_SIZE];
+
+    memset(packet, 0xA5, sizeof(packet));
+    floc_serial_begin(SERIAL_BURD_TO_NEST_TYPE, bench_serial_write, frame);
+
+    floc_serial_set_batch_ms(0);
+
+    run("floc_serial_send/3_plain", 1000000, [&](uint32_t i){
+        for (int p = 0; p < 3; p++) {
+            floc_serial_send_unicast(BENCH_PEER_ID, packet, sizeof(packet));
+        }
+
+        keep(frame[i % sizeof(frame)]);
+    });
+
+    floc_serial_set_batch_ms(1000);
+
+    run("floc_serial_send/3_batched", 1000000, [&](uint32_t i){
+        for (int p = 0; p < 3; p++) {
+            floc_serial_send_unicast(BENCH_PEER_ID, packet, sizeof(packet));
+        }
+
+        floc_serial_flush();
+        keep(frame[i % sizeof(frame)]);
+    });
+
+    uint16_t size = floc_serial_frame_size(frame, sizeof(frame));
+
+    run("floc_serial_split/3_batched", 1000000, [&](uint32_t i){
+        FlocSerialReader_t reader;
+        FlocSerialRecord_t record;
+        uint16_t total = 0;
+
+        floc_serial_open(&reader, frame, size);
+
+        while (floc_serial_next(&reader, &record)) {
+            total += record.size;
+        }
+
+        keep(total);
+        keep(i);
+    });
+
+    floc_serial_set_batch_ms(FLOC_SERIAL_BATCH_MS);
+}
+
+int
+main(
+    int argc,
+    char** argv
+){
+    if (argc > 1) {
+        bench_filter = argv[1];
+    }
+
+    // Keep stdout machine-readable.
+    Serial.setOutput(stderr);
+
+    set_network_id(BENCH_NETWORK_ID);
+    set_device_id(BENCH_LOCAL_ID);
+
+    bench_build_header();
+    bench_broadcast_received();
+    bench_add_packet();
+    bench_queue_handler();
+    bench_bloom();
+    bench_dispatch();
+    bench_trace();
+    bench_fec();
+    bench_serial();
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+/*
+ * Host stand-in for the Arduino core.
+ *
+ * Only the pieces the FLOC library touches are provided: Serial, millis()
+ * and micros(). Time is virtual so that benchmarks and simulators can
+ * drive it explicitly; see host_clock_*() below.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+class
+HostSerial {
+    public:
+        void
+        begin(
+            unsigned long baud
+        );
+
+        int
+        printf(
+            const char* fmt,
+            ...
+        ) __attribute__((format(printf, 2, 3)));
+
+        size_t
+        write(
+            uint8_t byte
+        );
+
+        size_t
+        write(
+            const uint8_t* buf,
+            size_t size
+        );
+
+        int
+        available(
+            void
+        );
+
+        int
+        read(
+            void
+        );
+
+        void
+        setOutput(
+            FILE* out
+        );
+
+    private:
+        FILE* output = nullptr;
+};
+
+extern HostSerial Serial;
+
+unsigned long
+millis(
+    void
+);
+
+unsigned long
+micros(
+    void
+);
+
+// --- Host-only virtual clock control ---
+
+void
+host_clock_set_us(
+    uint64_t now_us
+);
+
+void
+host_clock_advance_us(
+    uint64_t delta_us
+);
+
+uint64_t
+host_clock_now_us(
+    void
+);
@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "Arduino.h"
+#include "nmv3_api.hpp"
+
+// ----- Arduino -----
+
+HostSerial Serial;
+
+static uint64_t host_now_us = 0;
+
+void
+HostSerial::begin(
+    unsigned long baud
+){
+    (void) baud;
+}
+
+int
+HostSerial::printf(
+    const char* fmt,
+    ...
+){
+    FILE* out = output ? output : stdout;
+
+    va_list args;
+    va_start(args, fmt);
+    int written = vfprintf(out, fmt, args);
+    va_end(args);
+
+    return written;
+}
+
+size_t
+HostSerial::write(
+    uint8_t byte
+){
+    FILE* out = output ? output : stdout;
+
+    return fwrite(&byte, 1, 1, out);
+}
+
+size_t
+HostSerial::write(
+    const uint8_t* buf,
+    size_t size
+){
+    FILE* out = output ? output : stdout;
+
+    return fwrite(buf, 1, size, out);
+}
+
+int
+HostSerial::available(
+    void
+){
+    return 0;
+}
+
+int
+HostSerial::read(
+    void
+){
+    return -1;
+}
+
+void
+HostSerial::setOutput(
+    FILE* out
+){
+    output = out;
+}
+
+unsigned long
+millis(
+    void
+){
+    return (unsigned long) (host_now_us / 1000);
+}
+
+unsigned long
+micros(
+    void
+){
+    return (unsigned long) host_now_us;
+}
+
+void
+host_clock_set_us(
+    uint64_t now_us
+){
+    host_now_us = now_us;
+}
+
+void
+host_clock_advance_us(
+    uint64_t delta_us
+){
+    host_now_us += delta_us;
+}
+
+uint64_t
+host_clock_now_us(
+    void
+){
+    return host_now_us;
+}
+
+// ----- NMv3 -----
+
+static HostBroadcastHook_t broadcast_hook = nullptr;
+static HostUnicastHook_t unicast_hook = nullptr;
+static uint32_t broadcast_count = 0;
+static uint32_t unicast_count = 0;
+static uint32_t ping_count = 0;
+
+void
+broadcast(
+    uint8_t* buf,
+    uint8_t size
+){
+    broadcast_count++;
+
+    if (broadcast_hook) {
+        broadcast_hook(buf, size);
+    }
+}
+
+void
+unicast(
+    uint8_t modem_id,
+    uint8_t* buf,
+    uint8_t size
+){
+    unicast_count++;
+
+    if (unicast_hook) {
+        unicast_hook(modem_id, buf, size);
+    }
+}
+
+void
+ping(
+    uint8_t modem_id
+){
+    (void) modem_id;
+
+    ping_count++;
+}
+
+void
+query_status(
+    void
+){
+    /* Do Nothing */
+}
+
+void
+host_nmv3_set_broadcast_hook(
+    HostBroadcastHook_t hook
+){
+    broadcast_hook = hook;
+}
+
+void
+host_nmv3_set_unicast_hook(
+    HostUnicastHook_t hook
+){
+    unicast_hook = hook;
+}
+
+uint32_t
+host_nmv3_broadcast_count(
+    void
+){
+    return broadcast_count;
+}
+
+uint32_t
+host_nmv3_unicast_count(
+    void
+){
+    return unicast_count;
+}
+
+uint32_t
+host_nmv3_ping_count(
+    void
+){
+    return ping_count;
+}
+
+void
+host_nmv3_reset_counts(
+    void
+){
+    broadcast_count = 0;
+    unicast_count = 0;
+    ping_count = 0;
+}
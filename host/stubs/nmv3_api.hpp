@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+ * Host stand-in for the NMv3 modem API.
+ *
+ * The calls the FLOC library makes are recorded instead of being written to
+ * a modem. A hook can be installed to route transmitted frames somewhere
+ * useful (a simulated channel, a capture file, ...).
+ */
+
+#include <stdint.h>
+
+void
+broadcast(
+    uint8_t* buf,
+    uint8_t size
+);
+
+// Addressed to one modem, which the real modem follows with a delivery report
+void
+unicast(
+    uint8_t modem_id,
+    uint8_t* buf,
+    uint8_t size
+);
+
+void
+ping(
+    uint8_t modem_id
+);
+
+void
+query_status(
+    void
+);
+
+// --- Host-only instrumentation ---
+
+typedef void (*HostBroadcastHook_t)(uint8_t* buf, uint8_t size);
+
+typedef void (*HostUnicastHook_t)(uint8_t modem_id, uint8_t* buf, uint8_t size);
+
+void
+host_nmv3_set_broadcast_hook(
+    HostBroadcastHook_t hook
+);
+
+void
+host_nmv3_set_unicast_hook(
+    HostUnicastHook_t hook
+);
+
+uint32_t
+host_nmv3_broadcast_count(
+    void
+);
+
+uint32_t
+host_nmv3_unicast_count(
+    void
+);
+
+uint32_t
+host_nmv3_ping_count(
+    void
+);
+
+void
+host_nmv3_reset_counts(
+    void
+);
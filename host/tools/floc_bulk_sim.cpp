@@ -0,0 +1,333 @@
+/*
+ * Link simulation for bulk transfer sessions (see floc_bulk.hpp).
+ *
+ * Two nodes share one half-duplex acoustic channel: one frame is on the air
+ * at a time, every frame takes size * 8 / bitrate to send and arrives
+ * --delay ms after it ends, and every frame, data or ACK, is lost with the
+ * given probability. Both nodes run the real library in this process; the
+ * device ID is switched to whichever node is acting.
+ *
+ * Utilization is the airtime of data frames that delivered new bytes over
+ * the time until the stream was complete. For comparison, the utilization
+ * of one frame per round trip (per-packet ACKs, no loss) is printed too.
+ *
+ * Usage: floc_bulk_sim [--bytes N] [--bitrate BPS] [--delay MS] [--loss P] [--seed S]
+ *
+ * With no --loss, loss rates of 0, 5, 10 and 20% are run. One JSON object per
+ * run is printed on stdout.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+#include <Arduino.h>
+#include <nmv3_api.hpp>
+
+#include "floc.hpp"
+#include "floc_buffer.hpp"
+#include "floc_bulk.hpp"
+#include "floc_compact.hpp"
+#include "floc_event.hpp"
+#include "floc_utils.hpp"
+
+#define SIM_SENDER      0x0001
+#define SIM_RECEIVER    0x0002
+#define SIM_NETWORK_ID  0x1234
+#define SIM_STEP_US     10000
+#define SIM_LIMIT_US    (24ULL * 3600 * 1000000)
+
+void
+act_upon(
+    void
+){
+    /* Do Nothing */
+}
+
+struct
+sim_frame {
+    uint64_t arrival_us;
+    std::vector<uint8_t> bytes;
+};
+
+static std::vector<uint8_t> lastFrame;
+static bool frameSent = false;
+
+static uint32_t bitrate = 1000;
+static uint32_t rng_state = 1;
+
+static uint32_t received = 0;
+static uint32_t mismatches = 0;
+static bool finished = false;
+static bool txDone = false;
+static bool txDelivered = false;
+static uint64_t usefulAirtimeUs = 0;
+static uint64_t finishUs = 0;
+
+// xorshift32, so runs are repeatable for a given seed
+static uint32_t
+rng_next(
+    void
+){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint8_t
+pattern(
+    uint32_t offset
+){
+    return (uint8_t) (offset * 7 % 251);
+}
+
+static uint64_t
+airtime_us(
+    uint32_t size
+){
+    return (uint64_t) size * 8 * 1000000 / bitrate;
+}
+
+static void
+capture(
+    uint8_t* buf,
+    uint8_t size
+){
+    lastFrame.assign(buf, buf + size);
+    frameSent = true;
+}
+
+static void
+on_data(
+    uint16_t src_addr,
+    uint8_t session,
+    const uint8_t* data,
+    uint8_t size
+){
+    (void) src_addr;
+    (void) session;
+
+    if (size == 0) {
+        finished = true;
+        finishUs = host_clock_now_us();
+        return;
+    }
+
+    for (uint8_t i = 0; i < size; i++) {
+        if (data[i] != pattern(received + i)) {
+            mismatches++;
+        }
+    }
+
+    received += size;
+    usefulAirtimeUs += airtime_us(FLOC_HEADER_WIRE_SIZE + DATA_HEADER_SIZE + FLOC_BULK_HEADER_SIZE + size);
+}
+
+static void
+on_sent(
+    uint16_t dest_addr,
+    uint8_t session,
+    bool delivered
+){
+    (void) dest_addr;
+    (void) session;
+
+    txDone = true;
+    txDelivered = delivered;
+}
+
+static void
+run(
+    uint32_t bytes,
+    uint32_t delay_ms,
+    double loss,
+    uint32_t seed
+){
+    std::deque<sim_frame> channel;
+    uint64_t now = 0;
+    uint64_t busy_until = 0;
+    uint32_t written = 0;
+    uint32_t frames = 0;
+    uint32_t lost = 0;
+    uint8_t chunk[FLOC_BULK_CHUNK];
+    FlocBulkStats_t stats = {};
+
+    rng_state = seed;
+    received = 0;
+    mismatches = 0;
+    finished = false;
+    txDone = false;
+    usefulAirtimeUs = 0;
+
+    set_device_id(SIM_SENDER);
+    uint8_t session = floc_bulk_open(SIM_RECEIVER);
+
+    while (!(finished && txDone) && now < SIM_LIMIT_US) {
+        host_clock_set_us(now);
+
+        while (!channel.empty() && channel.front().arrival_us <= now) {
+            sim_frame& f = channel.front();
+            FlocHeader_t header = ((const FlocPacket_t*) f.bytes.data())->header;
+
+            if (floc_compact_is_compact(f.bytes.data(), f.bytes.size())) {
+                floc_compact_decode(f.bytes.data(), f.bytes.size(), &header);
+            }
+
+            set_device_id(ntohs(header.dest_addr));
+            floc_broadcast_received(f.bytes.data(), f.bytes.size());
+            floc_event_clear();
+            channel.pop_front();
+        }
+
+        set_device_id(SIM_SENDER);
+
+        while (written < bytes && !txDone) {
+            uint32_t n = bytes - written < sizeof(chunk) ? bytes - written : sizeof(chunk);
+
+            for (uint32_t i = 0; i < n; i++) {
+                chunk[i] = pattern(written + i);
+            }
+
+            uint16_t taken = floc_bulk_write(session, chunk, n);
+            written += taken;
+
+            if (written == bytes) {
+                floc_bulk_close(session);
+            }
+
+            if (taken < n) {
+                break;
+            }
+        }
+
+        floc_bulk_stats(session, &stats);
+
+        uint64_t next = now + SIM_STEP_US;
+
+        if (now >= busy_until) {
+            frameSent = false;
+            flocBuffer.queueHandler();
+
+            if (frameSent) {
+                uint64_t air = airtime_us(lastFrame.size());
+
+                frames++;
+                busy_until = now + air;
+
+                if ((rng_next() / 4294967296.0) < loss) {
+                    lost++;
+                } else {
+                    channel.push_back({ now + air + (uint64_t) delay_ms * 1000, lastFrame });
+                }
+
+                next = busy_until;
+            }
+        } else if (busy_until < next) {
+            next = busy_until;
+        }
+
+        if (!channel.empty() && channel.front().arrival_us < next) {
+            next = channel.front().arrival_us;
+        }
+
+        now = next > now ? next : now + 1;
+    }
+
+    uint64_t data_air = airtime_us(FLOC_HEADER_WIRE_SIZE + DATA_HEADER_SIZE + FLOC_BULK_HEADER_SIZE + FLOC_BULK_CHUNK);
+    uint64_t ack_air = airtime_us(FLOC_HEADER_WIRE_SIZE + DATA_HEADER_SIZE + FLOC_BULK_ACK_SIZE);
+    double stop_and_wait = (double) data_air / (data_air + ack_air + 2ULL * delay_ms * 1000);
+    double seconds = finishUs / 1e6;
+
+    printf("{\"bytes\":%u,\"bitrate\":%u,\"rtt_ms\":%u,\"loss\":%.2f,\"delivered\":%s,\"received\":%u,\"mismatches\":%u,"
+           "\"seconds\":%.1f,\"frames\":%u,\"frames_lost\":%u,\"retransmissions\":%u,\"final_window\":%u,\"srtt_ms\":%u,"
+           "\"goodput_bps\":%.1f,\"utilization\":%.3f,\"stop_and_wait_utilization\":%.3f}\n",
+        bytes,
+        bitrate,
+        2 * delay_ms,
+        loss,
+        txDelivered && finished ? "true" : "false",
+        received,
+        mismatches,
+        seconds,
+        frames,
+        lost,
+        stats.retransmissions,
+        stats.window,
+        stats.srtt_ms,
+        seconds > 0 ? received * 8 / seconds : 0.0,
+        finishUs ? (double) usefulAirtimeUs / finishUs : 0.0,
+        stop_and_wait);
+    fflush(stdout);
+
+    // Let the receiver's session expire before the next run
+    host_clock_set_us(now + (uint64_t) FLOC_BULK_RX_TIMEOUT_MS * 1000 + 1000);
+    flocBuffer.queueHandler();
+}
+
+static void
+usage(
+    const char* prog
+){
+    fprintf(stderr, "usage: %s [--bytes N] [--bitrate BPS] [--delay MS] [--loss P] [--seed S]\n", prog);
+}
+
+int
+main(
+    int argc,
+    char** argv
+){
+    uint32_t bytes = 20000;
+    uint32_t delay_ms = 2000;
+    uint32_t seed = 1;
+    double loss = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+
+        if (strcmp(argv[i], "--bytes") == 0) {
+            bytes = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--bitrate") == 0) {
+            bitrate = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--delay") == 0) {
+            delay_ms = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--loss") == 0) {
+            loss = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (bytes == 0 || bitrate == 0 || seed == 0 || loss >= 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Keep stdout machine-readable.
+    Serial.setOutput(stderr);
+
+    set_network_id(SIM_NETWORK_ID);
+    host_nmv3_set_broadcast_hook(capture);
+    floc_bulk_set_handlers(on_data, on_sent);
+
+    if (loss >= 0) {
+        run(bytes, delay_ms, loss, seed);
+    } else {
+        static const double rates[] = { 0.0, 0.05, 0.10, 0.20 };
+
+        for (double rate : rates) {
+            run(bytes, delay_ms, rate, seed);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * Loss simulation comparing FEC groups against per-packet retransmission.
+ *
+ * Every frame is lost independently with the given probability. Three ways
+ * of moving the same messages are compared:
+ *
+ *   plain  each message sent once, as floc_data_send() does
+ *   arq    each message retried until ACKed, up to --attempts sends, with
+ *          every ACK also subject to loss
+ *   fec    messages sent in groups of k with m parity frames, decoded with
+ *          the real codec and checked byte for byte
+ *
+ * Goodput is delivered payload bytes over all bytes put on the air,
+ * including headers, parity and ACKs. One JSON object per scheme and loss
+ * rate is printed on stdout.
+ *
+ * Usage: floc_fec_sim [--k K] [--m M] [--size BYTES] [--messages N] [--attempts N] [--seed S]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "floc.hpp"
+#include "floc_fec.hpp"
+
+void
+act_upon(
+    void
+){
+    /* Do Nothing */
+}
+
+static uint32_t rng_state;
+
+// xorshift32, so runs are repeatable for a given seed
+static uint32_t
+rng_next(
+    void
+){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static bool
+lost(
+    double loss
+){
+    return (rng_next() / 4294967296.0) < loss;
+}
+
+typedef struct
+sim_result {
+    uint32_t delivered;
+    uint64_t payload_bytes;
+    uint64_t air_bytes;
+    uint64_t frames;
+};
+
+static void
+print_result(
+    const char* scheme,
+    double loss,
+    uint32_t messages,
+    const sim_result* r
+){
+    printf("{\"scheme\":\"%s\",\"loss\":%.2f,\"delivery\":%.4f,\"goodput\":%.4f,\"frames_per_message\":%.3f}\n",
+        scheme,
+        loss,
+        (double) r->delivered / messages,
+        r->air_bytes ? (double) r->payload_bytes / r->air_bytes : 0.0,
+        (double) r->frames / messages);
+}
+
+static void
+simulate_plain(
+    double loss,
+    uint32_t messages,
+    uint8_t size,
+    sim_result* r
+){
+    uint8_t frame = FLOC_HEADER_WIRE_SIZE + DATA_HEADER_SIZE + size;
+
+    for (uint32_t i = 0; i < messages; i++) {
+        r->frames++;
+        r->air_bytes += frame;
+
+        if (!lost(loss)) {
+            r->delivered++;
+            r->payload_bytes += size;
+        }
+    }
+}
+
+static void
+simulate_arq(
+    double loss,
+    uint32_t messages,
+    uint8_t size,
+    uint8_t attempts,
+    sim_result* r
+){
+    uint8_t frame = FLOC_HEADER_WIRE_SIZE + COMMAND_HEADER_SIZE + size;
+    uint8_t ack = FLOC_HEADER_WIRE_SIZE + ACK_HEADER_SIZE;
+
+    for (uint32_t i = 0; i < messages; i++) {
+        bool delivered = false;
+
+        for (uint8_t a = 0; a < attempts; a++) {
+            r->frames++;
+            r->air_bytes += frame;
+
+            if (lost(loss)) {
+                continue;
+            }
+
+            delivered = true;
+
+            // Every copy that arrives is ACKed
+            r->frames++;
+            r->air_bytes += ack;
+
+            if (!lost(loss)) {
+                break;
+            }
+        }
+
+        if (delivered) {
+            r->delivered++;
+            r->payload_bytes += size;
+        }
+    }
+}
+
+static bool
+simulate_fec(
+    double loss,
+    uint32_t messages,
+    uint8_t size,
+    uint8_t k,
+    uint8_t m,
+    sim_result* r
+){
+    uint8_t len = size + 1;
+    uint8_t data_frame = FLOC_HEADER_WIRE_SIZE + DATA_HEADER_SIZE + FLOC_FEC_DATA_HEADER_SIZE + size;
+    uint8_t parity_frame = FLOC_HEADER_WIRE_SIZE + DATA_HEADER_SIZE + FLOC_FEC_PARITY_HEADER_SIZE + len;
+
+    uint8_t sent[FLOC_FEC_MAX_K + FLOC_FEC_MAX_M][FLOC_FEC_MAX_SHARD];
+    uint8_t received[FLOC_FEC_MAX_K + FLOC_FEC_MAX_M][FLOC_FEC_MAX_SHARD];
+    uint8_t* sent_ptrs[FLOC_FEC_MAX_K + FLOC_FEC_MAX_M];
+    uint8_t* received_ptrs[FLOC_FEC_MAX_K + FLOC_FEC_MAX_M];
+
+    for (int i = 0; i < FLOC_FEC_MAX_K + FLOC_FEC_MAX_M; i++) {
+        sent_ptrs[i] = sent[i];
+        received_ptrs[i] = received[i];
+    }
+
+    for (uint32_t base = 0; base < messages; base += k) {
+        uint8_t group = (messages - base < k) ? (uint8_t) (messages - base) : k;
+        uint16_t present = 0;
+
+        for (uint8_t i = 0; i < group; i++) {
+            sent[i][0] = size;
+            for (uint8_t b = 1; b < len; b++) {
+                sent[i][b] = (uint8_t) rng_next();
+            }
+        }
+
+        floc_fec_encode(sent_ptrs, group, m, len, sent_ptrs + group);
+
+        for (uint8_t i = 0; i < group + m; i++) {
+            r->frames++;
+            r->air_bytes += (i < group) ? data_frame : parity_frame;
+
+            if (!lost(loss)) {
+                present |= 1 << i;
+                memcpy(received[i], sent[i], len);
+            } else {
+                memset(received[i], 0, len);
+            }
+        }
+
+        bool decoded = floc_fec_decode(received_ptrs, present, group, m, len);
+
+        for (uint8_t i = 0; i < group; i++) {
+            if (!(present & (1 << i)) && !decoded) {
+                continue;
+            }
+
+            if (memcmp(received[i], sent[i], len) != 0) {
+                fprintf(stderr, "decode mismatch in group at message %u, shard %u\n", base, i);
+                return false;
+            }
+
+            r->delivered++;
+            r->payload_bytes += size;
+        }
+    }
+
+    return true;
+}
+
+static void
+usage(
+    const char* prog
+){
+    fprintf(stderr, "usage: %s [--k K] [--m M] [--size BYTES] [--messages N] [--attempts N] [--seed S]\n", prog);
+}
+
+int
+main(
+    int argc,
+    char** argv
+){
+    uint32_t k = 4;
+    uint32_t m = 2;
+    uint32_t size = 40;
+    uint32_t messages = 100000;
+    uint32_t attempts = 5;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        uint32_t* option = nullptr;
+
+        if (strcmp(argv[i], "--k") == 0) {
+            option = &k;
+        } else if (strcmp(argv[i], "--m") == 0) {
+            option = &m;
+        } else if (strcmp(argv[i], "--size") == 0) {
+            option = &size;
+        } else if (strcmp(argv[i], "--messages") == 0) {
+            option = &messages;
+        } else if (strcmp(argv[i], "--attempts") == 0) {
+            option = &attempts;
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            option = &seed;
+        }
+
+        if (option == nullptr || i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+
+        *option = (uint32_t) strtoul(argv[++i], nullptr, 0);
+    }
+
+    if (k == 0 || k > FLOC_FEC_MAX_K || m == 0 || m > FLOC_FEC_MAX_M ||
+        size == 0 || size > FLOC_FEC_MAX_PAYLOAD || messages == 0 || attempts == 0 || seed == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char fec_name[16];
+    snprintf(fec_name, sizeof(fec_name), "fec_k%u_m%u", k, m);
+
+    for (int percent = 0; percent <= 30; percent += 5) {
+        double loss = percent / 100.0;
+        sim_result plain = {};
+        sim_result arq = {};
+        sim_result fec = {};
+
+        rng_state = seed;
+        simulate_plain(loss, messages, size, &plain);
+
+        rng_state = seed;
+        simulate_arq(loss, messages, size, attempts, &arq);
+
+        rng_state = seed;
+        if (!simulate_fec(loss, messages, size, k, m, &fec)) {
+            return 1;
+        }
+
+        print_result("plain", loss, messages, &plain);
+        print_result("arq", loss, messages, &arq);
+        print_result(fec_name, loss, messages, &fec);
+    }
+
+    return 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * Channel access simulation for TDMA mode (see floc_mac.hpp).
+ *
+ * Sender nodes are spread at random within --range meters of a sink and
+ * each gets Poisson traffic of --size byte frames, queued up to
+ * FLOC_SIM_QUEUE frames. A frame reaches the sink after the propagation
+ * delay at the speed of sound, and is lost if it overlaps any other frame
+ * there. Free-running nodes send as soon as their modem is idle, like
+ * queueHandler() does today; TDMA nodes ask the library's slot timing.
+ *
+ * Load is the offered airtime as a share of the channel; throughput is the
+ * airtime of frames received intact, over the simulated time.
+ *
+ * Usage: floc_mac_sim [--nodes N] [--size BYTES] [--bitrate BPS] [--range M]
+ *                     [--slot-ms MS] [--load L] [--hours H] [--seed S]
+ *
+ * With no --load, loads of 5 to 80% are run. One JSON object per run is
+ * printed on stdout.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "floc.hpp"
+#include "floc_mac.hpp"
+
+#define FLOC_SIM_MAX_NODES  32
+#define FLOC_SIM_QUEUE      6       // Like FLOCBufferManager's queues
+#define FLOC_SIM_LOOP_MS    100     // Slack for the application loop reaching a slot
+
+void
+act_upon(
+    void
+){
+    /* Do Nothing */
+}
+
+struct
+sim_node {
+    uint32_t delay_ms;          // To the sink
+    uint8_t slot;
+    double next_arrival_ms;
+    uint32_t busy_until_ms;
+    std::deque<uint32_t> queue; // Arrival times
+};
+
+struct
+sim_rx {
+    uint32_t start_ms;
+    uint32_t end_ms;
+    uint32_t arrival_ms;
+};
+
+static uint32_t rng_state = 1;
+
+// xorshift32, so runs are repeatable for a given seed
+static uint32_t
+rng_next(
+    void
+){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double
+rng_uniform(
+    void
+){
+    return (rng_next() + 0.5) / 4294967296.0;
+}
+
+static void
+run(
+    bool use_tdma,
+    uint8_t nodes,
+    uint8_t size,
+    uint32_t range_m,
+    double load,
+    uint32_t hours,
+    uint32_t seed
+){
+    std::vector<sim_node> senders(nodes);
+    std::vector<sim_rx> received;
+    uint32_t airtime = floc_mac_airtime_ms(size);
+    uint32_t duration_ms = hours * 3600 * 1000;
+    double mean_gap_ms = airtime * nodes / load;
+    uint32_t sent = 0;
+    uint32_t queue_drops = 0;
+
+    rng_state = seed;
+
+    for (uint8_t i = 0; i < nodes; i++) {
+        // Uniform over the disk around the sink
+        double distance = range_m * sqrt(rng_uniform());
+
+        set_device_id(i + 1);
+
+        senders[i].delay_ms = (uint32_t) (distance * 1000 / FLOC_MAC_SOUND_SPEED_MPS);
+        senders[i].slot = floc_tdma_slot();
+        senders[i].next_arrival_ms = -mean_gap_ms * log(rng_uniform());
+        senders[i].busy_until_ms = 0;
+    }
+
+    for (uint32_t now = 0; now < duration_ms; now++) {
+        for (sim_node& n : senders) {
+            while (n.next_arrival_ms <= now) {
+                if (n.queue.size() < FLOC_SIM_QUEUE) {
+                    n.queue.push_back((uint32_t) n.next_arrival_ms);
+                } else {
+                    queue_drops++;
+                }
+
+                n.next_arrival_ms += -mean_gap_ms * log(rng_uniform());
+            }
+
+            if (n.queue.empty() || now < n.busy_until_ms) {
+                continue;
+            }
+
+            // Same rule as floc_mac_clear_to_send(): room for the largest frame
+            if (use_tdma && floc_tdma_wait_ms(now, n.slot, FLOC_MAX_SIZE) != 0) {
+                continue;
+            }
+
+            received.push_back({ now + n.delay_ms, now + n.delay_ms + airtime, n.queue.front() });
+            n.queue.pop_front();
+            n.busy_until_ms = now + airtime;
+            sent++;
+        }
+    }
+
+    std::sort(received.begin(), received.end(), [](const sim_rx& a, const sim_rx& b) {
+        return a.start_ms < b.start_ms;
+    });
+
+    uint32_t delivered = 0;
+    double latency_ms = 0;
+    uint32_t latest_end = 0;
+
+    for (size_t i = 0; i < received.size(); i++) {
+        bool collided = i > 0 && received[i].start_ms < latest_end;
+
+        if (i + 1 < received.size() && received[i + 1].start_ms < received[i].end_ms) {
+            collided = true;
+        }
+
+        latest_end = std::max(latest_end, received[i].end_ms);
+
+        if (!collided) {
+            delivered++;
+            latency_ms += received[i].end_ms - received[i].arrival_ms;
+        }
+    }
+
+    printf("{\"mode\":\"%s\",\"nodes\":%u,\"load\":%.2f,\"frames_sent\":%u,\"queue_drops\":%u,"
+           "\"collision_rate\":%.3f,\"throughput\":%.3f,\"mean_latency_ms\":%.0f}\n",
+        use_tdma ? "tdma" : "free",
+        nodes,
+        load,
+        sent,
+        queue_drops,
+        sent > 0 ? 1.0 - (double) delivered / sent : 0.0,
+        (double) delivered * airtime / duration_ms,
+        delivered > 0 ? latency_ms / delivered : 0.0);
+    fflush(stdout);
+}
+
+static void
+usage(
+    const char* prog
+){
+    fprintf(stderr, "usage: %s [--nodes N] [--size BYTES] [--bitrate BPS] [--range M] "
+                    "[--slot-ms MS] [--load L] [--hours H] [--seed S]\n", prog);
+}
+
+int
+main(
+    int argc,
+    char** argv
+){
+    uint32_t nodes = 7;
+    uint32_t size = 32;
+    uint32_t bitrate = 1000;
+    uint32_t range_m = 1500;
+    uint32_t slot_ms = 0;
+    uint32_t hours = 2;
+    uint32_t seed = 1;
+    double load = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+
+        if (strcmp(argv[i], "--nodes") == 0) {
+            nodes = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--size") == 0) {
+            size = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--bitrate") == 0) {
+            bitrate = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--range") == 0) {
+            range_m = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--slot-ms") == 0) {
+            slot_ms = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--load") == 0) {
+            load = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--hours") == 0) {
+            hours = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (nodes == 0 || nodes > FLOC_SIM_MAX_NODES || size == 0 || size > FLOC_MAX_SIZE ||
+        bitrate == 0 || hours == 0 || seed == 0 || load == 0 || load >= 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Keep stdout machine-readable.
+    Serial.setOutput(stderr);
+
+    floc_mac_set_modem(bitrate, FLOC_MAC_PREAMBLE_MS);
+
+    FlocTdmaConfig_t config;
+    config.slots = nodes;
+    config.max_range_m = range_m;
+    config.epoch_ms = 0;
+    config.slot_ms = 0;
+
+    // By default, room for four of the largest frames per slot
+    if (slot_ms == 0) {
+        slot_ms = 4 * floc_mac_airtime_ms(FLOC_MAX_SIZE) + FLOC_SIM_LOOP_MS +
+                  (range_m * 1000 + FLOC_MAC_SOUND_SPEED_MPS - 1) / FLOC_MAC_SOUND_SPEED_MPS;
+    }
+
+    config.slot_ms = slot_ms;
+
+    if (!floc_tdma_configure(&config)) {
+        fprintf(stderr, "slot of %u ms is too short for a %u byte frame plus the guard time\n",
+            slot_ms, FLOC_MAX_SIZE);
+        return 2;
+    }
+
+    fprintf(stderr, "slot %u ms, guard %u ms, frame airtime %u ms\n",
+        slot_ms, floc_tdma_guard_ms(), floc_mac_airtime_ms(size));
+
+    if (load > 0) {
+        run(false, nodes, size, range_m, load, hours, seed);
+        run(true, nodes, size, range_m, load, hours, seed);
+    } else {
+        static const double loads[] = { 0.05, 0.1, 0.2, 0.4, 0.8 };
+
+        for (double l : loads) {
+            run(false, nodes, size, range_m, l, hours, seed);
+            run(true, nodes, size, range_m, l, hours, seed);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * Replays a FLOC capture (see floc_capture.hpp) through the receive path.
+ *
+ * The capture is mmap'd and every RX record is fed to
+ * floc_broadcast_received() / floc_unicast_received() with the virtual
+ * clock set to the recorded timestamp, so Bloom resets and other
+ * millis()-driven behaviour line up with the original run. The node identity
+ * is taken from the capture header. After each frame the buffer manager is
+ * serviced once, as the application loop would. With --loops the Bloom
+ * filter is cleared at the start of every pass.
+ *
+ * Usage: floc_replay [--max-speed] [--loops N] capture.bin
+ *
+ * A one-line JSON summary is printed on stdout.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+
+#include <Arduino.h>
+#include <nmv3_api.hpp>
+
+#include "floc.hpp"
+#include "floc_buffer.hpp"
+#include "floc_capture.hpp"
+#include "bloomfilter.hpp"
+#include "floc_event.hpp"
+#include "floc_latency.hpp"
+
+void
+act_upon(
+    void
+){
+    /* Do Nothing */
+}
+
+// Events are drained every frame like an application loop would, but not inspected.
+static void
+ignore_event(
+    const FlocEvent_t* event
+){
+    (void) event;
+}
+
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+// One JSON line per destination the replayed node sent to.
+static void
+print_latency(
+    void
+){
+    static const char* stages[FLOC_LATENCY_STAGE_COUNT] = { "queueing", "service", "rtt" };
+    uint16_t dest_addr;
+
+    for (uint8_t i = 0; floc_latency_destination(i, &dest_addr); i++) {
+        printf("{\"dest\":%u", dest_addr);
+
+        for (int stage = 0; stage < FLOC_LATENCY_STAGE_COUNT; stage++) {
+            FlocLatencyStats_t stats;
+
+            if (!floc_latency_stats(dest_addr, (FlocLatencyStage_e) stage, &stats)) {
+                continue;
+            }
+
+            printf(",\"%s\":{\"count\":%u,\"p50_ms\":%u,\"p90_ms\":%u,\"p99_ms\":%u,\"max_ms\":%u}",
+                stages[stage], stats.count, stats.p50_ms, stats.p90_ms, stats.p99_ms, stats.max_ms);
+        }
+
+        printf("}\n");
+    }
+}
+#endif // FLOC_LATENCY
+
+static void
+usage(
+    const char* prog
+){
+    fprintf(stderr, "usage: %s [--max-speed] [--loops N] capture.bin\n", prog);
+}
+
+static void
+sleep_ms(
+    uint32_t ms
+){
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+    nanosleep(&ts, nullptr);
+}
+
+int
+main(
+    int argc,
+    char** argv
+){
+    bool max_speed = false;
+    uint32_t loops = 1;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-speed") == 0) {
+            max_speed = true;
+        } else if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+            loops = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (path == nullptr || loops == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+
+    size_t length = (size_t) st.st_size;
+    if (length < FLOC_CAPTURE_FILE_HEADER_SIZE) {
+        fprintf(stderr, "%s: too small to be a capture\n", path);
+        close(fd);
+        return 1;
+    }
+
+    const uint8_t* base = (const uint8_t*) mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    const FlocCaptureFileHeader_t* file_header = (const FlocCaptureFileHeader_t*) base;
+
+    if (memcmp(file_header->magic, FLOC_CAPTURE_MAGIC, FLOC_CAPTURE_MAGIC_SIZE) != 0 ||
+        file_header->version != FLOC_CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a version %d FLOC capture\n", path, FLOC_CAPTURE_VERSION);
+        munmap((void*) base, length);
+        return 1;
+    }
+
+    // Keep stdout for the summary.
+    Serial.setOutput(stderr);
+
+    set_network_id(file_header->network_id);
+    set_device_id(file_header->device_id);
+
+    uint64_t rx_frames = 0;
+    uint64_t events = 0;
+    uint64_t tx_recorded = 0;
+    uint64_t truncated = 0;
+    uint64_t clock_base_us = 0;
+
+    host_nmv3_reset_counts();
+    floc_event_set_handler(ignore_event);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (uint32_t loop = 0; loop < loops; loop++) {
+        size_t offset = FLOC_CAPTURE_FILE_HEADER_SIZE;
+        uint32_t first_ms = 0;
+        uint32_t last_ms = 0;
+        bool first = true;
+
+        // Otherwise every loop after the first is dropped as duplicates.
+        bloom_reset();
+
+        while (offset + FLOC_CAPTURE_RECORD_HEADER_SIZE <= length) {
+            const FlocCaptureRecordHeader_t* record = (const FlocCaptureRecordHeader_t*) (base + offset);
+            const uint8_t* frame = (const uint8_t*) (record + 1);
+
+            if (offset + FLOC_CAPTURE_RECORD_HEADER_SIZE + record->size > length) {
+                truncated++;
+                break;
+            }
+
+            offset += FLOC_CAPTURE_RECORD_HEADER_SIZE + record->size;
+
+            if (first) {
+                first_ms = record->timestamp_ms;
+                last_ms = record->timestamp_ms;
+                first = false;
+            }
+
+            // Recorded speed: wait out the gap since the previous record.
+            if (!max_speed && record->timestamp_ms > last_ms) {
+                sleep_ms(record->timestamp_ms - last_ms);
+            }
+            last_ms = record->timestamp_ms;
+
+            host_clock_set_us(clock_base_us + (uint64_t) (record->timestamp_ms - first_ms) * 1000);
+
+            if (record->direction == FLOC_CAPTURE_TX) {
+                tx_recorded++;
+                continue;
+            }
+
+            // The receive path takes a mutable buffer; the mapping is read-only.
+            uint8_t buf[256];
+            memcpy(buf, frame, record->size);
+
+            if (record->link == FLOC_CAPTURE_LINK_UNICAST) {
+                floc_unicast_received(buf, record->size);
+            } else {
+                floc_broadcast_received(buf, record->size);
+            }
+
+            flocBuffer.queueHandler();
+            events += floc_event_dispatch();
+            rx_frames++;
+        }
+
+        // Later loops continue from where this one left off in virtual time.
+        clock_base_us = host_clock_now_us() + 1000;
+    }
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    printf("{\"capture\":\"%s\",\"loops\":%u,\"rx_frames\":%llu,\"tx_recorded\":%llu,"
+           "\"events\":%llu,\"events_dropped\":%u,\"tx_replayed\":%u,\"truncated\":%llu,\"elapsed_ns\":%llu,\"ns_per_frame\":%.2f}\n",
+        path,
+        loops,
+        (unsigned long long) rx_frames,
+        (unsigned long long) tx_recorded,
+        (unsigned long long) events,
+        floc_event_dropped(),
+        host_nmv3_broadcast_count(),
+        (unsigned long long) truncated,
+        (unsigned long long) elapsed_ns,
+        rx_frames ? (double) elapsed_ns / (double) rx_frames : 0.0);
+
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+    print_latency();
+#endif // FLOC_LATENCY
+
+    munmap((void*) base, length);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Gateway-side telemetry aggregation over a capture (see floc_capture.hpp).
+ *
+ * Every received FLOC_RESPONSE_TYPE frame whose payload decodes as a
+ * telemetry part is fed into the fleet table; the latest snapshot per node
+ * and the fleet total are printed as JSON, one object per line.
+ *
+ * Usage: floc_telemetry capture.bin
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <Arduino.h>
+
+#include "floc.hpp"
+#include "floc_utils.hpp"
+#include "floc_capture.hpp"
+#include "floc_compact.hpp"
+#include "floc_telemetry.hpp"
+
+void
+act_upon(
+    void
+){
+    /* Do Nothing */
+}
+
+static const char* field_names[FLOC_TM_FIELD_COUNT] = {
+    "rx_data", "rx_command", "rx_ack", "rx_response",
+    "tx_data", "tx_command", "tx_ack", "tx_response",
+    "drop_too_small", "drop_wrong_nid", "drop_self", "drop_duplicate",
+    "drop_queue_full", "drop_ttl_expired", "drop_malformed",
+    "queue_retransmission", "queue_response", "queue_command",
+    "hwm_retransmission", "hwm_response", "hwm_command",
+    "command_acked", "command_failed",
+    "retries_1", "retries_2", "retries_3", "retries_4",
+    "retries_5", "retries_6", "retries_7", "retries_8plus",
+    "rtt_lt_125ms", "rtt_lt_250ms", "rtt_lt_500ms", "rtt_lt_1s", "rtt_lt_2s",
+    "rtt_lt_4s", "rtt_lt_8s", "rtt_lt_16s", "rtt_lt_32s", "rtt_ge_32s",
+    "dedup_fp_permille", "uptime_s",
+};
+
+static void
+print_telemetry(
+    const char* label,
+    int addr,
+    const FlocTelemetry_t* t
+){
+    printf("{\"node\":");
+    if (addr < 0) {
+        printf("\"%s\"", label);
+    } else {
+        printf("%d", addr);
+    }
+
+    for (int f = 0; f < FLOC_TM_FIELD_COUNT; f++) {
+        if (t->present & (1ULL << f)) {
+            printf(",\"%s\":%u", field_names[f], t->values[f]);
+        }
+    }
+
+    printf("}\n");
+}
+
+int
+main(
+    int argc,
+    char** argv
+){
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s capture.bin\n", argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < FLOC_CAPTURE_FILE_HEADER_SIZE) {
+        fprintf(stderr, "%s: not a capture\n", argv[1]);
+        close(fd);
+        return 1;
+    }
+
+    size_t length = (size_t) st.st_size;
+    const uint8_t* base = (const uint8_t*) mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    if (memcmp(base, FLOC_CAPTURE_MAGIC, FLOC_CAPTURE_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "%s: bad capture magic\n", argv[1]);
+        munmap((void*) base, length);
+        return 1;
+    }
+
+    size_t offset = FLOC_CAPTURE_FILE_HEADER_SIZE;
+    uint32_t parts = 0;
+
+    while (offset + FLOC_CAPTURE_RECORD_HEADER_SIZE <= length) {
+        const FlocCaptureRecordHeader_t* record = (const FlocCaptureRecordHeader_t*) (base + offset);
+        const uint8_t* frame = (const uint8_t*) (record + 1);
+
+        if (offset + FLOC_CAPTURE_RECORD_HEADER_SIZE + record->size > length) {
+            break;
+        }
+        offset += FLOC_CAPTURE_RECORD_HEADER_SIZE + record->size;
+
+        if (record->direction != FLOC_CAPTURE_RX) {
+            continue;
+        }
+
+        // Compact frames are expanded to a full header first
+        FlocPacket_t expanded;
+        const FlocPacket_t* pkt = (const FlocPacket_t*) frame;
+        uint8_t frame_size = record->size;
+
+        if (floc_compact_is_compact(frame, frame_size)) {
+            uint8_t header_size = floc_compact_decode(frame, frame_size, &expanded.header);
+
+            if (header_size == 0 || (size_t) (frame_size - header_size) > sizeof(expanded.payload)) {
+                continue;
+            }
+
+            memcpy(&expanded.payload, frame + header_size, frame_size - header_size);
+            frame_size = FLOC_HEADER_COMMON_SIZE + (frame_size - header_size);
+            pkt = &expanded;
+        }
+
+        if (frame_size < FLOC_HEADER_COMMON_SIZE + RESPONSE_HEADER_SIZE ||
+            (pkt->header.type & FLOC_TYPE_MASK) != FLOC_RESPONSE_TYPE) {
+            continue;
+        }
+
+        uint8_t size = pkt->payload.response.header.size;
+        if (FLOC_HEADER_COMMON_SIZE + RESPONSE_HEADER_SIZE + size > frame_size) {
+            continue;
+        }
+
+        host_clock_set_us((uint64_t) record->timestamp_ms * 1000);
+
+        if (floc_telemetry_fleet_ingest(ntohs(pkt->header.src_addr), pkt->payload.response.payload, size)) {
+            parts++;
+        }
+    }
+
+    munmap((void*) base, length);
+
+    for (uint8_t i = 0; i < floc_telemetry_fleet_size(); i++) {
+        const FlocTelemetryNode_t* node = floc_telemetry_fleet_node(i);
+        print_telemetry(nullptr, node->addr, &node->telemetry);
+    }
+
+    FlocTelemetry_t total;
+    floc_telemetry_fleet_total(&total);
+    print_telemetry("total", -1, &total);
+
+    fprintf(stderr, "%u telemetry parts from %u nodes\n", parts, floc_telemetry_fleet_size());
+
+    return 0;
+}
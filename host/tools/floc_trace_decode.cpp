@@ -0,0 +1,136 @@
+/*
+ * Formats FLOC trace dumps (see floc_trace.hpp) as text.
+ *
+ * The input is one or more dumps back to back, as produced by
+ * floc_trace_drain() or floc_trace_dump_serial(). Bytes that do not start a
+ * dump are skipped so a raw serial log with other output mixed in can be
+ * decoded directly.
+ *
+ * Usage: floc_trace_decode [dump.bin]   (reads stdin without an argument)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "floc.hpp"
+#include "floc_metrics.hpp"
+#include "floc_trace.hpp"
+
+static const char* packet_types[] = { "DATA", "COMMAND", "ACK", "RESPONSE" };
+
+static const char* drop_reasons[FLOC_DROP_REASON_COUNT] = {
+    "too_small", "wrong_nid", "self", "duplicate", "queue_full", "ttl_expired", "malformed",
+};
+
+static const char* queues[FLOC_QUEUE_COUNT] = { "retransmission", "response", "command" };
+
+static void
+print_record(
+    const FlocTraceRecord_t* r,
+    uint32_t base_us
+){
+    printf("%12.3f ms  ", (double) (r->timestamp_us - base_us) / 1000.0);
+
+    switch (r->event) {
+        case FLOC_TRACE_RX:
+            printf("RX       type=%s pid=%u src=%u\n", packet_types[r->a >> 6], r->a & 0x3F, r->b);
+            break;
+        case FLOC_TRACE_DROP:
+            printf("DROP     reason=%s src=%u\n",
+                r->a < FLOC_DROP_REASON_COUNT ? drop_reasons[r->a] : "?", r->b);
+            break;
+        case FLOC_TRACE_ENQUEUE:
+            printf("ENQUEUE  queue=%s depth=%u\n", r->a < FLOC_QUEUE_COUNT ? queues[r->a] : "?", r->b);
+            break;
+        case FLOC_TRACE_TX:
+            printf("TX       type=%s pid=%u size=%u\n", packet_types[r->a >> 6], r->a & 0x3F, r->b);
+            break;
+        case FLOC_TRACE_ACK:
+            printf("ACK      pid=%u src=%u\n", r->a, r->b);
+            break;
+        case FLOC_TRACE_CMD_DONE:
+            printf("CMD_DONE pid=%u transmissions=%u %s\n", r->a, r->b & 0xFF, (r->b >> 8) ? "acked" : "failed");
+            break;
+        case FLOC_TRACE_PING:
+            printf("PING     modem=%u count=%u\n", r->a, r->b);
+            break;
+        default:
+            if (r->event >= FLOC_TRACE_USER) {
+                printf("USER%-4u a=%u b=%u\n", r->event - FLOC_TRACE_USER, r->a, r->b);
+            } else {
+                printf("EVENT%-3u a=%u b=%u\n", r->event, r->a, r->b);
+            }
+            break;
+    }
+}
+
+int
+main(
+    int argc,
+    char** argv
+){
+    FILE* in = stdin;
+
+    if (argc > 1) {
+        in = fopen(argv[1], "rb");
+        if (in == nullptr) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    size_t offset = 0;
+    bool have_base = false;
+    uint32_t base_us = 0;
+
+    while (offset + sizeof(FlocTraceDumpHeader_t) <= data.size()) {
+        FlocTraceDumpHeader_t header;
+        memcpy(&header, &data[offset], sizeof(header));
+
+        if (header.magic != FLOC_TRACE_MAGIC || header.version != FLOC_TRACE_VERSION) {
+            offset++;
+            continue;
+        }
+
+        size_t records_size = (size_t) header.count * sizeof(FlocTraceRecord_t);
+        if (offset + sizeof(header) + records_size > data.size()) {
+            fprintf(stderr, "truncated dump at offset %zu\n", offset);
+            break;
+        }
+
+        offset += sizeof(header);
+
+        if (header.lost > 0) {
+            printf("-- %u records lost --\n", header.lost);
+        }
+
+        for (uint16_t i = 0; i < header.count; i++) {
+            FlocTraceRecord_t record;
+            memcpy(&record, &data[offset], sizeof(record));
+            offset += sizeof(record);
+
+            if (!have_base) {
+                base_us = record.timestamp_us;
+                have_base = true;
+            }
+
+            print_record(&record, base_us);
+        }
+    }
+
+    return 0;
+}
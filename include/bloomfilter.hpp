@@ -1,23 +1,91 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
+
+#include "floc_profile.hpp"
+
+// Two-hash bloom filter of Profile::bloom_filter_bits bits. The functions
+// below use one sized for the build's FlocProfile.
+template <typename Profile>
+class
+FlocBloomFilter {
+    public:
+        bool
+        check(
+            uint32_t key
+        ) const {
+            return (filter[hash1(key) / 8] & (1 << (hash1(key) % 8))) &&
+                   (filter[hash2(key) / 8] & (1 << (hash2(key) % 8)));
+        }
+
+        void
+        add(
+            uint32_t key
+        ){
+            filter[hash1(key) / 8] |= (1 << (hash1(key) % 8));
+            filter[hash2(key) / 8] |= (1 << (hash2(key) % 8));
+        }
+
+        // with two hashes the false positive rate is roughly (bits set / bits)^2
+        uint16_t
+        falsePositivePermille(
+            void
+        ) const {
+            uint32_t fill = 0;
+
+            for (uint16_t i = 0; i < sizeof(filter); i++) {
+                fill += __builtin_popcount(filter[i]);
+            }
+
+            return ((uint64_t) fill * fill * 1000) / ((uint64_t) bits * bits);
+        }
+
+        void
+        reset(
+            void
+        ){
+            memset(filter, 0, sizeof(filter));
+        }
+
+    private:
+        static constexpr uint16_t bits = Profile::bloom_filter_bits;
+
+        static_assert(bits > 0 && bits % 8 == 0, "The filter is whole bytes");
+
+        static uint16_t
+        hash1(
+            uint32_t key
+        ){
+            return (key * 31) % bits;
+        }
+
+        static uint16_t
+        hash2(
+            uint32_t key
+        ){
+            return ((key >> 3) ^ (key * 17)) % bits;
+        }
+
+        uint8_t filter[bits / 8] = {0};
+};
 
 uint32_t 
 hash_packet_buffer(
-    uint8_t pid, 
+    uint16_t seq, 
     uint16_t dest_addr,
     uint16_t src_addr
 );
 
 bool 
 bloom_check_packet(
-    uint8_t pid, 
+    uint16_t seq, 
     uint16_t dest_addr,
     uint16_t src_addr
 );
 
 void bloom_add_packet(
-    uint8_t pid, 
+    uint16_t seq, 
     uint16_t dest_addr,
     uint16_t src_addr
 );
@@ -27,12 +95,15 @@ bloom_add(
     uint32_t key
 );
 
-void maybe_reset_bloom_filter(
+uint16_t
+bloom_false_positive_permille(
     void
 );
 
-uint32_t
-H(
-    uint32_t a,
-    uint32_t b
+void bloom_reset(
+    void
+);
+
+void maybe_reset_bloom_filter(
+    void
 );
\ No newline at end of file
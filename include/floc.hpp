@@ -2,11 +2,17 @@
 
 #include <stdint.h>
 
+#include "floc_profile.hpp"
+
 // -- Defaults ---
-#define TTL_START 3
+#define TTL_START (FlocProfile::ttl_start)
+
+#define FLOC_INVALID_PID 0xFF // Outside the 6-bit PID space
 
 // --- Configuration (Maximum Sizes) ---
-#define FLOC_MAX_SIZE 64  // Maximum size of a complete FLOC packet
+#define FLOC_MAX_SIZE (FlocProfile::max_size)  // Maximum size of a complete FLOC packet
+
+#define FLOC_STATUS_REQUESTERS 8 // Status requests answered by one modem status reply
 
 // --- Macros for field sizes (optional, for documentation) ---
 #define FLOC_TTL_SIZE 4
@@ -18,6 +24,9 @@
 
 #define COMMAND_TYPE_SIZE 8
 
+#define DATA_SIZE_SIZE 6
+#define DATA_ENCODING_SIZE 2
+
 #define SERIAL_FLOC_TYPE_SIZE 8
 
 // --- Packet Structures ---
@@ -33,11 +42,24 @@ FlocPacketType_e : uint8_t {
     FLOC_RESPONSE_TYPE = 0x3
 };
 
+// How the payload of a data packet is to be read
+typedef enum
+DataEncoding_e : uint8_t {
+    DATA_ENCODING_PLAIN = 0x0,
+    DATA_ENCODING_FEC = 0x1,    // Erasure-coded group member (floc_fec.hpp)
+    DATA_ENCODING_FRAG = 0x2,   // Fragment of a larger transfer (floc_frag.hpp)
+    DATA_ENCODING_AGGREGATE = 0x3,  // Frames from several sources, merged by a relay (floc_aggregate.hpp)
+};
+
 typedef enum
 CommandType_e: uint8_t {  // Example
     COMMAND_TYPE_1 = 0x1,
     COMMAND_TYPE_2 = 0x2,
     // ...
+
+    // 0xF0 - 0xFF are reserved for the protocol itself
+    COMMAND_TYPE_TELEMETRY = 0xF0,  // Reply with a metrics snapshot (floc_telemetry.hpp)
+    COMMAND_TYPE_STATUS = 0xF1,     // Reply with modem address and supply voltage
 };
 
 typedef enum
@@ -50,6 +72,7 @@ typedef enum
 SerialFlocPacketType_e: uint8_t {
     SERIAL_BROADCAST_TYPE = 'B',
     SERIAL_UNICAST_TYPE   = 'U',
+    SERIAL_BATCH_TYPE     = 'M',    // Several of the above, with a checksum (floc_serial.hpp)
     // ...
 };
 
@@ -66,9 +89,37 @@ FlocHeader_t {
     uint16_t last_hop_addr;
 };
 
+// FlocHeader_t.res bits
+#define FLOC_RES_ERROR      0x1     // Response reports an error
+#define FLOC_RES_COMPACT    0x2     // Compact header (floc_compact.hpp), on the wire only
+
+// FlocHeader_t.type bits. With FLOC_TYPE_EXT set, an extension follows the
+// payload: one byte of FLOC_EXT_* flags, then the field of each flag set,
+// in bit order. Relays forward it untouched.
+#define FLOC_TYPE_MASK      0x7
+#define FLOC_TYPE_EXT       0x8
+
+#define FLOC_EXT_ACKS       0x01    // [base pid][bitmap:16], ACKs for the receiver's commands (floc_ack.hpp)
+#define FLOC_EXT_EPOCH      0x02    // [epoch], the bits of the sender's sequence number above pid
+
+#define FLOC_EXT_FLAGS_SIZE 1
+#define FLOC_EXT_ACKS_SIZE  3
+#define FLOC_EXT_EPOCH_SIZE 1
+
+// Each node numbers its frames with a sequence number whose low bits are the
+// pid. Dedup, ACK matching and retransmission counts use all of it, so the
+// pid wrapping every 64 frames does not alias. Frames without an epoch
+// extension count as epoch 0.
+#define FLOC_PID_MASK       ((1 << FLOC_PID_SIZE) - 1)
+#define FLOC_EPOCH_SIZE     8
+#define FLOC_SEQ_MASK       ((1 << (FLOC_PID_SIZE + FLOC_EPOCH_SIZE)) - 1)
+#define FLOC_SEQ(epoch, pid) ((uint16_t) (((epoch) << FLOC_PID_SIZE) | ((pid) & FLOC_PID_MASK)))
+#define FLOC_SEQ_EPOCH(seq) ((uint8_t) ((seq) >> FLOC_PID_SIZE))
+
 typedef struct
 DataHeader_t {
-    uint8_t size;
+    uint8_t size : DATA_SIZE_SIZE;
+    DataEncoding_e encoding : DATA_ENCODING_SIZE;   // Zero on nodes that predate it
 };
 
 typedef struct
@@ -85,6 +136,18 @@ AckHeader_t {
 #endif // ACK_DATA
 };
 
+// AckHeader_t.ack_pid of an aggregated ACK: the flag plus the number of
+// AckGroup_t in the payload (floc_ack.hpp)
+#define FLOC_ACK_AGGREGATE      0x80
+#define FLOC_ACK_GROUPS_MASK    0x7F
+
+typedef struct
+AckGroup_t {
+    uint16_t addr;      // Sender of the commands being ACKed
+    uint8_t base_pid;
+    uint16_t bitmap;    // Bit i also ACKs base_pid + 1 + i, mod 64
+};
+
 typedef struct
 ResponseHeader_t {
     uint8_t request_pid;
@@ -97,22 +160,49 @@ ResponseHeader_t {
 
 #define FLOC_HEADER_COMMON_SIZE (sizeof(FlocHeader_t))
 
+// Compact headers (floc_compact.hpp), without and with the last hop byte
+#define FLOC_COMPACT_HEADER_MIN_SIZE 5
+#define FLOC_COMPACT_HEADER_MAX_SIZE 6
+
+// Header bytes a payload shares the frame with. Networks that only use
+// compact headers get the bytes saved as payload.
+#ifdef FLOC_COMPACT_HEADER // FLOC_COMPACT_HEADER
+#define FLOC_HEADER_WIRE_SIZE   FLOC_COMPACT_HEADER_MAX_SIZE
+#else
+#define FLOC_HEADER_WIRE_SIZE   FLOC_HEADER_COMMON_SIZE
+#endif // FLOC_COMPACT_HEADER
+
 #define DATA_HEADER_SIZE        (sizeof(DataHeader_t))
 #define COMMAND_HEADER_SIZE     (sizeof(CommandHeader_t))
 #define ACK_HEADER_SIZE         (sizeof(AckHeader_t))
+#define ACK_GROUP_SIZE          (sizeof(AckGroup_t))
 #define RESPONSE_HEADER_SIZE    (sizeof(ResponseHeader_t))
 
-#define MAX_DATA_PAYLOAD_SIZE       (FLOC_MAX_SIZE - FLOC_HEADER_COMMON_SIZE - DATA_HEADER_SIZE)
-#define MAX_COMMAND_PAYLOAD_SIZE    (FLOC_MAX_SIZE - FLOC_HEADER_COMMON_SIZE - COMMAND_HEADER_SIZE)
+// Payload sizes for a profile (floc_profile.hpp). The packet structures
+// below are sized for the build's FlocProfile.
+template <typename Profile>
+struct
+FlocCodecSizes {
+    static constexpr uint8_t data_payload       = Profile::max_size - FLOC_HEADER_WIRE_SIZE - DATA_HEADER_SIZE;
+    static constexpr uint8_t command_payload    = Profile::max_size - FLOC_HEADER_WIRE_SIZE - COMMAND_HEADER_SIZE;
 
-// Ack packets don't have a data field in this example, but you could define a MAX_ACK_DATA_SIZE if needed.
-#ifdef ACK_DATA // ACK_DATA
-#define MAX_ACK_PAYLOAD_SIZE        (FLOC_MAX_SIZE - FLOC_HEADER_COMMON_SIZE - ACK_HEADER_SIZE)
-#else
-#define MAX_ACK_PAYLOAD_SIZE        0
-#endif //ACK_DATA
+    // Without ACK_DATA the ack payload only carries the groups of aggregated ACKs
+    static constexpr uint8_t ack_payload        = Profile::max_size - FLOC_HEADER_WIRE_SIZE - ACK_HEADER_SIZE;
 
-#define MAX_RESPONSE_PAYLOAD_SIZE   (FLOC_MAX_SIZE - FLOC_HEADER_COMMON_SIZE - RESPONSE_HEADER_SIZE)
+    static constexpr uint8_t response_payload   = Profile::max_size - FLOC_HEADER_WIRE_SIZE - RESPONSE_HEADER_SIZE;
+
+    // A FlocPacket_t, a full header and any one of the payloads with its header
+    static constexpr uint16_t packet = FLOC_HEADER_COMMON_SIZE + Profile::max_size - FLOC_HEADER_WIRE_SIZE;
+
+    static_assert(Profile::max_size >= FLOC_HEADER_COMMON_SIZE + RESPONSE_HEADER_SIZE + 8,
+                  "Frames must fit a full header and a small payload");
+    static_assert(data_payload < (1 << DATA_SIZE_SIZE), "Data payload size is a 6-bit field, max_size is at most 74 (70 compact)");
+};
+
+#define MAX_DATA_PAYLOAD_SIZE       (FlocCodecSizes<FlocProfile>::data_payload)
+#define MAX_COMMAND_PAYLOAD_SIZE    (FlocCodecSizes<FlocProfile>::command_payload)
+#define MAX_ACK_PAYLOAD_SIZE        (FlocCodecSizes<FlocProfile>::ack_payload)
+#define MAX_RESPONSE_PAYLOAD_SIZE   (FlocCodecSizes<FlocProfile>::response_payload)
 
 
 // --- Complete FLOC Packet Structures ---
@@ -131,10 +221,7 @@ CommandPacket_t {
 typedef struct
 AckPacket_t {
     AckHeader_t header;
-    // If you add data to acks
-#ifdef ACK_DATA // ACK_DATA
     uint8_t payload[MAX_ACK_PAYLOAD_SIZE];
-#endif // ACK_DATA
 };
 
 typedef struct
@@ -157,6 +244,8 @@ FlocPacket_t {
     FlocPacketVariant_u payload;
 };
 
+static_assert(sizeof(FlocPacket_t) == FlocCodecSizes<FlocProfile>::packet, "FlocCodecSizes is out of date");
+
 typedef struct
 SerialUnicastPacket_t {
     uint16_t dest_addr;
@@ -215,32 +304,17 @@ SerialFlocPacket_t {
 #ifdef ACK_DATA // ACK_DATA
 #define ACK_PACKET_ACTUAL_SIZE(pkt)         (FLOC_HEADER_COMMON_SIZE + ACK_HEADER_SIZE + (pkt)->payload.ack.header.size)
 #else
-#define ACK_PACKET_ACTUAL_SIZE(pkt)         (FLOC_HEADER_COMMON_SIZE + ACK_HEADER_SIZE)
+#define ACK_PACKET_ACTUAL_SIZE(pkt)         (FLOC_HEADER_COMMON_SIZE + ACK_HEADER_SIZE + \
+                                             (((pkt)->payload.ack.header.ack_pid & FLOC_ACK_AGGREGATE) ? \
+                                              ((pkt)->payload.ack.header.ack_pid & FLOC_ACK_GROUPS_MASK) * ACK_GROUP_SIZE : 0))
 #endif // ACK_DATA
 
 #define RESPONSE_PACKET_ACTUAL_SIZE(pkt)    (FLOC_HEADER_COMMON_SIZE + RESPONSE_HEADER_SIZE + (pkt)->payload.response.header.size)
 
 #define SERIAL_FLOC_ACTUAL_SIZE(pkt)        (SERIAL_FLOC_HEADER_SIZE + (pkt)->header.size)
 
-// ----- Device Action -----
-struct
-DeviceAction_t {
-    uint8_t modemRespType;
-    uint16_t lastHopAddr;
-    uint16_t srcAddr;
-    uint8_t flocType;
-    uint8_t commandType;
-    uint8_t dataSize;
-    uint8_t* data;
-};
-
-extern DeviceAction_t da;
-
-void
-init_da(
-    void
-);
-
+// ----- Application Hook -----
+// Received packets are delivered as events, see floc_event.hpp
 extern void
 act_upon(
     void
@@ -268,9 +342,72 @@ set_device_id(
     uint16_t new_device_id
 );
 
+uint8_t
+use_packet_id(
+    void
+);
+
+// The sequence number the next of our frames gets, and setting it on a
+// warm restart.
+uint16_t
+floc_next_seq(
+    void
+);
+
+void
+floc_set_next_seq(
+    uint16_t seq
+);
+
+// The sequence number of the last of our frames given `pid`.
+uint16_t
+floc_seq_of_pid(
+    uint8_t pid
+);
+
+// Whether our frames carry a FLOC_EXT_EPOCH extension. Nodes that predate
+// extensions drop such frames, so this is off unless enabled, by default
+// with -DFLOC_PID_EPOCH.
+void
+floc_set_epochs(
+    bool enable
+);
+
+bool
+floc_epochs(
+    void
+);
+
+void
+floc_build_header(
+    FlocPacket_t* packet,
+    uint8_t ttl,
+    FlocPacketType_e type,
+    uint16_t dest_addr,
+    bool err_packet
+);
+
+// Bytes `packet` occupies with a full header, from its type and size fields.
+// Includes the extension, if any.
+uint8_t
+floc_packet_size(
+    const FlocPacket_t* packet
+);
+
+// Bytes an extension with `ext_flags` takes, or 0 if a flag is unknown.
+uint8_t
+floc_ext_size(
+    uint8_t ext_flags
+);
+
+// Ask the local modem for its status on behalf of `requester_addr`, whose
+// request had `request_pid`. Requests that arrive before the modem answers
+// are all answered by the next floc_status_send(). The parser only calls it
+// for status commands addressed to us.
 void
 floc_status_query(
-    uint8_t dest_addr
+    uint16_t requester_addr,
+    uint8_t request_pid
 );
 
 void
@@ -280,12 +417,30 @@ floc_acknowledgement_send(
     uint16_t dest_addr
 );
 
+// Answer every pending floc_status_query() with the modem's status.
 void
 floc_status_send(
     uint8_t node_addr,
     float supply_voltage
 );
 
+// Sends `payload` once, without an ACK. Returns its packet ID, or
+// FLOC_INVALID_PID if it does not fit.
+uint8_t
+floc_data_send(
+    uint16_t dest_addr,
+    const uint8_t* payload,
+    uint8_t size
+);
+
+uint8_t
+floc_command_send(
+    uint16_t dest_addr,
+    CommandType_e command_type,
+    const uint8_t* payload,
+    uint8_t size
+);
+
 void
 floc_error_send(
     uint8_t ttl,
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+#include "floc_event.hpp"
+
+/*
+ * ACK aggregation.
+ *
+ * Each ACK costs a whole frame, and with it the modem's preamble, to carry
+ * one PID. Instead of queueing ACKs as commands arrive, they are held for up
+ * to the hold time and then sent together as one ACK packet. Its ack_pid is
+ * FLOC_ACK_AGGREGATE plus the number of AckGroup_t in the payload, and each
+ * group ACKs base_pid and every PID set in its bitmap for one command
+ * sender:
+ *
+ *   [0x80 | groups][addr][base pid][bitmap] ...
+ *
+ * A packet whose groups are all for one node is addressed to it, otherwise
+ * it is broadcast to FLOC_ACK_BROADCAST. A lone pending ACK is still sent as
+ * a plain ACK.
+ *
+ * Every node parses aggregated ACKs, but only nodes with a hold time send
+ * them. The hold time is 0 by default, which queues each ACK right away.
+ *
+ * ACKs for a node we are about to send a response or data frame to ride
+ * along with it instead, in a FLOC_EXT_ACKS header extension with one
+ * group's base pid and bitmap. That applies to ACKs still held here and to
+ * plain ACK packets still waiting in the response queue. Nodes that predate
+ * extensions drop such frames, so this is off unless enabled, by default
+ * with -DFLOC_ACK_PIGGYBACK.
+ */
+
+#ifndef FLOC_ACK_HOLD_MS
+#define FLOC_ACK_HOLD_MS        0
+#endif
+
+#define FLOC_ACK_PENDING        16      // ACKs held at once; a full table is flushed
+#define FLOC_ACK_BITMAP_SPAN    16      // PIDs after base_pid one group can cover
+#define FLOC_ACK_MAX_GROUPS     (MAX_ACK_PAYLOAD_SIZE / ACK_GROUP_SIZE)
+
+#define FLOC_ACK_BROADCAST      0xFFFF
+
+void
+floc_ack_set_hold(
+    uint16_t hold_ms
+);
+
+uint16_t
+floc_ack_hold(
+    void
+);
+
+void
+floc_ack_set_piggyback(
+    bool enable
+);
+
+bool
+floc_ack_piggyback(
+    void
+);
+
+// ACK command `pid` from `dest_addr`, now or within the hold time.
+void
+floc_ack_queue(
+    uint16_t dest_addr,
+    uint8_t pid
+);
+
+// Queue everything held now.
+void
+floc_ack_flush(
+    void
+);
+
+// Flushes once the oldest ACK has been held for the hold time. Called from
+// FLOCBufferManager::queueHandler().
+void
+floc_ack_poll(
+    void
+);
+
+uint8_t
+floc_ack_pending(
+    void
+);
+
+// Adds `pid` to `group`, which is empty while its base_pid is
+// FLOC_INVALID_PID. Fields are in host order. Returns false if `pid` is
+// outside what the group can cover.
+bool
+floc_ack_group_add(
+    AckGroup_t* group,
+    uint8_t pid
+);
+
+// Whether any ACKs for `dest_addr` are being held.
+bool
+floc_ack_holding(
+    uint16_t dest_addr
+);
+
+// Moves the ACKs held for `dest_addr` that fit into `group`.
+void
+floc_ack_take(
+    uint16_t dest_addr,
+    AckGroup_t* group
+);
+
+// Called by the ACK parser for aggregated ACKs. PIDs ACKed to us go to the
+// ack tracker and become one FLOC_ACK_TYPE event each, built from `event`.
+// Returns false if the packet is malformed.
+bool
+floc_ack_receive(
+    const FlocHeader_t* floc_header,
+    const AckPacket_t* pkt,
+    uint8_t size,
+    const FlocEvent_t* event
+);
+
+// Held ACKs as [count] and [addr:2][pid] each, for floc_persist.hpp.
+// Returns the bytes written, 0 if they do not fit.
+uint8_t
+floc_ack_save(
+    uint8_t* out,
+    uint8_t capacity
+);
+
+// Returns the bytes read, 0 if `in` is malformed.
+uint8_t
+floc_ack_restore(
+    const uint8_t* in,
+    uint8_t size
+);
+
+// Called by the receive path for a FLOC_EXT_ACKS extension on a frame for us.
+void
+floc_ack_receive_piggyback(
+    uint16_t src_addr,
+    uint8_t base_pid,
+    uint16_t bitmap,
+    const FlocEvent_t* event
+);
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+#include "floc_event.hpp"
+
+/*
+ * In-network aggregation of data packets.
+ *
+ * Near the sink every relay forwards the readings of everyone behind it,
+ * each in its own frame with its own header. With a hold window set, a
+ * relay holds the plain data frames it would forward, per destination, and
+ * sends those that arrive within the window as one frame:
+ *
+ *   [src:16][seq:16][ttl][size][payload]    once per record, back to back
+ *
+ * after a DataHeader_t with DATA_ENCODING_AGGREGATE. Each record is one of
+ * the frames: its source, the source's full sequence number, the TTL the
+ * relay received it with, and its payload. The merged frame is the relay's
+ * own, sent once like its data, with the highest TTL of its records less
+ * one. A frame that would not fit sends the held ones first, and a window
+ * that closes on a single frame forwards it unchanged.
+ *
+ * A relay that holds a merged frame of someone else's for the same
+ * destination merges its records in turn. The destination delivers every
+ * record as a data event from its source, deduplicated by source and
+ * sequence number like the frames themselves, so a reading that also
+ * arrived on its own is delivered once.
+ *
+ * Frames carrying ACKs for their destination, and FEC and fragment frames,
+ * are forwarded as they are. Held frames are not part of floc_persist
+ * snapshots, so keep the window short. The window is 0 by default, which
+ * turns this off; relays that do not aggregate still forward merged frames.
+ */
+
+#ifndef FLOC_AGGREGATE_HOLD_MS
+#define FLOC_AGGREGATE_HOLD_MS          0
+#endif
+
+#define FLOC_AGGREGATE_PENDING          2       // Destinations held for at once; the oldest is sent
+#define FLOC_AGGREGATE_RECORD_SIZE      6       // Record header, before the payload
+
+// Largest payload of a frame that can be merged
+#define FLOC_AGGREGATE_MAX_PAYLOAD      (MAX_DATA_PAYLOAD_SIZE - FLOC_AGGREGATE_RECORD_SIZE)
+
+// Longest a frame waits for others to share its frame with.
+void
+floc_aggregate_set_hold_ms(
+    uint16_t hold_ms
+);
+
+uint16_t
+floc_aggregate_hold_ms(
+    void
+);
+
+// Called by the receive path with a frame it is about to forward, `size`
+// bytes without the extension. Returns false if the frame is to be
+// forwarded as it is.
+bool
+floc_aggregate_hold(
+    const FlocPacket_t* packet,
+    uint8_t size,
+    const uint8_t* ext,
+    uint16_t seq
+);
+
+// Sends whatever is held now.
+void
+floc_aggregate_flush(
+    void
+);
+
+// Sends what has been held for the hold window. Called from
+// FLOCBufferManager::queueHandler().
+void
+floc_aggregate_poll(
+    void
+);
+
+// Called by the data packet parser. Pushes an event for each new record of
+// a merged frame for us, and returns false if the frame is malformed.
+bool
+floc_aggregate_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size,
+    const FlocEvent_t* event
+);
+
+// Called by the receive path for every frame, duplicates included. A record
+// passed on by the next hop confirms our forward of it (floc_hop.hpp).
+void
+floc_aggregate_overheard(
+    const FlocPacket_t* packet,
+    uint8_t size
+);
+
+// Frames merged into others, and merged frames sent.
+uint32_t
+floc_aggregate_merged(
+    void
+);
+
+uint32_t
+floc_aggregate_sent(
+    void
+);
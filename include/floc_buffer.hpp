@@ -5,14 +5,30 @@
 #include <queue>
 
 #include "floc.hpp"
+#include "bloomfilter.hpp"
+#include "floc_metrics.hpp"
+#include "floc_latency.hpp"
+#include "floc_mac.hpp"
 
 struct ping_device {
     uint16_t devAdd;
     uint8_t pingCount;
 };
 
+// Node-local bookkeeping that travels with a queued packet, never on the wire
+struct queue_entry {
+    FlocPacket_t packet;
+    uint16_t seq;               // Full sequence number of our own frames
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+    FlocPacketTiming_t timing;
+#endif // FLOC_LATENCY
+};
+
+// Sized by a profile (floc_profile.hpp). Built for the build's FlocProfile,
+// as FLOCBufferManager.
+template <typename Profile>
 class 
-FLOCBufferManager {
+FLOCBufferManagerT {
     public:
         void
         addPacket(
@@ -24,11 +40,31 @@ FLOCBufferManager {
             void
         );
 
+        uint16_t
+        getQueueDepth(
+            FlocQueueId_e queue
+        );
+
         void
         addAckID(
             uint8_t ackID
         );
 
+        // Queues, retry counts and received ACKs, for floc_persist.hpp.
+        // Returns the bytes written, 0 if they do not fit.
+        uint16_t
+        saveState(
+            uint8_t* out,
+            uint16_t capacity
+        );
+
+        // Replaces the queues. Returns the bytes read, 0 if `in` is malformed.
+        uint16_t
+        restoreState(
+            const uint8_t* in,
+            uint16_t size
+        );
+
         void
         addToPingList(
             uint8_t index,
@@ -79,7 +115,7 @@ FLOCBufferManager {
 
         bool
         checkAckID(
-            uint8_t ackID
+            uint16_t seq
         );
 
         bool
@@ -87,36 +123,94 @@ FLOCBufferManager {
             void
         );
 
+        void
+        transmitPacket(
+            FlocPacket_t& packet,
+            uint8_t size,
+            FlocTrafficClass_e traffic
+        );
+
+        uint8_t
+        attachAcks(
+            FlocPacket_t& packet,
+            uint8_t size
+        );
+
+        uint8_t
+        attachEpoch(
+            FlocPacket_t& packet,
+            uint8_t base_size,
+            uint8_t size,
+            uint16_t seq
+        );
+
         void
         retransmissionHandler(
             void
         );
 
-        void
+        uint8_t
+        airSize(
+            const FlocPacket_t& packet,
+            uint8_t size
+        );
+
+        uint8_t
+        responseSize(
+            const FlocPacket_t& packet
+        );
+
+        // Returns false, sending nothing, if the frame it picked is over
+        // the response airtime budget
+        bool
         responseHandler(
             void
         );
 
+        uint8_t
+        commandSize(
+            const FlocPacket_t& packet
+        );
+
         void
         commandHandler(
             void
         );
         
-        const int maxTransmissions = 5;
-        const int maxSendBuffer    = 5;
+        static constexpr uint8_t maxTransmissions = Profile::max_transmissions;
+        static constexpr uint8_t maxSendBuffer    = Profile::max_send_buffer;
 
-        ping_device pingDevice[3];
+        ping_device pingDevice[Profile::ping_devices];
 
-        std::deque<FlocPacket_t> commandBuffer;
-        std::deque<FlocPacket_t> responseBuffer;
+        std::deque<queue_entry> commandBuffer;
+        std::deque<queue_entry> responseBuffer;
 
         // this is going to be different
-        std::deque<FlocPacket_t> retransmissionBuffer;
+        std::deque<queue_entry> retransmissionBuffer;
 
-        std::map<uint8_t, int> ackIDs;
-        std::map<uint8_t, int> transmissionCounts;
+        // Keyed by full sequence number
+        std::map<uint16_t, int> ackIDs;
+        std::map<uint16_t, int> transmissionCounts;
+        std::map<uint16_t, unsigned long> lastTransmitTimes;
         
 
 };
 
+typedef FLOCBufferManagerT<FlocProfile> FLOCBufferManager;
+
 extern FLOCBufferManager flocBuffer;
+
+// RAM a profile needs, in bytes. The queues and ACK maps live on the heap;
+// `entry` is what each queued frame takes there, before allocator overhead.
+// The retransmission queue holds at most max_send_buffer + 1 frames, the
+// command and response queues whatever the application sends.
+template <typename Profile>
+struct
+FlocFootprint {
+    static constexpr uint32_t dedup    = sizeof(FlocBloomFilter<Profile>);
+    static constexpr uint32_t pings    = Profile::ping_devices * sizeof(ping_device);
+    static constexpr uint32_t entry    = sizeof(queue_entry) - sizeof(FlocPacket_t) + FlocCodecSizes<Profile>::packet;
+    static constexpr uint32_t forwards = (Profile::max_send_buffer + 1) * entry;
+
+    static constexpr uint32_t total    = dedup + pings + forwards;
+};
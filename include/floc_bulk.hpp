@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Bulk transfer sessions for long streams such as logs or images.
+ *
+ * A session keeps up to a window of data frames in flight and repeats only
+ * the ones the receiver reports missing, instead of one round trip per
+ * frame. Bulk frames share DATA_ENCODING_FRAG with floc_frag.hpp and use
+ * its other two kinds:
+ *
+ *   data: [kind:2 | session:6][seq:15 | ack now:1][chunk]
+ *   ack:  [kind:2 | session:6][next expected seq][32-bit bitmap]
+ *
+ * Sequence numbers and the ACK bitmap are big-endian; bit i of the bitmap
+ * is seq + 1 + i. A data frame with no chunk ends the stream.
+ *
+ * The receiver ACKs every FLOC_BULK_ACK_EVERY frames, on a new gap or a
+ * duplicate, at the end of the stream, and whenever the sender sets the
+ * "ack now" bit, which it does on the last frame it can send for now. A
+ * frame counts as lost once a frame sent after it is ACKed, or after the
+ * retransmission timeout. The window grows by one frame per window of ACKed
+ * frames. Once per loss episode, timeouts included, it shrinks in proportion
+ * to the measured loss rate, so steady background noise barely trims it
+ * while a fading channel backs off. The timeout follows the measured round
+ * trip and doubles after each expiry.
+ */
+
+#define FLOC_BULK_HEADER_SIZE       3
+#define FLOC_BULK_ACK_SIZE          7
+#define FLOC_BULK_CHUNK             (MAX_DATA_PAYLOAD_SIZE - FLOC_BULK_HEADER_SIZE)
+#define FLOC_BULK_SEQ_MASK          0x7FFF
+#define FLOC_BULK_ACK_NOW           0x8000
+
+#define FLOC_BULK_MAX_WINDOW        32      // Frames buffered per session on each side
+#define FLOC_BULK_MIN_WINDOW        2
+#define FLOC_BULK_INITIAL_WINDOW    4
+#define FLOC_BULK_ACK_EVERY         4
+#define FLOC_BULK_QUEUE_AHEAD       2       // Frames let into the response queue at once
+
+#define FLOC_BULK_INITIAL_RTO_MS    10000
+#define FLOC_BULK_MIN_RTO_MS        2000
+#define FLOC_BULK_MAX_RTO_MS        60000
+#define FLOC_BULK_MAX_TIMEOUTS      6       // Consecutive timeouts before the session fails
+#define FLOC_BULK_RX_TIMEOUT_MS     180000  // Idle incoming sessions are dropped
+
+#define FLOC_BULK_TX_SESSIONS       1
+#define FLOC_BULK_RX_SESSIONS       2
+
+#define FLOC_BULK_INVALID           0xFF
+
+typedef struct
+FlocBulkStats_t {
+    uint16_t window;            // Current window, in frames
+    uint32_t srtt_ms;
+    uint32_t rto_ms;
+    uint32_t frames_sent;       // Including retransmissions
+    uint32_t retransmissions;
+    uint32_t bytes_acked;
+    uint16_t loss_permille;     // Recent share of frames lost
+};
+
+// In-order stream data from `src_addr`. `size` is 0 once at the end of the
+// stream. `data` is only valid during the call.
+typedef void (*FlocBulkRxHandler_t)(
+    uint16_t src_addr,
+    uint8_t session,
+    const uint8_t* data,
+    uint8_t size
+);
+
+// An outgoing session ended, either fully ACKed or after FLOC_BULK_MAX_TIMEOUTS.
+typedef void (*FlocBulkTxHandler_t)(
+    uint16_t dest_addr,
+    uint8_t session,
+    bool delivered
+);
+
+void
+floc_bulk_set_handlers(
+    FlocBulkRxHandler_t rx_handler,
+    FlocBulkTxHandler_t tx_handler
+);
+
+// Returns a session ID, or FLOC_BULK_INVALID if FLOC_BULK_TX_SESSIONS are busy
+// or `dest_addr` is a broadcast or group address, which cannot acknowledge.
+uint8_t
+floc_bulk_open(
+    uint16_t dest_addr
+);
+
+// Copies as much of `data` into the send window as fits and returns the
+// number of bytes taken. Call again with the rest once ACKs free space.
+uint16_t
+floc_bulk_write(
+    uint8_t session,
+    const uint8_t* data,
+    uint16_t size
+);
+
+// No more writes; the stream ends after what is already written.
+void
+floc_bulk_close(
+    uint8_t session
+);
+
+bool
+floc_bulk_stats(
+    uint8_t session,
+    FlocBulkStats_t* out
+);
+
+// Sends, resends and times out. Called from FLOCBufferManager::queueHandler().
+void
+floc_bulk_poll(
+    void
+);
+
+// Called by floc_frag_receive() for the bulk kinds, for frames addressed to us.
+bool
+floc_bulk_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size
+);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Append-only binary capture of every FLOC frame crossing the receive and
+ * transmit paths.
+ *
+ * A capture is a FlocCaptureFileHeader_t followed by back-to-back records,
+ * each a FlocCaptureRecordHeader_t and `size` raw frame bytes. All
+ * multi-byte fields are little-endian (the byte order of every target we
+ * build for), so a capture buffer can be written straight to storage and
+ * read back on the host.
+ *
+ * Enable the hooks in the library with -DFLOC_CAPTURE.
+ */
+
+#define FLOC_CAPTURE_MAGIC      "FLCP"
+#define FLOC_CAPTURE_MAGIC_SIZE 4
+#define FLOC_CAPTURE_VERSION    1
+
+typedef enum
+FlocCaptureLink_e : uint8_t {
+    FLOC_CAPTURE_LINK_BROADCAST = 0x0,
+    FLOC_CAPTURE_LINK_UNICAST   = 0x1,
+    FLOC_CAPTURE_LINK_SERIAL    = 0x2,
+};
+
+typedef enum
+FlocCaptureDirection_e : uint8_t {
+    FLOC_CAPTURE_RX = 0x0,
+    FLOC_CAPTURE_TX = 0x1,
+};
+
+#pragma pack(push, 1)
+
+typedef struct
+FlocCaptureFileHeader_t {
+    char     magic[FLOC_CAPTURE_MAGIC_SIZE];
+    uint8_t  version;
+    uint8_t  res;
+    uint16_t network_id;
+    uint16_t device_id;
+};
+
+typedef struct
+FlocCaptureRecordHeader_t {
+    uint32_t timestamp_ms;
+    uint8_t  link;
+    uint8_t  direction;
+    uint8_t  size;
+};
+
+#pragma pack(pop)
+
+#define FLOC_CAPTURE_FILE_HEADER_SIZE   (sizeof(FlocCaptureFileHeader_t))
+#define FLOC_CAPTURE_RECORD_HEADER_SIZE (sizeof(FlocCaptureRecordHeader_t))
+
+// Start a capture into `buf`. Returns false if the buffer cannot even hold
+// the file header.
+bool
+floc_capture_begin(
+    uint8_t* buf,
+    uint32_t capacity
+);
+
+// Detach the capture buffer; recording becomes a no-op.
+void
+floc_capture_end(
+    void
+);
+
+void
+floc_capture_record(
+    FlocCaptureLink_e link,
+    FlocCaptureDirection_e direction,
+    const uint8_t* frame,
+    uint8_t size
+);
+
+// Bytes written so far, including the file header.
+uint32_t
+floc_capture_length(
+    void
+);
+
+// Records that did not fit in the buffer.
+uint32_t
+floc_capture_dropped(
+    void
+);
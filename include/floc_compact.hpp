@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Compact header mode.
+ *
+ * A network that enables it sends 5 or 6 header bytes instead of the 9 of
+ * FlocHeader_t:
+ *
+ *   [type:4 | ttl:4][nid hash:4 | flags:4][dest][res:2 | pid:6][src][last hop]
+ *
+ * The network ID is reduced to a 4-bit hash and checked against our own,
+ * addresses are 8-bit indexes into a table shared by the whole network, and
+ * the last hop is left out while a packet is still on its first hop (last
+ * hop == source). The res/pid byte sits at the same offset as in the full
+ * header, and FLOC_RES_COMPACT in it marks the frame as compact, so
+ * receivers accept both forms at all times.
+ *
+ * Without an address table, addresses below 0xFF map to themselves.
+ * Headers whose addresses cannot be mapped are sent in full.
+ */
+
+#define FLOC_COMPACT_LAST_HOP       0x10    // flags: last hop byte present
+
+#define FLOC_COMPACT_BROADCAST      0xFF    // Stands for 0xFFFF
+
+#ifndef FLOC_COMPACT_ADDRESSES
+#define FLOC_COMPACT_ADDRESSES      32      // Address table entries, at most 0xFF
+#endif
+
+// Use compact headers for frames we send. On by default with -DFLOC_COMPACT_HEADER.
+void
+floc_compact_enable(
+    bool enable
+);
+
+bool
+floc_compact_enabled(
+    void
+);
+
+// Map `short_addr` to `device_id` for the whole network. Returns false if
+// `short_addr` is outside the table.
+bool
+floc_compact_set_address(
+    uint8_t short_addr,
+    uint16_t device_id
+);
+
+// Back to identity mapping.
+void
+floc_compact_clear_addresses(
+    void
+);
+
+uint8_t
+floc_compact_nid_hash(
+    uint16_t nid
+);
+
+// True if `frame` starts with a compact header.
+bool
+floc_compact_is_compact(
+    const uint8_t* frame,
+    uint8_t size
+);
+
+// Writes the compact form of `header` to `out` and returns its size, or 0
+// if an address has no short form.
+uint8_t
+floc_compact_encode(
+    const FlocHeader_t* header,
+    uint8_t* out
+);
+
+// Rebuilds a full header (in network order, like a received one) and
+// returns the number of bytes consumed, or 0 if the frame is malformed or
+// uses an unknown short address. The network ID is taken to be ours; check
+// floc_compact_nid_hash() first.
+uint8_t
+floc_compact_decode(
+    const uint8_t* frame,
+    uint8_t size,
+    FlocHeader_t* header
+);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Command dispatch table.
+ *
+ * Every CommandType_e has a slot in a 256-entry table, so dispatching a
+ * received command is one indexed lookup no matter how many types are
+ * registered. A slot holds the handler plus what the parser checks before
+ * calling it: whether an ACK is owed and the accepted payload sizes.
+ * Commands are only ACKed and handled by the node they are addressed to, or
+ * by the members of the group they are addressed to. Relays just forward
+ * them, whether or not they have registered the type.
+ *
+ * The library registers COMMAND_TYPE_1, COMMAND_TYPE_2 and the reserved
+ * protocol commands itself. Applications add their own at startup:
+ *
+ *     floc_dispatch_register(MY_COMMAND, my_handler, FLOC_DISPATCH_NEEDS_ACK, 4, 4, 0);
+ */
+
+#define FLOC_DISPATCH_REGISTERED    0x01
+#define FLOC_DISPATCH_NEEDS_ACK     0x02
+
+// What a handler sees. `data` points into the received frame and is only
+// valid for the duration of the call.
+typedef struct
+FlocCommandContext_t {
+    uint16_t src_addr;
+    uint8_t pid;
+    CommandType_e command_type;
+    uint8_t priority;
+    const uint8_t* data;
+    uint8_t size;
+};
+
+typedef void (*FlocCommandHandler_t)(const FlocCommandContext_t* ctx);
+
+typedef struct
+FlocCommandEntry_t {
+    FlocCommandHandler_t handler;   // May be null: the command is only ACKed and queued as an event
+    uint8_t flags;
+    uint8_t min_size;
+    uint8_t max_size;
+    uint8_t priority;               // Application-defined, passed through to the handler
+};
+
+// Replaces whatever was registered for `command_type`. Returns false if
+// min_size > max_size or max_size exceeds MAX_COMMAND_PAYLOAD_SIZE.
+bool
+floc_dispatch_register(
+    CommandType_e command_type,
+    FlocCommandHandler_t handler,
+    uint8_t flags,
+    uint8_t min_size,
+    uint8_t max_size,
+    uint8_t priority
+);
+
+void
+floc_dispatch_unregister(
+    CommandType_e command_type
+);
+
+// Never null; unregistered types have flags == 0.
+const FlocCommandEntry_t*
+floc_dispatch_lookup(
+    uint8_t command_type
+);
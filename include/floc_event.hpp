@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Parsed-packet events.
+ *
+ * floc_broadcast_received() and floc_unicast_received() push one event per
+ * valid packet into a bounded ring. Each event owns a copy of its payload,
+ * so the receive buffer can be reused immediately and a burst of frames is
+ * kept until the application gets to it.
+ *
+ * Events are consumed either one at a time:
+ *
+ *     FlocEvent_t event;
+ *     while (floc_event_pop(&event)) { ... }
+ *
+ * or by registering a handler and calling floc_event_dispatch() once per
+ * loop iteration. If the ring is full, the newest event is dropped and
+ * counted.
+ *
+ * The ring has one producer (the receive path) and one consumer (the
+ * application loop).
+ */
+
+#ifndef FLOC_EVENT_QUEUE_DEPTH
+#define FLOC_EVENT_QUEUE_DEPTH  8   // Must be a power of two
+#endif
+
+// Slots are indexed with a mask, and head and tail are 8-bit counters
+static_assert(FLOC_EVENT_QUEUE_DEPTH > 0 && (FLOC_EVENT_QUEUE_DEPTH & (FLOC_EVENT_QUEUE_DEPTH - 1)) == 0 &&
+              FLOC_EVENT_QUEUE_DEPTH <= 128, "FLOC_EVENT_QUEUE_DEPTH must be a power of two, at most 128");
+
+#define FLOC_EVENT_NONE         0xFF
+
+typedef struct
+FlocEvent_t {
+    uint8_t flocType;       // FlocPacketType_e
+    uint8_t commandType;    // Only for FLOC_COMMAND_TYPE
+    uint8_t pid;
+    uint8_t requestPid;     // Only for FLOC_ACK_TYPE (acked pid) and FLOC_RESPONSE_TYPE
+    uint16_t srcAddr;
+    uint16_t destAddr;
+    uint16_t lastHopAddr;
+    uint8_t dataSize;
+    uint8_t data[FLOC_MAX_SIZE - FLOC_HEADER_WIRE_SIZE];
+};
+
+typedef void (*FlocEventHandler_t)(const FlocEvent_t* event);
+
+// Called by the receive path. Returns false if the ring was full.
+bool
+floc_event_push(
+    const FlocEvent_t* event
+);
+
+// Copies the oldest event into `event`; returns false if there is none.
+bool
+floc_event_pop(
+    FlocEvent_t* event
+);
+
+uint8_t
+floc_event_count(
+    void
+);
+
+void
+floc_event_set_handler(
+    FlocEventHandler_t handler
+);
+
+// Hands every queued event to the registered handler, oldest first, and
+// returns how many were handled. Without a handler, events stay queued.
+uint8_t
+floc_event_dispatch(
+    void
+);
+
+// Events dropped because the ring was full, since the last clear.
+uint32_t
+floc_event_dropped(
+    void
+);
+
+void
+floc_event_clear(
+    void
+);
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+#include "floc_event.hpp"
+
+/*
+ * Forward error correction for data packets.
+ *
+ * Frames on our link are either received intact or lost, so FEC here is an
+ * erasure code across a group of frames: k data packets are followed by m
+ * parity packets, and any k of the k + m recover the whole group. The code
+ * is a systematic Reed-Solomon code over GF(2^8) with a Cauchy generator
+ * matrix, using log/exp tables and integer arithmetic only.
+ *
+ * FEC packets are data packets with DATA_ENCODING_FEC, so nodes that do not
+ * decode them still forward them. After the DataHeader_t they carry
+ *
+ *   data:   [group][index]              [payload]
+ *   parity: [group][0x80 | j][k:4 | m:4][parity over the shards]
+ *
+ * Each shard is [payload length][payload], zero padded to the longest
+ * payload in the group. Data shards are delivered as soon as they arrive;
+ * missing ones are delivered once enough parity has arrived to rebuild them.
+ */
+
+#define FLOC_FEC_MAX_K              8
+#define FLOC_FEC_MAX_M              4
+
+#define FLOC_FEC_DATA_HEADER_SIZE   2
+#define FLOC_FEC_PARITY_HEADER_SIZE 3
+#define FLOC_FEC_PARITY_FLAG        0x80
+
+// Largest payload per FEC data packet, leaving room for the length byte in parity shards
+#define FLOC_FEC_MAX_PAYLOAD        (MAX_DATA_PAYLOAD_SIZE - FLOC_FEC_PARITY_HEADER_SIZE - 1)
+#define FLOC_FEC_MAX_SHARD          (FLOC_FEC_MAX_PAYLOAD + 1)
+
+#define FLOC_FEC_RX_GROUPS          2       // Groups being reassembled at once
+#define FLOC_FEC_GROUP_TIMEOUT_MS   120000  // Give up on an incomplete group
+#define FLOC_FEC_FLUSH_MS           30000   // Send parity for a partial group after this
+
+// ----- Codec -----
+
+// Computes `m` parity shards of `len` bytes from `k` data shards.
+void
+floc_fec_encode(
+    const uint8_t* const* data,
+    uint8_t k,
+    uint8_t m,
+    uint8_t len,
+    uint8_t* const* parity
+);
+
+// `shards` holds k data shards followed by m parity shards, `present` has a
+// bit for each one that was received. Missing data shards are rebuilt in
+// place. Returns false if fewer than k shards are present.
+bool
+floc_fec_decode(
+    uint8_t* const* shards,
+    uint16_t present,
+    uint8_t k,
+    uint8_t m,
+    uint8_t len
+);
+
+// ----- Packets -----
+
+// Groups of `k` data packets get `m` parity packets. Defaults to k = 4, m = 2.
+bool
+floc_fec_configure(
+    uint8_t k,
+    uint8_t m
+);
+
+// Queue `payload` as the next data packet of the current group for
+// `dest_addr`, which may be FLOC_ACK_BROADCAST or a group; every node, or
+// every member, then decodes it. Returns its packet ID, or FLOC_INVALID_PID
+// if it is larger than FLOC_FEC_MAX_PAYLOAD.
+uint8_t
+floc_fec_send(
+    uint16_t dest_addr,
+    const uint8_t* payload,
+    uint8_t size
+);
+
+// Send parity for the current group now, even if it has fewer than k packets.
+void
+floc_fec_flush(
+    void
+);
+
+// Flushes groups that have waited FLOC_FEC_FLUSH_MS. Called from FLOCBufferManager::queueHandler().
+void
+floc_fec_poll(
+    void
+);
+
+// Called by the data packet parser. Fills `event` for a data shard, pushes
+// events for rebuilt shards, and returns false if the packet is malformed.
+// Packets for other nodes, and for groups we are not in, are left alone to
+// be forwarded.
+bool
+floc_fec_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size,
+    FlocEvent_t* event
+);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Fragmentation and reassembly of payloads larger than one data packet.
+ *
+ * A transfer is split into fragments of FLOC_FRAG_CHUNK bytes, each sent
+ * once as a data packet with DATA_ENCODING_FRAG. After the DataHeader_t
+ * they carry
+ *
+ *   data: [kind:2 | xfer:6][index][last index][chunk]
+ *   nack: [kind:2 | xfer:6][bitmap of missing fragments, LSB first]
+ *
+ * The receiver reserves count * FLOC_FRAG_CHUNK bytes of a fixed pool when
+ * it first hears of a transfer and copies every fragment straight to its
+ * final offset there. Whenever the last fragment arrives and others are
+ * missing, it answers with a NACK bitmap, and the sender resends only those.
+ * A NACK with no bitmap means the transfer is complete. If the sender hears
+ * nothing after sending everything, it resends the last fragment as a probe.
+ *
+ * The sender does not copy the payload either: fragments are built from the
+ * caller's buffer as queue space frees up, so it must stay valid until the
+ * transfer's completion handler runs.
+ */
+
+#define FLOC_FRAG_HEADER_SIZE       3
+#define FLOC_FRAG_CHUNK             (MAX_DATA_PAYLOAD_SIZE - FLOC_FRAG_HEADER_SIZE)
+#define FLOC_FRAG_MAX_FRAGMENTS     256     // 8-bit fragment index
+#define FLOC_FRAG_XFER_MASK         0x3F
+
+#define FLOC_FRAG_POOL_SIZE         4096    // Reassembly pool, shared by all incoming transfers
+#define FLOC_FRAG_RX_SESSIONS       4
+#define FLOC_FRAG_TX_SESSIONS       2
+#define FLOC_FRAG_DONE_HISTORY      4       // Finished transfers remembered, to re-ACK late probes
+
+// Largest transfer a receiver with an empty pool can take
+#define FLOC_FRAG_MAX_COUNT         (FLOC_FRAG_POOL_SIZE / FLOC_FRAG_CHUNK < FLOC_FRAG_MAX_FRAGMENTS ? \
+                                     FLOC_FRAG_POOL_SIZE / FLOC_FRAG_CHUNK : FLOC_FRAG_MAX_FRAGMENTS)
+#define FLOC_FRAG_MAX_SIZE          (FLOC_FRAG_MAX_COUNT * FLOC_FRAG_CHUNK)
+
+#define FLOC_FRAG_QUEUE_AHEAD       2       // Fragments let into the response queue at once
+#define FLOC_FRAG_PROBE_MS          20000   // Silence after the last fragment before probing
+#define FLOC_FRAG_MAX_PROBES        5
+#define FLOC_FRAG_RX_TIMEOUT_MS     180000  // Idle incoming transfers are dropped
+
+#define FLOC_FRAG_INVALID           0xFF
+
+typedef enum
+FlocFragKind_e : uint8_t {
+    FLOC_FRAG_KIND_DATA = 0x0,
+    FLOC_FRAG_KIND_NACK = 0x1,
+    FLOC_FRAG_KIND_BULK = 0x2,      // Bulk session data (floc_bulk.hpp)
+    FLOC_FRAG_KIND_BULK_ACK = 0x3,
+};
+
+// A complete incoming transfer. `data` points into the reassembly pool and
+// is only valid during the call.
+typedef void (*FlocFragRxHandler_t)(
+    uint16_t src_addr,
+    uint8_t xfer,
+    const uint8_t* data,
+    uint16_t size
+);
+
+// An outgoing transfer finished, and its buffer may be reused.
+typedef void (*FlocFragTxHandler_t)(
+    uint16_t dest_addr,
+    uint8_t xfer,
+    bool delivered
+);
+
+void
+floc_frag_set_handlers(
+    FlocFragRxHandler_t rx_handler,
+    FlocFragTxHandler_t tx_handler
+);
+
+// Start sending `size` bytes to `dest_addr`. Returns the transfer ID, or
+// FLOC_FRAG_INVALID if it is empty, larger than FLOC_FRAG_MAX_SIZE, all
+// FLOC_FRAG_TX_SESSIONS are busy, or `dest_addr` is a broadcast or group
+// address: NACKs only work with one receiver.
+uint8_t
+floc_frag_send(
+    uint16_t dest_addr,
+    const uint8_t* data,
+    uint16_t size
+);
+
+// Feeds queued fragments, probes and timeouts. Called from FLOCBufferManager::queueHandler().
+void
+floc_frag_poll(
+    void
+);
+
+// Called by the data packet parser. Returns false if the packet is malformed.
+bool
+floc_frag_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size
+);
+
+uint8_t
+floc_frag_tx_active(
+    void
+);
+
+uint8_t
+floc_frag_rx_active(
+    void
+);
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Multicast groups.
+ *
+ * Destination addresses FLOC_GROUP_FIRST to FLOC_GROUP_LAST name groups
+ * rather than devices. A node joins any number of them; membership is a
+ * bitmap, so checking a received frame is one bit test. Members read group
+ * frames like frames addressed to them, ACKing group commands. Everyone
+ * else only forwards them.
+ *
+ * Relays learn where members are from their ACKs. A relay that forwards a
+ * group command remembers it. An ACK for it passing back through the relay
+ * shows that the group has members beyond, and group frames keep being
+ * forwarded while that was heard within FLOC_GROUP_ROUTE_TIMEOUT_MS. If no
+ * ACK comes back within FLOC_GROUP_ACK_WAIT_MS, the branch has no members.
+ * Group frames then stop at this relay until the route timeout passes and
+ * the next command probes again. A relay with no information forwards, so
+ * data-only groups still flood.
+ *
+ * floc_group_command_send() commands a whole group with one frame. It is
+ * retried like any command until every expected member has ACKed, and the
+ * callback gets who did.
+ */
+
+#define FLOC_GROUP_FIRST                0xFE00
+#define FLOC_GROUP_LAST                 0xFEFF
+#define FLOC_GROUP_COUNT                (FLOC_GROUP_LAST - FLOC_GROUP_FIRST + 1)
+
+#ifndef FLOC_GROUP_ROUTE_TIMEOUT_MS
+#define FLOC_GROUP_ROUTE_TIMEOUT_MS     (10UL * 60 * 1000)
+#endif
+
+#ifndef FLOC_GROUP_ACK_WAIT_MS
+#define FLOC_GROUP_ACK_WAIT_MS          15000
+#endif
+
+#define FLOC_GROUP_ROUTES               16      // Groups a relay keeps track of; the stalest is dropped
+#define FLOC_GROUP_FORWARDS             8       // Group commands a relay watches ACKs for
+#define FLOC_GROUP_COLLECTS             4       // Group commands of ours collecting ACKs at once
+#define FLOC_GROUP_MAX_MEMBERS          16      // ACKs one collection keeps track of
+
+static inline
+bool
+floc_group_is(
+    uint16_t addr
+){
+    return addr >= FLOC_GROUP_FIRST && addr <= FLOC_GROUP_LAST;
+}
+
+// Returns false if `group_addr` is not a group address.
+bool
+floc_group_join(
+    uint16_t group_addr
+);
+
+void
+floc_group_leave(
+    uint16_t group_addr
+);
+
+bool
+floc_group_member(
+    uint16_t group_addr
+);
+
+// ----- Forwarding -----
+
+// Whether a group frame we did not send should be forwarded. Called by the
+// receive path; commands are remembered to learn from their ACKs.
+bool
+floc_group_forward(
+    const FlocHeader_t* header
+);
+
+// An ACK from someone else for `base_pid`, and every pid set in `bitmap`
+// after it, of commands sent by `commander`. Called by the receive path.
+void
+floc_group_ack_overheard(
+    uint16_t commander,
+    uint8_t base_pid,
+    uint16_t bitmap
+);
+
+// Group frames a relay did not forward because no member was beyond it.
+uint32_t
+floc_group_pruned(
+    void
+);
+
+// ----- Collecting ACKs -----
+
+typedef struct
+FlocGroupResult_t {
+    uint16_t group_addr;
+    uint8_t pid;
+    bool complete;                              // Every expected member ACKed
+    uint8_t acked_count;
+    uint16_t acked[FLOC_GROUP_MAX_MEMBERS];
+};
+
+typedef void (*FlocGroupCallback_t)(const FlocGroupResult_t* result, void* ctx);
+
+// Sends one command to `group_addr`. With `members`, retries stop as soon as
+// all of them have ACKed. Without, the command is sent the profile's
+// max_transmissions times, and the result lists whoever ACKed. The callback
+// runs once, when the command leaves the command queue. Returns the PID, or
+// FLOC_INVALID_PID if it could not be queued.
+uint8_t
+floc_group_command_send(
+    uint16_t group_addr,
+    CommandType_e command_type,
+    const uint8_t* payload,
+    uint8_t size,
+    const uint16_t* members,
+    uint8_t member_count,
+    FlocGroupCallback_t callback,
+    void* ctx
+);
+
+// An ACK addressed to us. Returns false if `pid` is not a group command of
+// ours, which leaves the ACK to the command queue.
+bool
+floc_group_acked(
+    uint16_t src_addr,
+    uint8_t pid
+);
+
+// Called by FLOCBufferManager::commandHandler() when a group command runs
+// out of transmissions.
+void
+floc_group_command_done(
+    uint8_t pid
+);
+
+uint8_t
+floc_group_collecting(
+    void
+);
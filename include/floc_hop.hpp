@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Implicit hop ACKs.
+ *
+ * Only the final destination ACKs, so a relay cannot tell whether its
+ * forward reached the next hop. It can hear the next hop forward it on,
+ * though: the same src and pid, from a last hop other than us and with a
+ * lower TTL than we sent. A relay that forwarded the same frame alongside
+ * us sends it with the same TTL, so it does not count.
+ *
+ * After forwarding a frame from the retransmission queue the node watches
+ * for that for up to the hop timeout. If nothing is heard, the frame is
+ * queued for forwarding once more. Frames for a known neighbor are not
+ * watched, since their destination does not forward them, and neither are
+ * frames whose TTL leaves the next hop nothing to forward.
+ *
+ * The timeout is 0 by default, which turns this off.
+ */
+
+#ifndef FLOC_HOP_TIMEOUT_MS
+#define FLOC_HOP_TIMEOUT_MS     0
+#endif
+
+#define FLOC_HOP_PENDING        8       // Frames watched at once; the oldest is given up on
+
+void
+floc_hop_set_timeout(
+    uint32_t timeout_ms
+);
+
+uint32_t
+floc_hop_timeout(
+    void
+);
+
+// Called by FLOCBufferManager::retransmissionHandler() with the frame as it
+// was received, before its TTL was decremented.
+void
+floc_hop_forwarded(
+    const FlocPacket_t* packet
+);
+
+// Called by the receive path for every frame, duplicates included.
+void
+floc_hop_overheard(
+    const FlocHeader_t* header
+);
+
+// Re-forwards frames nobody was heard forwarding. Called from
+// FLOCBufferManager::queueHandler().
+void
+floc_hop_poll(
+    void
+);
+
+uint8_t
+floc_hop_pending(
+    void
+);
+
+// Forwards confirmed by overhearing, and forwards sent a second time.
+uint32_t
+floc_hop_confirmed(
+    void
+);
+
+uint32_t
+floc_hop_reforwarded(
+    void
+);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Per-packet latency tracing.
+ *
+ * With -DFLOC_LATENCY every queued packet carries a FlocPacketTiming_t that
+ * stays on the node: when it was queued, first and last sent, and when its
+ * ACK arrived. Finished packets are folded into per-destination sample
+ * rings, from which queueing delay, service time (first to last send, i.e.
+ * time spent retrying) and ACK round-trip percentiles are computed.
+ */
+
+#define FLOC_LATENCY_DESTINATIONS   8   // Destinations tracked, least recently used is evicted
+#define FLOC_LATENCY_SAMPLES        32  // Samples kept per destination and stage
+
+#define FLOC_TIMING_ENQUEUED        0x01
+#define FLOC_TIMING_SENT            0x02
+#define FLOC_TIMING_ACKED           0x04
+
+typedef enum
+FlocLatencyStage_e : uint8_t {
+    FLOC_LATENCY_QUEUEING = 0x0,    // enqueue -> first send
+    FLOC_LATENCY_SERVICE,           // first send -> last send
+    FLOC_LATENCY_RTT,               // last send -> ACK
+    FLOC_LATENCY_STAGE_COUNT
+};
+
+typedef struct
+FlocPacketTiming_t {
+    uint8_t flags;
+    unsigned long enqueue_ms;
+    unsigned long first_tx_ms;
+    unsigned long last_tx_ms;
+    unsigned long ack_ms;
+};
+
+typedef struct
+FlocLatencyStats_t {
+    uint16_t count;
+    uint16_t p50_ms;
+    uint16_t p90_ms;
+    uint16_t p99_ms;
+    uint16_t max_ms;
+};
+
+// Fold a finished packet into the stats for `dest_addr`.
+void
+floc_latency_record(
+    uint16_t dest_addr,
+    const FlocPacketTiming_t* timing
+);
+
+// Returns false if nothing has been recorded for this destination and stage.
+bool
+floc_latency_stats(
+    uint16_t dest_addr,
+    FlocLatencyStage_e stage,
+    FlocLatencyStats_t* out
+);
+
+// Iterate tracked destinations; returns false past the last one.
+bool
+floc_latency_destination(
+    uint8_t index,
+    uint16_t* dest_addr
+);
+
+void
+floc_latency_reset(
+    void
+);
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Channel access.
+ *
+ * By default FLOCBufferManager::queueHandler() transmits whenever it has a
+ * frame, so neighbors that happen to send at once collide. TDMA mode
+ * divides time into superframes of `slots` slots of `slot_ms` each, counted
+ * from `epoch_ms`, and a node only starts a frame inside its own slot. The
+ * frame must end at least a guard time before the slot does, so that its
+ * last bit has reached every neighbor before the next slot opens. The guard
+ * is the propagation delay over `max_range_m` at the speed of sound in
+ * water.
+ *
+ * A node's slot is its device ID modulo `slots`, unless set explicitly.
+ * Nodes must agree on the configuration and keep their millis() clocks
+ * aligned to within the guard time, e.g. by adjusting `epoch_ms` from a
+ * shared time source.
+ *
+ * Airtime estimates use the modem bitrate and a fixed per-frame preamble.
+ *
+ * Airtime budgets cap how much of the channel each traffic class may use,
+ * with a token bucket per class that fills at `share_permille` of real time
+ * up to `burst_ms` of airtime. FLOC_TRAFFIC_ALL is a further bucket that
+ * every frame is charged to, capping the node as a whole. A class whose
+ * bucket cannot pay for its next frame is skipped, and lower priority
+ * classes may send instead. A frame is let through with a full bucket even
+ * if it costs more than `burst_ms`, leaving the bucket in debt. Every class
+ * is unlimited until given a budget.
+ */
+
+#ifndef FLOC_MAC_BITRATE_BPS
+#define FLOC_MAC_BITRATE_BPS        1000
+#endif
+
+#ifndef FLOC_MAC_PREAMBLE_MS
+#define FLOC_MAC_PREAMBLE_MS        0
+#endif
+
+#define FLOC_MAC_SOUND_SPEED_MPS    1500
+#define FLOC_MAC_PING_SIZE          8       // Airtime of a modem ping, as a frame size
+
+#define FLOC_MAC_UNLIMITED          0       // share_permille of a class without a budget
+
+#define FLOC_TDMA_OFF               0   // FlocTdmaConfig_t.slots
+
+typedef enum
+FlocTrafficClass_e : uint8_t {
+    FLOC_TRAFFIC_FORWARD = 0x0,     // Other nodes' packets we relay
+    FLOC_TRAFFIC_RESPONSE,          // Our responses, ACKs and data
+    FLOC_TRAFFIC_COMMAND,
+    FLOC_TRAFFIC_RANGING,           // Modem pings
+    FLOC_TRAFFIC_ALL,               // Every frame, on top of its own class
+    FLOC_TRAFFIC_CLASS_COUNT
+};
+
+typedef struct
+FlocTdmaConfig_t {
+    uint8_t slots;              // Slots per superframe, FLOC_TDMA_OFF to transmit freely
+    uint32_t slot_ms;
+    uint16_t max_range_m;       // Farthest neighbor, sets the guard time
+    uint32_t epoch_ms;          // millis() at the start of a superframe
+};
+
+// Bitrate and per-frame overhead used for airtime estimates.
+void
+floc_mac_set_modem(
+    uint32_t bitrate_bps,
+    uint16_t preamble_ms
+);
+
+uint32_t
+floc_mac_airtime_ms(
+    uint8_t size
+);
+
+// Returns false, and leaves the current mode alone, if a slot cannot hold
+// a FLOC_MAX_SIZE frame plus the guard time.
+bool
+floc_tdma_configure(
+    const FlocTdmaConfig_t* config
+);
+
+bool
+floc_tdma_enabled(
+    void
+);
+
+uint32_t
+floc_tdma_guard_ms(
+    void
+);
+
+// Override the slot derived from the device ID.
+void
+floc_tdma_set_slot(
+    uint8_t slot
+);
+
+uint8_t
+floc_tdma_slot(
+    void
+);
+
+// Milliseconds from `now_ms` until `slot` may start a frame of `size`
+// bytes, 0 if it may start now.
+uint32_t
+floc_tdma_wait_ms(
+    uint32_t now_ms,
+    uint8_t slot,
+    uint8_t size
+);
+
+// Whether queueHandler() may transmit now. Always true outside TDMA mode.
+bool
+floc_mac_clear_to_send(
+    void
+);
+
+// Let `traffic` use up to `share_permille` of the channel, in bursts of up
+// to `burst_ms` of airtime. FLOC_MAC_UNLIMITED removes the budget.
+void
+floc_mac_set_budget(
+    FlocTrafficClass_e traffic,
+    uint16_t share_permille,
+    uint32_t burst_ms
+);
+
+// Whether the budgets of `traffic` and FLOC_TRAFFIC_ALL cover a frame of
+// `size` bytes now.
+bool
+floc_mac_budget_allows(
+    FlocTrafficClass_e traffic,
+    uint8_t size
+);
+
+// Airtime left in the bucket of `traffic`, negative while in debt.
+int32_t
+floc_mac_budget_ms(
+    FlocTrafficClass_e traffic
+);
+
+// Called by FLOCBufferManager for every frame and ping sent.
+void
+floc_mac_sent(
+    FlocTrafficClass_e traffic,
+    uint8_t size
+);
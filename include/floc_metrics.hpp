@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Always-on protocol metrics.
+ *
+ * Every counter lives in one fixed struct updated in place by the receive
+ * and transmit paths. Updates are bracketed by a sequence counter so that
+ * floc_metrics_snapshot() can take a consistent copy from another context
+ * (a timer, the other core) without stopping the loop.
+ */
+
+#define FLOC_METRICS_VERSION        1
+
+#define FLOC_METRICS_PACKET_TYPES   4   // FLOC_DATA_TYPE .. FLOC_RESPONSE_TYPE
+#define FLOC_METRICS_RETRY_BUCKETS  8   // commands acked after 1..8+ transmissions
+#define FLOC_METRICS_RTT_BUCKETS    10  // < 125ms, < 250ms, ... , >= 32s
+#define FLOC_METRICS_RTT_BASE_MS    125
+
+#define FLOC_METRICS_SNAPSHOT_TRIES 8
+
+typedef enum
+FlocDropReason_e : uint8_t {
+    FLOC_DROP_TOO_SMALL = 0x0,  // Shorter than its headers claim
+    FLOC_DROP_WRONG_NID,        // Another network's traffic
+    FLOC_DROP_SELF,             // Our own frame forwarded back to us
+    FLOC_DROP_DUPLICATE,        // Bloom filter hit
+    FLOC_DROP_QUEUE_FULL,       // No room in a transmit queue or the event queue
+    FLOC_DROP_TTL_EXPIRED,      // Would have been forwarded with TTL 0
+    FLOC_DROP_MALFORMED,        // Unknown packet or command type
+    FLOC_DROP_REASON_COUNT
+};
+
+typedef enum
+FlocQueueId_e : uint8_t {
+    FLOC_QUEUE_RETRANSMISSION = 0x0,
+    FLOC_QUEUE_RESPONSE,
+    FLOC_QUEUE_COMMAND,
+    FLOC_QUEUE_COUNT
+};
+
+typedef struct
+FlocMetrics_t {
+    uint32_t rx[FLOC_METRICS_PACKET_TYPES];
+    uint32_t tx[FLOC_METRICS_PACKET_TYPES];
+    uint32_t drops[FLOC_DROP_REASON_COUNT];
+    uint16_t queue_hwm[FLOC_QUEUE_COUNT];
+    uint32_t command_acked;
+    uint32_t command_failed;
+    uint32_t retries[FLOC_METRICS_RETRY_BUCKETS];
+    uint32_t ack_rtt[FLOC_METRICS_RTT_BUCKETS];
+};
+
+extern FlocMetrics_t flocMetrics;
+extern volatile uint32_t flocMetricsSeq;
+
+// --- Update helpers (hot path) ---
+
+static inline void
+floc_metrics_write_begin(
+    void
+){
+    flocMetricsSeq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+floc_metrics_write_end(
+    void
+){
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    flocMetricsSeq++;
+}
+
+static inline void
+floc_metrics_rx(
+    uint8_t type
+){
+    if (type >= FLOC_METRICS_PACKET_TYPES) {
+        return;
+    }
+
+    floc_metrics_write_begin();
+    flocMetrics.rx[type]++;
+    floc_metrics_write_end();
+}
+
+static inline void
+floc_metrics_tx(
+    uint8_t type
+){
+    if (type >= FLOC_METRICS_PACKET_TYPES) {
+        return;
+    }
+
+    floc_metrics_write_begin();
+    flocMetrics.tx[type]++;
+    floc_metrics_write_end();
+}
+
+static inline void
+floc_metrics_drop(
+    FlocDropReason_e reason
+){
+    floc_metrics_write_begin();
+    flocMetrics.drops[reason]++;
+    floc_metrics_write_end();
+}
+
+static inline void
+floc_metrics_queue_depth(
+    FlocQueueId_e queue,
+    uint32_t depth
+){
+    if (depth <= flocMetrics.queue_hwm[queue]) {
+        return;
+    }
+
+    floc_metrics_write_begin();
+    flocMetrics.queue_hwm[queue] = depth > 0xFFFF ? 0xFFFF : (uint16_t) depth;
+    floc_metrics_write_end();
+}
+
+// A command left the command buffer after `transmissions` sends.
+void
+floc_metrics_command_done(
+    int transmissions,
+    bool acked
+);
+
+void
+floc_metrics_ack_rtt(
+    unsigned long rtt_ms
+);
+
+// --- Readout ---
+
+// Copies a consistent view of the counters. Returns false if the writer kept
+// interfering (e.g. called from an interrupt that preempted an update).
+bool
+floc_metrics_snapshot(
+    FlocMetrics_t* out
+);
+
+void
+floc_metrics_reset(
+    void
+);
+
+// Binary dump: [version][size][FlocMetrics_t, little-endian]. Returns the
+// number of bytes written, or 0 if `capacity` is too small.
+uint16_t
+floc_metrics_serialize(
+    uint8_t* buf,
+    uint16_t capacity
+);
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Warm restart from a snapshot in non-volatile storage.
+ *
+ * A snapshot holds the sequence counter, the transmit queues with their
+ * retry counts and received ACKs, and the ACKs held for aggregation. It is
+ * taken into RAM every FLOC_PERSIST_INTERVAL_MS and written out
+ * FLOC_PERSIST_CHUNK bytes per queueHandler() call, so the loop never waits
+ * on storage.
+ *
+ * The store has two slots. A snapshot goes to the slot that does not hold
+ * the newest one, and its header is written last, so a reset mid-write
+ * leaves the previous snapshot intact. floc_persist_restore() loads the
+ * valid slot with the higher generation.
+ *
+ * Frames sent after the last snapshot would reuse sequence numbers after a
+ * restore, and neighbors would drop them as duplicates. The counter is
+ * therefore saved FLOC_PERSIST_SEQ_RESERVE ahead, and a new snapshot starts
+ * once half of the last written one's reserve is used. The other half has to
+ * last until the new snapshot is written, which takes up to
+ * FLOC_PERSIST_WRITE_POLLS queueHandler() calls, so the reserve is sized for
+ * FLOC_PERSIST_SEQ_PER_POLL frames of our own per call. A node that sends
+ * more than that while a snapshot is written can reuse sequence numbers
+ * after a restore; raise FLOC_PERSIST_SEQ_PER_POLL for it.
+ *
+ * Snapshots are in host byte order; only the node that wrote one reads it.
+ */
+
+#ifndef FLOC_PERSIST_INTERVAL_MS
+#define FLOC_PERSIST_INTERVAL_MS    30000
+#endif
+
+#ifndef FLOC_PERSIST_CHUNK
+#define FLOC_PERSIST_CHUNK          64      // Bytes written per queueHandler() call
+#endif
+
+#ifndef FLOC_PERSIST_SEQ_PER_POLL
+#define FLOC_PERSIST_SEQ_PER_POLL   2       // Most frames of our own per queueHandler() call
+#endif
+
+#define FLOC_PERSIST_MAGIC          0x53504C46  // "FLPS"
+#define FLOC_PERSIST_VERSION        1
+#define FLOC_PERSIST_SLOT_SIZE      1536        // Header included
+#define FLOC_PERSIST_SLOTS          2
+
+// Taking the snapshot and erasing the slot, each chunk of the largest body,
+// and the header
+#define FLOC_PERSIST_WRITE_POLLS    (2 + (FLOC_PERSIST_SLOT_SIZE + FLOC_PERSIST_CHUNK - 1) / FLOC_PERSIST_CHUNK)
+#define FLOC_PERSIST_SEQ_RESERVE    (2 * FLOC_PERSIST_WRITE_POLLS * FLOC_PERSIST_SEQ_PER_POLL)
+
+#pragma pack(push, 1)
+
+typedef struct
+FlocPersistHeader_t {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  res;
+    uint16_t size;              // Of the body after the header
+    uint32_t generation;
+    uint16_t crc;               // CRC-16/CCITT of the body
+};
+
+#pragma pack(pop)
+
+#define FLOC_PERSIST_HEADER_SIZE    (sizeof(FlocPersistHeader_t))
+
+// Platform storage. Offsets are within one slot. `erase` is called before a
+// slot is rewritten and `sync` after a snapshot's header has been written;
+// either may be nullptr.
+typedef struct
+FlocPersistStore_t {
+    void* ctx;
+    bool (*read)(void* ctx, uint8_t slot, uint16_t offset, uint8_t* data, uint16_t size);
+    bool (*write)(void* ctx, uint8_t slot, uint16_t offset, const uint8_t* data, uint16_t size);
+    bool (*erase)(void* ctx, uint8_t slot);
+    void (*sync)(void* ctx);
+};
+
+// Use `store` for snapshots from now on. It must stay valid.
+void
+floc_persist_begin(
+    const FlocPersistStore_t* store
+);
+
+void
+floc_persist_end(
+    void
+);
+
+// Loads the newest valid snapshot. Call once at startup, after setting the
+// device and network IDs and before any traffic. Returns false, leaving
+// everything as it was, if there is none.
+bool
+floc_persist_restore(
+    void
+);
+
+// Start a snapshot at the next poll, e.g. before a planned power-down.
+void
+floc_persist_request(
+    void
+);
+
+// Called from FLOCBufferManager::queueHandler().
+void
+floc_persist_poll(
+    void
+);
+
+bool
+floc_persist_busy(
+    void
+);
+
+// Of the newest snapshot written or restored, 0 if none.
+uint32_t
+floc_persist_generation(
+    void
+);
+
+#ifdef __linux__ // __linux__
+// A store backed by a file of FLOC_PERSIST_SLOTS slots, mapped into memory.
+// The file is created if needed.
+bool
+floc_persist_mmap_open(
+    const char* path,
+    FlocPersistStore_t* store
+);
+
+void
+floc_persist_mmap_close(
+    void
+);
+#endif // __linux__
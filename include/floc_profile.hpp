@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Compile-time protocol profiles.
+ *
+ * A profile is a type whose static constexpr members size the protocol for
+ * one kind of deployment: the modem's largest frame, how far frames travel,
+ * how hard commands are retried and how much RAM the queues and dedup
+ * filter get. The buffer manager, the dedup filter and the codec's payload
+ * sizes take it as a template parameter, so a build is sized exactly for
+ * its hardware without any runtime cost.
+ *
+ * Each build uses one profile, FLOC_PROFILE, which defaults to
+ * FlocProfileDefault. A deployment with its own profile defines it in a
+ * header and builds with, e.g.
+ *
+ *   -DFLOC_PROFILE_HEADER='"my_profile.hpp"' -DFLOC_PROFILE=MyProfile
+ *
+ * FlocFootprint<Profile> (floc_buffer.hpp) reports the RAM a profile needs.
+ *
+ * max_size is at most 74 bytes, or 70 with FLOC_COMPACT_HEADER: the data
+ * header's size field is 6 bits, so a data payload holds at most 63 bytes.
+ * Modems with larger frames still work, FLOC just does not fill them.
+ */
+
+// The sizes this library was written with.
+struct
+FlocProfileDefault {
+    static constexpr uint8_t max_size           = 64;   // Largest frame the modem sends, header included; at most 74
+    static constexpr uint8_t ttl_start          = 3;
+    static constexpr uint8_t max_transmissions  = 5;    // Of a command, and pings per device
+    static constexpr uint8_t max_send_buffer    = 5;    // Frames held for forwarding, plus one
+    static constexpr uint16_t bloom_filter_bits = 64;
+    static constexpr uint8_t ping_devices       = 3;    // Devices ranged in one ranging period
+};
+
+// Small leaf nodes: short frames, few hops and little RAM.
+struct
+FlocProfileSmall {
+    static constexpr uint8_t max_size           = 32;
+    static constexpr uint8_t ttl_start          = 2;
+    static constexpr uint8_t max_transmissions  = 3;
+    static constexpr uint8_t max_send_buffer    = 2;
+    static constexpr uint16_t bloom_filter_bits = 32;
+    static constexpr uint8_t ping_devices       = 1;
+};
+
+#ifdef FLOC_PROFILE_HEADER // FLOC_PROFILE_HEADER
+#include FLOC_PROFILE_HEADER
+#endif // FLOC_PROFILE_HEADER
+
+#ifndef FLOC_PROFILE
+#define FLOC_PROFILE FlocProfileDefault
+#endif
+
+typedef FLOC_PROFILE FlocProfile;
+
+static_assert(FlocProfile::ttl_start > 0 && FlocProfile::ttl_start < 16, "TTL is a 4-bit field");
+static_assert(FlocProfile::max_transmissions > 0, "Commands must be sent at least once");
+static_assert(FlocProfile::ping_devices > 0, "The ping table needs a slot");
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Request/response correlation.
+ *
+ * Every request this node sends that expects a FLOC_RESPONSE_TYPE answer is
+ * tracked by (peer, pid) together with a deadline and a callback. Since our
+ * own PIDs are 6 bits, the table has one slot per PID and a response is
+ * matched with a single indexed lookup. Any number of peers can be queried
+ * at once, as long as fewer than FLOC_PID_SPACE requests are in flight.
+ *
+ * The callback runs once per matching response part and once more with
+ * FLOC_REQUEST_TIMEOUT if the deadline passes first. Returning true from it
+ * completes the request; returning false keeps waiting for more parts.
+ */
+
+#define FLOC_PID_SPACE          64  // 6-bit packet IDs
+#define FLOC_STATUS_TIMEOUT_MS  60000
+
+typedef enum
+FlocRequestResult_e : uint8_t {
+    FLOC_REQUEST_OK = 0x0,
+    FLOC_REQUEST_ERROR,     // Error response, or our command was never ACKed
+    FLOC_REQUEST_TIMEOUT,
+};
+
+typedef bool (*FlocResponseCallback_t)(
+    uint16_t peer,
+    uint8_t pid,
+    FlocRequestResult_e result,
+    const uint8_t* data,
+    uint8_t size,
+    void* ctx
+);
+
+// Start tracking request `pid` sent to `peer`. A still-pending request with
+// the same PID (one that is FLOC_PID_SPACE requests old) times out first.
+void
+floc_request_track(
+    uint16_t peer,
+    uint8_t pid,
+    uint32_t timeout_ms,
+    FlocResponseCallback_t callback,
+    void* ctx
+);
+
+// Feed a received response. Returns true if it answered a tracked request.
+bool
+floc_request_complete(
+    uint16_t peer,
+    uint8_t request_pid,
+    FlocRequestResult_e result,
+    const uint8_t* data,
+    uint8_t size
+);
+
+// floc_command_send() plus floc_request_track(). Returns the PID, or
+// FLOC_INVALID_PID if the command could not be queued.
+uint8_t
+floc_command_request(
+    uint16_t dest_addr,
+    CommandType_e command_type,
+    const uint8_t* payload,
+    uint8_t size,
+    uint32_t timeout_ms,
+    FlocResponseCallback_t callback,
+    void* ctx
+);
+
+// Ask `dest_addr` for its modem status (COMMAND_TYPE_STATUS). The callback
+// gets the floc_status_send() payload: modem address, then supply voltage.
+uint8_t
+floc_status_request(
+    uint16_t dest_addr,
+    FlocResponseCallback_t callback,
+    void* ctx
+);
+
+void
+floc_request_cancel(
+    uint16_t peer,
+    uint8_t pid
+);
+
+// Expire requests past their deadline. Called from FLOCBufferManager::queueHandler().
+void
+floc_request_poll(
+    void
+);
+
+uint8_t
+floc_request_pending(
+    void
+);
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Serial framing between the Nest and its Burd.
+ *
+ * A plain frame is the direction prefix, a SerialFlocHeader_t and the
+ * payload of one packet: the FLOC packet, after its big-endian destination
+ * for SERIAL_UNICAST_TYPE. A SERIAL_BATCH_TYPE frame carries several. Its
+ * payload is back-to-back records, each a SerialFlocHeader_t and payload
+ * exactly as in a plain frame, and ends in a big-endian CRC-16/CCITT over
+ * the batch header and records. The header's size counts the CRC, so a
+ * batch is at most 255 bytes after its header.
+ *
+ * The encoder holds packets for up to the batch deadline, so a burst shares
+ * one prefix, header and turnaround. A packet that would not fit sends the
+ * batch first. A batch holding one packet goes out as a plain frame, and a
+ * deadline of 0, the default, sends every packet on its own as before.
+ *
+ * The decoder does not copy: records point into the caller's buffer.
+ */
+
+#ifndef FLOC_SERIAL_BATCH_MS
+#define FLOC_SERIAL_BATCH_MS        0
+#endif
+
+#define SERIAL_FLOC_CRC_SIZE        2
+#define SERIAL_FLOC_BATCH_MAX_SIZE  0xFF    // Records and CRC, bounded by SerialFlocHeader_t.size
+#define SERIAL_FLOC_FRAME_MAX_SIZE  (SERIAL_FLOC_PRE_SIZE + SERIAL_FLOC_HEADER_SIZE + SERIAL_FLOC_BATCH_MAX_SIZE)
+
+// Writes one frame to the serial port.
+typedef void (*FlocSerialWrite_t)(void* ctx, const uint8_t* frame, uint16_t size);
+
+// Frames go out through `write`, prefixed for `direction`.
+void
+floc_serial_begin(
+    SerialFlocPacketDirection_e direction,
+    FlocSerialWrite_t write,
+    void* ctx
+);
+
+// Longest a packet waits for others to share its frame.
+void
+floc_serial_set_batch_ms(
+    uint16_t batch_ms
+);
+
+uint16_t
+floc_serial_batch_ms(
+    void
+);
+
+// Returns false if the packet is larger than FLOC_MAX_SIZE.
+bool
+floc_serial_send_broadcast(
+    const uint8_t* packet,
+    uint8_t size
+);
+
+bool
+floc_serial_send_unicast(
+    uint16_t dest_addr,
+    const uint8_t* packet,
+    uint8_t size
+);
+
+// Sends whatever is held now.
+void
+floc_serial_flush(
+    void
+);
+
+// Sends the held packets once the oldest has waited the batch deadline.
+// Call from the application loop.
+void
+floc_serial_poll(
+    void
+);
+
+// Frames and packets sent, to see how well bursts batch.
+uint32_t
+floc_serial_frames_sent(
+    void
+);
+
+uint32_t
+floc_serial_packets_sent(
+    void
+);
+
+typedef struct
+FlocSerialReader_t {
+    const uint8_t* next;
+    const uint8_t* end;
+};
+
+typedef struct
+FlocSerialRecord_t {
+    SerialFlocPacketType_e type;    // SERIAL_BROADCAST_TYPE or SERIAL_UNICAST_TYPE
+    uint16_t dest_addr;             // Unicast only
+    const uint8_t* packet;          // The FLOC packet, in the frame's buffer
+    uint8_t size;
+};
+
+// Bytes of the frame starting at `buf`, or 0 until its prefix and header
+// are in. For finding frame boundaries in a byte stream.
+uint16_t
+floc_serial_frame_size(
+    const uint8_t* buf,
+    uint16_t size
+);
+
+// Checks a complete frame and starts reading its records from it. Returns
+// false if the frame is malformed or its CRC does not match.
+bool
+floc_serial_open(
+    FlocSerialReader_t* reader,
+    const uint8_t* frame,
+    uint16_t size
+);
+
+// Returns false once there are no more records.
+bool
+floc_serial_next(
+    FlocSerialReader_t* reader,
+    FlocSerialRecord_t* record
+);
+
+// Frames floc_serial_open() rejected.
+uint32_t
+floc_serial_rejected(
+    void
+);
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+
+/*
+ * Remote telemetry over FLOC response packets.
+ *
+ * A COMMAND_TYPE_TELEMETRY command makes the node it is addressed to answer
+ * with its metrics in one or more FLOC_RESPONSE_TYPE packets. Relays only
+ * forward the command, so one query gets one answer. Each part is
+ *
+ *   [version][last:1 | part:7][first field][LEB128 value]...
+ *
+ * where the values are the FlocTelemetryField_e entries in order, starting
+ * at `first field`. Parts are cut on field boundaries so every one decodes
+ * on its own, and small counters cost a single byte.
+ */
+
+#define FLOC_TELEMETRY_VERSION      1
+#define FLOC_TELEMETRY_PART_HEADER  3
+#define FLOC_TELEMETRY_LAST_PART    0x80
+
+#define FLOC_TELEMETRY_TIMEOUT_MS   60000   // How long to accept parts of one answer
+#define FLOC_TELEMETRY_FLEET_SIZE   16  // Nodes tracked by the gateway aggregator
+
+typedef enum
+FlocTelemetryField_e : uint8_t {
+    FLOC_TM_RX_DATA = 0,
+    FLOC_TM_RX_COMMAND,
+    FLOC_TM_RX_ACK,
+    FLOC_TM_RX_RESPONSE,
+    FLOC_TM_TX_DATA,
+    FLOC_TM_TX_COMMAND,
+    FLOC_TM_TX_ACK,
+    FLOC_TM_TX_RESPONSE,
+    FLOC_TM_DROP_TOO_SMALL,
+    FLOC_TM_DROP_WRONG_NID,
+    FLOC_TM_DROP_SELF,
+    FLOC_TM_DROP_DUPLICATE,
+    FLOC_TM_DROP_QUEUE_FULL,
+    FLOC_TM_DROP_TTL_EXPIRED,
+    FLOC_TM_DROP_MALFORMED,
+    FLOC_TM_QUEUE_RETRANSMISSION,
+    FLOC_TM_QUEUE_RESPONSE,
+    FLOC_TM_QUEUE_COMMAND,
+    FLOC_TM_HWM_RETRANSMISSION,
+    FLOC_TM_HWM_RESPONSE,
+    FLOC_TM_HWM_COMMAND,
+    FLOC_TM_COMMAND_ACKED,
+    FLOC_TM_COMMAND_FAILED,
+    FLOC_TM_RETRIES_FIRST,                                                  // 1 transmission
+    FLOC_TM_RETRIES_LAST = FLOC_TM_RETRIES_FIRST + 7,                       // 8+ transmissions
+    FLOC_TM_RTT_FIRST,                                                      // < 125ms
+    FLOC_TM_RTT_LAST = FLOC_TM_RTT_FIRST + 9,                               // >= 32s
+    FLOC_TM_DEDUP_FP_PERMILLE,                                              // Bloom false-positive estimate
+    FLOC_TM_UPTIME_S,
+    FLOC_TM_FIELD_COUNT
+};
+
+typedef struct
+FlocTelemetry_t {
+    uint32_t values[FLOC_TM_FIELD_COUNT];
+    uint64_t present;   // Bit per field received so far
+};
+
+typedef struct
+FlocTelemetryNode_t {
+    uint16_t addr;
+    unsigned long updated_ms;
+    FlocTelemetry_t telemetry;
+};
+
+// --- Node side ---
+
+void
+floc_telemetry_collect(
+    FlocTelemetry_t* out
+);
+
+// Encodes fields from `*field` onward into one part. Advances `*field` past
+// what fit and returns the part size.
+uint8_t
+floc_telemetry_encode(
+    const FlocTelemetry_t* telemetry,
+    uint8_t part,
+    uint8_t* field,
+    uint8_t* buf,
+    uint8_t capacity
+);
+
+// Queue the response parts for a telemetry request addressed to us.
+void
+floc_telemetry_send(
+    uint16_t dest_addr,
+    uint8_t request_pid
+);
+
+// --- Gateway side ---
+
+// Sends COMMAND_TYPE_TELEMETRY to `dest_addr`. The answer's parts are fed
+// into the fleet table as they arrive (see floc_request.hpp).
+void
+floc_telemetry_request(
+    uint16_t dest_addr
+);
+
+// Merges one part into `out`. Returns false if the part is malformed.
+bool
+floc_telemetry_decode(
+    const uint8_t* buf,
+    uint8_t size,
+    FlocTelemetry_t* out,
+    bool* last_part
+);
+
+// Feed a decoded part from `src_addr` into the fleet table.
+bool
+floc_telemetry_fleet_ingest(
+    uint16_t src_addr,
+    const uint8_t* data,
+    uint8_t size
+);
+
+const FlocTelemetryNode_t*
+floc_telemetry_fleet_node(
+    uint8_t index
+);
+
+uint8_t
+floc_telemetry_fleet_size(
+    void
+);
+
+// Field-wise sum over all tracked nodes (queue depths and high-water marks
+// are maxima instead).
+void
+floc_telemetry_fleet_total(
+    FlocTelemetry_t* out
+);
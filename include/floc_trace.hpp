@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Binary trace ring.
+ *
+ * FLOC_TRACE() stores a fixed 8-byte record (timestamp, event, two args) in
+ * a RAM ring and returns; nothing is formatted on the node. The ring keeps
+ * the most recent FLOC_TRACE_DEPTH records and is drained on demand, with
+ * host/tools/floc_trace_decode turning a dump back into text.
+ *
+ * Tracing is on by default. Build with -DFLOC_TRACE_OFF to compile every
+ * tracepoint out.
+ */
+
+#ifndef FLOC_TRACE_DEPTH
+#define FLOC_TRACE_DEPTH    128 // Records, must be a power of two
+#endif
+
+#define FLOC_TRACE_MAGIC    0xF7
+#define FLOC_TRACE_VERSION  1
+
+// Packs a packet type and PID into one trace argument
+#define FLOC_TRACE_TYPE_PID(type, pid)  ((uint8_t) ((((type) & 0x3) << 6) | ((pid) & 0x3F)))
+
+typedef enum
+FlocTraceEvent_e : uint8_t {
+    FLOC_TRACE_NONE = 0x00,
+    FLOC_TRACE_RX,          // a: type/pid, b: src addr
+    FLOC_TRACE_DROP,        // a: FlocDropReason_e, b: src addr (0 if unknown)
+    FLOC_TRACE_ENQUEUE,     // a: FlocQueueId_e, b: depth after enqueue
+    FLOC_TRACE_TX,          // a: type/pid, b: frame size
+    FLOC_TRACE_ACK,         // a: acked pid, b: src addr
+    FLOC_TRACE_CMD_DONE,    // a: pid, b: transmissions | acked << 8
+    FLOC_TRACE_PING,        // a: modem id, b: ping count
+    FLOC_TRACE_USER = 0x80, // 0x80 - 0xFF are free for the application
+};
+
+#pragma pack(push, 1)
+
+typedef struct
+FlocTraceRecord_t {
+    uint32_t timestamp_us;
+    uint8_t  event;
+    uint8_t  a;
+    uint16_t b;
+};
+
+// Dump header, followed by `count` records
+typedef struct
+FlocTraceDumpHeader_t {
+    uint8_t  magic;
+    uint8_t  version;
+    uint16_t count;
+    uint32_t lost;
+};
+
+#pragma pack(pop)
+
+static_assert((FLOC_TRACE_DEPTH & (FLOC_TRACE_DEPTH - 1)) == 0, "FLOC_TRACE_DEPTH must be a power of two");
+
+#ifndef FLOC_TRACE_OFF // FLOC_TRACE_OFF
+#define FLOC_TRACE(event, a, b)     floc_trace_write((event), (uint8_t) (a), (uint16_t) (b))
+#else
+#define FLOC_TRACE(event, a, b)     do {} while (0)
+#endif // FLOC_TRACE_OFF
+
+void
+floc_trace_write(
+    uint8_t event,
+    uint8_t a,
+    uint16_t b
+);
+
+// Copies records not yet drained, oldest first, behind a FlocTraceDumpHeader_t.
+// Returns the bytes written.
+uint16_t
+floc_trace_drain(
+    uint8_t* buf,
+    uint16_t capacity
+);
+
+// Writes the same dump straight to Serial.
+void
+floc_trace_dump_serial(
+    void
+);
+
+void
+floc_trace_reset(
+    void
+);
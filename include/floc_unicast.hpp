@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "floc.hpp"
+#include "floc_mac.hpp"
+
+/*
+ * Unicast to neighbors.
+ *
+ * Every frame normally goes out through broadcast(), so each neighbor
+ * decodes it, deduplicates it and, unless it is the destination, forwards
+ * it. When the destination is a node we have heard directly, the frame can
+ * instead be addressed to its modem with unicast(). No other node processes
+ * it, and the modem reports whether it arrived.
+ *
+ * Neighbors are the last hops of frames we receive, and are forgotten after
+ * FLOC_NEIGHBOR_TIMEOUT_MS without hearing from them or when a unicast to
+ * them fails. The application passes the modem's delivery reports to
+ * floc_unicast_delivered(). A delivered command counts as ACKed, so it is
+ * not retransmitted. A response or data frame that was not delivered is
+ * broadcast once by queueHandler(), and commands fall back to broadcast on
+ * their next retry.
+ *
+ * Nodes whose floc_unicast_received() does nothing never see unicast frames,
+ * so this is off unless enabled, by default with -DFLOC_UNICAST.
+ */
+
+#ifndef FLOC_NEIGHBOR_TIMEOUT_MS
+#define FLOC_NEIGHBOR_TIMEOUT_MS    (10UL * 60 * 1000)
+#endif
+
+#define FLOC_NEIGHBOR_MAX           8       // The oldest is replaced when full
+
+typedef struct
+FlocUnicastFrame_t {
+    FlocTrafficClass_e traffic;
+    uint8_t size;
+    uint8_t frame[FLOC_MAX_SIZE];           // As it went on the air
+};
+
+void
+floc_unicast_set_enabled(
+    bool enable
+);
+
+bool
+floc_unicast_enabled(
+    void
+);
+
+// Called by the receive path with the last hop of every valid frame.
+void
+floc_neighbor_heard(
+    uint16_t addr
+);
+
+bool
+floc_neighbor_known(
+    uint16_t addr
+);
+
+void
+floc_neighbor_forget(
+    uint16_t addr
+);
+
+uint8_t
+floc_neighbor_count(
+    void
+);
+
+// Sends `frame` to the modem of the header's destination if it is a known
+// neighbor. Returns false, having sent nothing, if it must be broadcast.
+// Called by FLOCBufferManager::transmitPacket().
+bool
+floc_unicast_send(
+    const FlocHeader_t* header,
+    uint8_t* frame,
+    uint8_t size,
+    FlocTrafficClass_e traffic
+);
+
+// The modem's delivery report for the last unicast to `modem_id`.
+void
+floc_unicast_delivered(
+    uint8_t modem_id,
+    bool delivered
+);
+
+// Takes a frame whose unicast failed and that should now be broadcast.
+// Called from FLOCBufferManager::queueHandler().
+bool
+floc_unicast_take_failed(
+    FlocUnicastFrame_t* out
+);
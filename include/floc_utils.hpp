@@ -28,6 +28,8 @@ printBufferContents(
     uint8_t* buf,
     uint8_t size
 ){
+    static const char hex[] = "0123456789ABCDEF";
+
     if (buf == nullptr){
         Serial.printf("\tOops! The buffer is a null pointer!\r\n"); 
         return;
@@ -39,44 +41,56 @@ printBufferContents(
     }
 
     // Header line
-    Serial.printf("=== %zu bytes ===\n", size);
+    Serial.printf("=== %u bytes ===\n", size);
     
-    // Process 16 bytes per line
+    // Process 16 bytes per line, formatted locally and written with one call
+    // per line so the dump disturbs timing as little as possible
     for (size_t i = 0; i < size; i += 16) {
         size_t chunk_size = (size - i < 16) ? (size - i) : 16;
-        
+
+        // "AAAA: " + 16 * "XX " (padded) + " |" + 16 ASCII + "|\n"
+        char line[6 + 48 + 2 + 16 + 3];
+        char* p = line;
+
         // Print address
-        Serial.printf("%04zX: ", i);
-        
-        // Print hex bytes
-        for (size_t j = 0; j < chunk_size; j++) {
-            Serial.printf("%02X", buf[i + j]);
-            if (j < chunk_size - 1) {
-                Serial.printf(" ");
+        *p++ = hex[(i >> 12) & 0xF];
+        *p++ = hex[(i >> 8) & 0xF];
+        *p++ = hex[(i >> 4) & 0xF];
+        *p++ = hex[i & 0xF];
+        *p++ = ':';
+        *p++ = ' ';
+
+        // Print hex bytes, padding the hex section to 47 characters
+        for (size_t j = 0; j < 16; j++) {
+            if (j < chunk_size) {
+                *p++ = hex[buf[i + j] >> 4];
+                *p++ = hex[buf[i + j] & 0xF];
+            } else {
+                *p++ = ' ';
+                *p++ = ' ';
+            }
+
+            if (j < 15) {
+                *p++ = ' ';
             }
         }
-        
-        // Pad hex section to 48 characters if needed
-        size_t hex_chars = chunk_size * 3 - 1; // 2 chars per byte + spaces, minus last space
-        for (size_t pad = hex_chars; pad < 47; pad++) {
-            Serial.printf(" ");
-        }
-        
+
         // Print separator
-        Serial.printf(" |");
-        
+        *p++ = ' ';
+        *p++ = '|';
+
         // Print ASCII representation
         for (size_t j = 0; j < chunk_size; j++) {
             unsigned char b = buf[i + j];
-            if (b >= 32 && b <= 126) {
-                Serial.printf("%c", b);
-            } else {
-                Serial.printf(".");
-            }
+            *p++ = (b >= 32 && b <= 126) ? (char) b : '.';
         }
-        
+
         // Close ASCII section and newline
-        Serial.printf("|\n");
+        *p++ = '|';
+        *p++ = '\n';
+        *p = '\0';
+
+        Serial.printf("%s", line);
     }
 }
 
@@ -94,4 +108,26 @@ ntohs(
     uint16_t val
 ){
     return __builtin_bswap16(val);
-}
\ No newline at end of file
+}
+
+// CRC-16/CCITT-FALSE, a nibble at a time
+static inline
+uint16_t
+floc_crc16(
+    const uint8_t* data,
+    uint16_t size
+){
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    };
+
+    uint16_t crc = 0xFFFF;
+
+    for (uint16_t i = 0; i < size; i++) {
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0xF)];
+    }
+
+    return crc;
+}
@@ -25,30 +25,7 @@
 #include "bloomfilter.hpp"
 #include "floc.hpp"
 
-#define BLOOM_FILTER_BITS 64
-#define BLOOM_FILTER_BYTES (BLOOM_FILTER_BITS / 8)
-
-static uint8_t bloom_filter[BLOOM_FILTER_BYTES] = {0};
-
-uint8_t 
-hash1(
-    uint32_t key
-) {
-    return (key * 31) % 64;
-}
-
-uint8_t 
-hash2(
-    uint32_t key
-) {
-    return ((key >> 3) ^ (key * 17)) % 64;
-}
-
-bool bloom_check(uint32_t key) {
-    return (bloom_filter[hash1(key) / 8] & (1 << (hash1(key) % 8))) &&
-           (bloom_filter[hash2(key) / 8] & (1 << (hash2(key) % 8)));
-}
-
+static FlocBloomFilter<FlocProfile> bloom_filter;
 
 // uint32_t 
 // hash_packet_buffer(
@@ -62,45 +39,44 @@ bool bloom_check(uint32_t key) {
 //     return hash;
 // }
 
-uint32_t
-H(
-    uint32_t a,
-    uint32_t b
-) {
-    return .5*(a + b) * (a + b + 1) + b;
-}
-
 // might want to add nid later
+// Pairing the fields in floating point loses the low bits once
+// addresses get large (groups, broadcast), and the filter hashes only use
+// those. Mixing in integers keeps every bit.
 uint32_t 
 hash_packet_buffer(
-    uint8_t pid, 
+    uint16_t seq, 
     uint16_t dest_addr,
     uint16_t src_addr
 ) {
-    uint32_t hash = 0;
+    uint32_t hash = ((uint32_t) seq << 16 | src_addr) ^ (dest_addr * 0x9E3779B1u);
+
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
 
-    hash = .5*(H(pid, H(dest_addr, src_addr)));
-    
     return hash;
 }
 
 bool 
 bloom_check_packet(
-    uint8_t pid, 
+    uint16_t seq, 
     uint16_t dest_addr,
     uint16_t src_addr
 ) {
-    uint32_t key = hash_packet_buffer(pid, dest_addr, src_addr); // or make_key_from_buffer
-    return bloom_check(key);
+    uint32_t key = hash_packet_buffer(seq, dest_addr, src_addr); // or make_key_from_buffer
+    return bloom_filter.check(key);
 }
 
 void bloom_add_packet(
-    uint8_t pid, 
+    uint16_t seq, 
     uint16_t dest_addr,
     uint16_t src_addr
 ) {
 
-    uint32_t key = hash_packet_buffer(pid, dest_addr, src_addr); // or make_key_from_buffer
+    uint32_t key = hash_packet_buffer(seq, dest_addr, src_addr); // or make_key_from_buffer
     bloom_add(key);
 }
 
@@ -108,8 +84,14 @@ void
 bloom_add(
     uint32_t key
 ) {
-    bloom_filter[hash1(key) / 8] |= (1 << (hash1(key) % 8));
-    bloom_filter[hash2(key) / 8] |= (1 << (hash2(key) % 8));
+    bloom_filter.add(key);
+}
+
+uint16_t
+bloom_false_positive_permille(
+    void
+) {
+    return bloom_filter.falsePositivePermille();
 }
 
 // MAYBE ADD
@@ -119,7 +101,7 @@ bloom_add(
 unsigned long last_reset = 0;
 
 void bloom_reset(void) {
-    memset(bloom_filter, 0, sizeof(bloom_filter));
+    bloom_filter.reset();
 }
 
 void maybe_reset_bloom_filter(
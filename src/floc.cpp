@@ -16,11 +16,41 @@
 #include "floc_buffer.hpp"
 #include "floc_utils.hpp"
 #include "bloomfilter.hpp"
-
-uint8_t packet_id = 0;
-
-uint16_t status_response_dest_addr = -1; // Address that has requested modem status info
-uint8_t status_request_pid = -1;
+#include "floc_ack.hpp"
+#include "floc_aggregate.hpp"
+#include "floc_compact.hpp"
+#include "floc_dispatch.hpp"
+#include "floc_event.hpp"
+#include "floc_fec.hpp"
+#include "floc_frag.hpp"
+#include "floc_group.hpp"
+#include "floc_hop.hpp"
+#include "floc_metrics.hpp"
+#include "floc_request.hpp"
+#include "floc_trace.hpp"
+#include "floc_unicast.hpp"
+
+#ifdef FLOC_CAPTURE // FLOC_CAPTURE
+#include "floc_capture.hpp"
+#endif // FLOC_CAPTURE
+
+uint16_t packet_seq = 0;
+
+#ifdef FLOC_PID_EPOCH // FLOC_PID_EPOCH
+static bool epochsEnabled = true;
+#else
+static bool epochsEnabled = false;
+#endif // FLOC_PID_EPOCH
+
+// Peers waiting for our modem status, and the PIDs of their requests
+struct
+status_requester {
+    uint16_t addr;
+    uint8_t pid;
+};
+
+static status_requester status_requesters[FLOC_STATUS_REQUESTERS];
+static uint8_t status_requester_count = 0;
 
 uint16_t network_id = 0;
 uint16_t device_id = 0;
@@ -53,30 +83,84 @@ set_device_id(
     device_id = new_device_id;
 }
 
-void
-init_da(
+uint8_t
+use_packet_id(
     void
 ){
-    da.modemRespType = -1;
-    da.flocType = -1;
-    da.commandType = -1;
-    da.srcAddr = -1;
-    da.dataSize = -1;
-    da.data = NULL;
+    uint8_t pid = packet_seq & FLOC_PID_MASK;
+
+    packet_seq = (packet_seq + 1) & FLOC_SEQ_MASK;
+
+    return pid;
 }
 
-uint8_t
-use_packet_id(
+uint16_t
+floc_next_seq(
     void
 ){
-    return packet_id++;
+    return packet_seq;
+}
+
+void
+floc_set_next_seq(
+    uint16_t seq
+){
+    packet_seq = seq & FLOC_SEQ_MASK;
+}
+
+uint16_t
+floc_seq_of_pid(
+    uint8_t pid
+){
+    uint16_t last = (packet_seq - 1) & FLOC_SEQ_MASK;
+
+    return (last - ((last - pid) & FLOC_PID_MASK)) & FLOC_SEQ_MASK;
+}
+
+void
+floc_set_epochs(
+    bool enable
+){
+    epochsEnabled = enable;
+}
+
+bool
+floc_epochs(
+    void
+){
+    return epochsEnabled;
 }
 
 void
 floc_status_query(
-    uint8_t dest_addr
+    uint16_t requester_addr,
+    uint8_t request_pid
 ){
-    status_response_dest_addr = dest_addr;
+    uint8_t i;
+
+    // A retransmitted request replaces the one it repeats
+    for (i = 0; i < status_requester_count; i++) {
+        if (status_requesters[i].addr == requester_addr) {
+            break;
+        }
+    }
+
+    if (i == status_requester_count) {
+        if (status_requester_count >= FLOC_STATUS_REQUESTERS) {
+        #ifdef DEBUG_ON // DEBUG_ON
+            Serial.printf("Too many pending status requests, dropping...\r\n");
+        #endif // DEBUG_ON
+
+            floc_metrics_drop(FLOC_DROP_QUEUE_FULL);
+            return;
+        }
+
+        status_requester_count++;
+    }
+
+    status_requesters[i].addr = requester_addr;
+    status_requesters[i].pid = request_pid;
+
     query_status();
 }
 
@@ -97,13 +181,57 @@ floc_build_header(
     packet->header.nid = htons(get_network_id());
 
     packet->header.pid = use_packet_id();
-    packet->header.res = (uint8_t) err_packet;
+    packet->header.res = err_packet ? FLOC_RES_ERROR : 0;
 
     packet->header.dest_addr = htons(dest_addr);
     packet->header.src_addr = htons(get_device_id());
     packet->header.last_hop_addr = htons(get_device_id());
 }
 
+// Up to the end of the payload, without any extension
+static uint8_t
+base_packet_size(
+    const FlocPacket_t* packet
+){
+    switch (packet->header.type & FLOC_TYPE_MASK) {
+        case FLOC_DATA_TYPE:
+            return DATA_PACKET_ACTUAL_SIZE(packet);
+        case FLOC_COMMAND_TYPE:
+            return COMMAND_PACKET_ACTUAL_SIZE(packet);
+        case FLOC_ACK_TYPE:
+            return ACK_PACKET_ACTUAL_SIZE(packet);
+        case FLOC_RESPONSE_TYPE:
+            return RESPONSE_PACKET_ACTUAL_SIZE(packet);
+        default:
+            return FLOC_HEADER_COMMON_SIZE;
+    }
+}
+
+uint8_t
+floc_packet_size(
+    const FlocPacket_t* packet
+){
+    uint8_t size = base_packet_size(packet);
+
+    if (packet->header.type & FLOC_TYPE_EXT) {
+        size += floc_ext_size(((const uint8_t*) packet)[size]);
+    }
+
+    return size;
+}
+
+uint8_t
+floc_ext_size(
+    uint8_t ext_flags
+){
+    if (ext_flags & ~(FLOC_EXT_ACKS | FLOC_EXT_EPOCH)) {
+        return 0;
+    }
+
+    return FLOC_EXT_FLAGS_SIZE + ((ext_flags & FLOC_EXT_ACKS) ? FLOC_EXT_ACKS_SIZE : 0) +
+                                 ((ext_flags & FLOC_EXT_EPOCH) ? FLOC_EXT_EPOCH_SIZE : 0);
+}
+
 void
 floc_acknowledgement_send(
     uint8_t ttl,
@@ -126,21 +254,23 @@ floc_status_send(
     uint8_t node_addr,
     float supply_voltage
 ){
-    // Construct the packet
-    FlocPacket_t packet;
+    for (uint8_t i = 0; i < status_requester_count; i++) {
+        // Construct the packet
+        FlocPacket_t packet;
 
-    floc_build_header(&packet, TTL_START, FLOC_RESPONSE_TYPE, status_response_dest_addr, false);
+        floc_build_header(&packet, TTL_START, FLOC_RESPONSE_TYPE, status_requesters[i].addr, false);
 
-    packet.payload.response.header.request_pid = packet.header.pid;
-    packet.payload.response.header.size = sizeof(node_addr) + sizeof(supply_voltage);
+        packet.payload.response.header.request_pid = status_requesters[i].pid;
+        packet.payload.response.header.size = sizeof(node_addr) + sizeof(supply_voltage);
 
-    // Copy the status string into the response data
-    memcpy(packet.payload.response.payload, &node_addr, sizeof(node_addr));
-    memcpy(packet.payload.response.payload + sizeof(node_addr), &supply_voltage, sizeof(supply_voltage));
+        // Copy the status string into the response data
+        memcpy(packet.payload.response.payload, &node_addr, sizeof(node_addr));
+        memcpy(packet.payload.response.payload + sizeof(node_addr), &supply_voltage, sizeof(supply_voltage));
 
-    flocBuffer.addPacket(packet);
+        flocBuffer.addPacket(packet);
+    }
 
-    // broadcast(MODEM_SERIAL_CONNECTION, (char*)(&packet), RESPONSE_PACKET_ACTUAL_SIZE(&packet));
+    status_requester_count = 0;
 }
 
 void
@@ -160,11 +290,73 @@ floc_error_send(
     //broadcast(MODEM_SERIAL_CONNECTION, (char*)(&packet), RESPONSE_PACKET_ACTUAL_SIZE(&packet));
 }
 
-void
+uint8_t
+floc_data_send(
+    uint16_t dest_addr,
+    const uint8_t* payload,
+    uint8_t size
+){
+    if (size > MAX_DATA_PAYLOAD_SIZE) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Data payload too large! Size: %u\r\n", size);
+    #endif // DEBUG_ON
+
+        return FLOC_INVALID_PID;
+    }
+
+    FlocPacket_t packet;
+
+    floc_build_header(&packet, TTL_START, FLOC_DATA_TYPE, dest_addr, false);
+
+    packet.payload.data.header.size = size;
+    packet.payload.data.header.encoding = DATA_ENCODING_PLAIN;
+
+    if (size > 0) {
+        memcpy(packet.payload.data.payload, payload, size);
+    }
+
+    flocBuffer.addPacket(packet);
+
+    return packet.header.pid;
+}
+
+uint8_t
+floc_command_send(
+    uint16_t dest_addr,
+    CommandType_e command_type,
+    const uint8_t* payload,
+    uint8_t size
+){
+    if (size > MAX_COMMAND_PAYLOAD_SIZE) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Command payload too large! Size: %u\r\n", size);
+    #endif // DEBUG_ON
+
+        return FLOC_INVALID_PID;
+    }
+
+    FlocPacket_t packet;
+
+    floc_build_header(&packet, TTL_START, FLOC_COMMAND_TYPE, dest_addr, false);
+
+    packet.payload.command.header.command_type = command_type;
+    packet.payload.command.header.size = size;
+
+    if (size > 0) {
+        memcpy(packet.payload.command.payload, payload, size);
+    }
+
+    flocBuffer.addPacket(packet);
+
+    return packet.header.pid;
+}
+
+bool
 parse_floc_data_packet(
     FlocHeader_t* floc_header,
-    DataPacket_t* pkt, 
-    uint8_t size
+    DataPacket_t* pkt,
+    uint8_t size,
+    FlocEvent_t* event
 ){
 #ifdef DEBUG_ON // DEBUG_ON
     Serial.printf("Data packet received...\r\n");
@@ -175,7 +367,9 @@ parse_floc_data_packet(
         Serial.printf("Invalid Data Packet: Too small\r\n");
     #endif // DEBUG_ON
 
-        return;
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
     }
 
     DataHeader_t* header = &pkt->header;
@@ -188,24 +382,51 @@ parse_floc_data_packet(
         Serial.printf("Invalid Data Packet: Incomplete data\r\n");
     #endif // DEBUG_ON
 
-        return;
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
     }
 
     // Extract data
     uint8_t* data = pkt->payload;
 
-    // Setup DeviceAction
-    da.flocType = FLOC_DATA_TYPE;
-    da.srcAddr = floc_header->src_addr;
-    da.dataSize = dataSize;
-    da.data = data;
+    if (header->encoding == DATA_ENCODING_FEC) {
+        // Delivers the payload of data shards and anything parity recovers
+        return floc_fec_receive(floc_header, data, dataSize, event);
+    }
+
+    if (header->encoding == DATA_ENCODING_FRAG) {
+        // Whole transfers are delivered through the floc_frag handlers, not as events
+        return floc_frag_receive(floc_header, data, dataSize);
+    }
+
+    if (header->encoding == DATA_ENCODING_AGGREGATE) {
+        // Each record is delivered as an event from its own source
+        return floc_aggregate_receive(floc_header, data, dataSize, event);
+    }
+
+    // Still forwarded, relays do not need to understand every encoding
+    if (header->encoding != DATA_ENCODING_PLAIN) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Unknown data encoding! Encoding: [%u]\r\n", header->encoding);
+    #endif // DEBUG_ON
+
+        return true;
+    }
+
+    event->flocType = FLOC_DATA_TYPE;
+    event->dataSize = dataSize;
+    memcpy(event->data, data, dataSize);
+
+    return true;
 }
 
-void
+bool
 parse_floc_command_packet(
     FlocHeader_t* floc_header,
     CommandPacket_t* pkt,
-    uint8_t size
+    uint8_t size,
+    FlocEvent_t* event
 ){
 #ifdef DEBUG_ON // DEBUG_ON
     Serial.printf("Command packet received...\r\n");
@@ -216,7 +437,9 @@ parse_floc_command_packet(
         Serial.printf("Invalid Command Packet: Too small\r\n");
     #endif // DEBUG_ON
 
-        return;
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
     }
 
     // Extract the command header
@@ -236,57 +459,83 @@ parse_floc_command_packet(
         Serial.printf("Invalid Command Packet: Incomplete data\r\n");
     #endif // DEBUG_ON
 
-        return;
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
+    }
+
+    // Relays only forward, and commands they have not registered are not
+    // theirs to check. The ACK and any handler are for the destination.
+    uint16_t dest_addr = ntohs(floc_header->dest_addr);
+
+    if (dest_addr != get_device_id() && !floc_group_member(dest_addr)) {
+        return true;
     }
 
     // Extract command data
     uint8_t* data = pkt->payload;
 
-    bool valid_cmd = true;
-    // Handle the command based on the type
-    switch (commandType) {
-        case COMMAND_TYPE_1:
-            da.commandType = commandType;
+    const FlocCommandEntry_t* entry = floc_dispatch_lookup(commandType);
 
-            floc_acknowledgement_send(TTL_START, floc_header->pid, ntohs(floc_header->src_addr));
-            break;
-        case COMMAND_TYPE_2:
-            da.commandType = commandType;
+    if (!(entry->flags & FLOC_DISPATCH_REGISTERED)) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Unknown FLOC Command Type! Type: [%01u]\r\n", commandType);
+    #endif // DEBUG_ON
 
-            floc_acknowledgement_send(TTL_START, floc_header->pid, ntohs(floc_header->src_addr));
-            break;
-        //...
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+        return false;
+    }
 
-        default:
-        #ifdef DEBUG_ON // DEBUG_ON
-            Serial.printf("Unknown FLOC Command Type! Type: [%01u]\r\n", commandType);
-        #endif // DEBUG_ON
+    if (dataSize < entry->min_size || dataSize > entry->max_size) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Invalid Command Packet: Size %u outside [%u, %u]\r\n", dataSize, entry->min_size, entry->max_size);
+    #endif // DEBUG_ON
 
-            valid_cmd = false;
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+        return false;
+    }
 
-            break;
+    if (entry->flags & FLOC_DISPATCH_NEEDS_ACK) {
+        floc_ack_queue(ntohs(floc_header->src_addr), floc_header->pid);
     }
 
-    if (valid_cmd) {
-        // Setup DeviceAction
-        da.flocType = FLOC_COMMAND_TYPE;
-        da.data = data;
-        da.dataSize = dataSize;
+    if (entry->handler != nullptr) {
+        FlocCommandContext_t ctx;
+        ctx.src_addr = ntohs(floc_header->src_addr);
+        ctx.pid = floc_header->pid;
+        ctx.command_type = (CommandType_e) commandType;
+        ctx.priority = entry->priority;
+        ctx.data = data;
+        ctx.size = dataSize;
+
+        entry->handler(&ctx);
     }
+
+    event->flocType = FLOC_COMMAND_TYPE;
+    event->commandType = commandType;
+    event->dataSize = dataSize;
+    memcpy(event->data, data, dataSize);
+
+    return true;
 }
 
-void
+bool
 parse_floc_acknowledgement_packet(
     FlocHeader_t* floc_header,
     AckPacket_t* pkt,
-    uint8_t size
+    uint8_t size,
+    FlocEvent_t* event
 ){
     if (size < sizeof(AckHeader_t)) {
     #ifdef DEBUG_ON // DEBUG_ON
         Serial.printf("Invalid ACK Packet: Too small\r\n");
     #endif // DEBUG_ON
 
-        return;
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
     }
 
     // Extract ACK header
@@ -294,7 +543,19 @@ parse_floc_acknowledgement_packet(
 
     uint8_t ack_pid = ackHeader->ack_pid;
 
-    flocBuffer.addAckID(ack_pid);
+    // One event per PID ACKed to us, pushed by the ACK layer
+    if (ack_pid & FLOC_ACK_AGGREGATE) {
+        return floc_ack_receive(floc_header, pkt, size, event);
+    }
+
+    FLOC_TRACE(FLOC_TRACE_ACK, ack_pid, ntohs(floc_header->src_addr));
+
+    // ACKs for other nodes are theirs to read once it is forwarded; pids alone
+    // would match our own commands
+    if (ntohs(floc_header->dest_addr) == get_device_id() &&
+        !floc_group_acked(ntohs(floc_header->src_addr), ack_pid)) {
+        flocBuffer.addAckID(ack_pid);
+    }
 
 #ifdef ACK_DATA // ACK_DATA
     uint8_t dataSize = ackHeader->size;
@@ -304,17 +565,20 @@ parse_floc_acknowledgement_packet(
         Serial.printf("Invalid Ack Packet: Incomplete data\r\n");
     #endif // DEBUG_ON
 
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
     }
 
     uint8_t* data = pkt->payload;
 #endif // ACK_DATA
 
-    // Setup DeviceAction
-    da.flocType = FLOC_ACK_TYPE;
+    event->flocType = FLOC_ACK_TYPE;
+    event->requestPid = ack_pid;
 
 #ifdef ACK_DATA // ACK_DATA
-    da.dataSize = dataSize;
-    da.data = data;
+    event->dataSize = dataSize;
+    memcpy(event->data, data, dataSize);
 #endif //ACK_DATA
 
 #ifdef DEBUG_ON // DEBUG_ON
@@ -324,20 +588,25 @@ parse_floc_acknowledgement_packet(
         printBufferContents(data, dataSize);
     #endif
 #endif // DEBUG_ON
+
+    return true;
 }
 
-void
+bool
 parse_floc_response_packet(
     FlocHeader_t* floc_header,
     ResponsePacket_t* pkt,
-    uint8_t size
+    uint8_t size,
+    FlocEvent_t* event
 ){
     if (size < sizeof(ResponseHeader_t)) {
     #ifdef DEBUG_ON // DEBUG_ON
         Serial.printf("Invalid Response Packet: Too small\r\n");
     #endif // DEBUG_ON
 
-        return;
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
     }
 
     // Extract Response header
@@ -351,62 +620,196 @@ parse_floc_response_packet(
         Serial.printf("Invalid Response Packet: Incomplete data\r\n");
     #endif // DEBUG_ON
 
-        return;
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, ntohs(floc_header->src_addr));
+        return false;
     }
 
     // Extract response data
     uint8_t* responseData = pkt->payload;
 
-    // Setup DeviceAction_t struct
-    da.flocType = FLOC_RESPONSE_TYPE;
-    da.data = responseData;
-    da.dataSize = dataSize;
+    // Answers to our own requests go to whoever is waiting for them. Someone
+    // else's answer passing through may carry the same peer and pid.
+    if (ntohs(floc_header->dest_addr) == get_device_id()) {
+        floc_request_complete(ntohs(floc_header->src_addr), request_pid,
+            (floc_header->res & FLOC_RES_ERROR) ? FLOC_REQUEST_ERROR : FLOC_REQUEST_OK, responseData, dataSize);
+    }
+
+    event->flocType = FLOC_RESPONSE_TYPE;
+    event->requestPid = request_pid;
+    event->dataSize = dataSize;
+    memcpy(event->data, responseData, dataSize);
 
 #ifdef DEBUG_ON // DEBUG_ON
     Serial.printf("Response Packet Received:\r\n");
     Serial.printf("  Request Packet ID: %d\r\n", request_pid);
     printBufferContents(responseData, dataSize);
 #endif // DEBUG_ON
+
+    return true;
 }
 
-void
-floc_broadcast_received(
-    uint8_t* broadcastBuffer,
+// ACKs for other nodes' commands, in an ACK packet or riding on another frame
+static void
+overhear_acks(
+    const FlocPacket_t* pkt,
+    uint8_t size,
+    const uint8_t* ext
+){
+    if (ext != nullptr && (ext[0] & FLOC_EXT_ACKS)) {
+        floc_group_ack_overheard(ntohs(pkt->header.dest_addr), ext[1], (ext[2] << 8) | ext[3]);
+    }
+
+    if ((pkt->header.type & FLOC_TYPE_MASK) != FLOC_ACK_TYPE || size < FLOC_HEADER_COMMON_SIZE + ACK_HEADER_SIZE) {
+        return;
+    }
+
+    const AckPacket_t* ack = &pkt->payload.ack;
+
+    if (!(ack->header.ack_pid & FLOC_ACK_AGGREGATE)) {
+        floc_group_ack_overheard(ntohs(pkt->header.dest_addr), ack->header.ack_pid, 0);
+        return;
+    }
+
+    uint8_t count = ack->header.ack_pid & FLOC_ACK_GROUPS_MASK;
+
+    if (size < FLOC_HEADER_COMMON_SIZE + ACK_HEADER_SIZE + count * ACK_GROUP_SIZE) {
+        return;
+    }
+
+    const AckGroup_t* groups = (const AckGroup_t*) ack->payload;
+
+    for (uint8_t i = 0; i < count; i++) {
+        floc_group_ack_overheard(ntohs(groups[i].addr), groups[i].base_pid, ntohs(groups[i].bitmap));
+    }
+}
+
+// Broadcast and unicast frames only differ in how the modem delivered them
+static void
+receive_frame(
+    uint8_t* frameBuffer,
     uint8_t size
 ){
+    if (size > FLOC_MAX_SIZE) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Packet larger than FLOC_MAX_SIZE!\r\n");
+    #endif // DEBUG_ON
+
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, 0);
+        return;
+    }
+
+    // Cast buffer to FLOC packet
+    FlocPacket_t* pkt = (FlocPacket_t *) frameBuffer;
+    FlocPacket_t expanded;
+
+    // Compact frames are expanded so everything below sees a full header
+    if (floc_compact_is_compact(frameBuffer, size)) {
+        if ((frameBuffer[1] & 0xF) != floc_compact_nid_hash(get_network_id())) {
+        #ifdef DEBUG_ON // DEBUG_ON
+            Serial.printf("Not on our network. Dropping...\r\n");
+        #endif // DEBUG_ON
+
+            floc_metrics_drop(FLOC_DROP_WRONG_NID);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_WRONG_NID, 0);
+            return;
+        }
+
+        uint8_t header_size = floc_compact_decode(frameBuffer, size, &expanded.header);
+
+        if (header_size == 0 || (size_t) (size - header_size) > sizeof(expanded.payload)) {
+        #ifdef DEBUG_ON // DEBUG_ON
+            Serial.printf("Invalid compact header!\r\n");
+            printBufferContents(frameBuffer, size);
+        #endif // DEBUG_ON
+
+            floc_metrics_drop(FLOC_DROP_MALFORMED);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, 0);
+            return;
+        }
+
+        memcpy(&expanded.payload, frameBuffer + header_size, size - header_size);
+        size = FLOC_HEADER_COMMON_SIZE + (size - header_size);
+        pkt = &expanded;
+    }
+
     if (size < sizeof(FlocHeader_t)) {
         // Packet is too small to contain a valid header
     #ifdef DEBUG_ON // DEBUG_ON
         Serial.printf("Packet too small to contain valid header!\r\n");
-        printBufferContents(broadcastBuffer, size);
+        printBufferContents(frameBuffer, size);
     #endif // DEBUG_ON
 
+        floc_metrics_drop(FLOC_DROP_TOO_SMALL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TOO_SMALL, 0);
         return;
     }
 
-    // Cast buffer to FLOC packet
-    FlocPacket_t* pkt = (FlocPacket_t *) broadcastBuffer;
     // Extract the common header
     FlocHeader_t* header = &pkt->header;
 
     uint8_t ttl = header->ttl;
-    uint8_t type = header->type;
+    uint8_t type = header->type & FLOC_TYPE_MASK;
     uint16_t nid = ntohs(header->nid);
     uint8_t pid = header->pid;
     uint16_t dest_addr = ntohs(header->dest_addr);
     uint16_t src_addr = ntohs(header->src_addr);
     uint16_t last_hop_addr = ntohs(header->last_hop_addr);
 
-    if (bloom_check_packet(pid, dest_addr, src_addr)) {
-    #ifdef DEBUG_ON
-        Serial.printf("Duplicate packet (raw hash), dropping.\n");
-    #endif
-        return;
+    // The payload parsers below never see the extension
+    const uint8_t* ext = nullptr;
+
+    if (header->type & FLOC_TYPE_EXT) {
+        uint8_t base_size = size > FLOC_HEADER_COMMON_SIZE + 1 ? base_packet_size(pkt) : size;
+        uint8_t ext_size = base_size < size ? floc_ext_size(((uint8_t*) pkt)[base_size]) : 0;
+
+        if (ext_size == 0 || base_size + ext_size > size) {
+        #ifdef DEBUG_ON // DEBUG_ON
+            Serial.printf("Invalid header extension!\r\n");
+        #endif // DEBUG_ON
+
+            floc_metrics_drop(FLOC_DROP_MALFORMED);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, src_addr);
+            return;
+        }
+
+        ext = (uint8_t*) pkt + base_size;
+        size = base_size;
     }
 
-    // adds timeout
-    maybe_reset_bloom_filter();
-    bloom_add_packet(pid, dest_addr, src_addr);
+    // Where the sender says which epoch this pid is from
+    uint16_t seq = pid;
+
+    if (ext != nullptr && (ext[0] & FLOC_EXT_EPOCH)) {
+        seq = FLOC_SEQ(ext[FLOC_EXT_FLAGS_SIZE + ((ext[0] & FLOC_EXT_ACKS) ? FLOC_EXT_ACKS_SIZE : 0)], pid);
+    }
+
+    // FEC and fragment streams addressed to us are deduplicated exactly by
+    // their own layer, and a long stream would otherwise fill the filter.
+    // Merged frames are deduplicated record by record.
+    bool layer_dedup = type == FLOC_DATA_TYPE && dest_addr == get_device_id() &&
+                       size >= FLOC_HEADER_COMMON_SIZE + DATA_HEADER_SIZE &&
+                       pkt->payload.data.header.encoding != DATA_ENCODING_PLAIN;
+
+    // A neighbor passing on a frame we forwarded, which is a duplicate to us
+    floc_hop_overheard(header);
+    floc_aggregate_overheard(pkt, size);
+
+    if (!layer_dedup) {
+        if (bloom_check_packet(seq, dest_addr, src_addr)) {
+        #ifdef DEBUG_ON
+            Serial.printf("Duplicate packet (raw hash), dropping.\n");
+        #endif
+            floc_metrics_drop(FLOC_DROP_DUPLICATE);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_DUPLICATE, src_addr);
+            return;
+        }
+
+        // adds timeout
+        maybe_reset_bloom_filter();
+        bloom_add_packet(seq, dest_addr, src_addr);
+    }
 
 #ifdef DEBUG_ON // DEBUG_ON
     Serial.printf("FLOC Packet Header\r\n");
@@ -424,6 +827,8 @@ floc_broadcast_received(
         Serial.printf("Not on our network. Dropping...\r\n");
     #endif // DEBUG_ON
 
+        floc_metrics_drop(FLOC_DROP_WRONG_NID);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_WRONG_NID, src_addr);
         return;
     }
 
@@ -432,57 +837,119 @@ floc_broadcast_received(
         Serial.printf("Recv retrans from self. Dropping...\r\n");
     #endif // DEBUG_ON
 
+        floc_metrics_drop(FLOC_DROP_SELF);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_SELF, src_addr);
         return;
     }
 
-    // Setup DeviceAction
-    da.srcAddr = src_addr;
+    // Whoever sent this frame is in range
+    floc_neighbor_heard(last_hop_addr);
+
+    floc_metrics_rx(type);
+    FLOC_TRACE(FLOC_TRACE_RX, FLOC_TRACE_TYPE_PID(type, pid), src_addr);
+
+    FlocEvent_t event;
+    event.flocType = FLOC_EVENT_NONE;
+    event.commandType = 0;
+    event.pid = pid;
+    event.requestPid = 0;
+    event.srcAddr = src_addr;
+    event.destAddr = dest_addr;
+    event.lastHopAddr = last_hop_addr;
+    event.dataSize = 0;
+
+    // ACKs riding along with a frame for us
+    if (ext != nullptr && (ext[0] & FLOC_EXT_ACKS) && dest_addr == get_device_id()) {
+        floc_ack_receive_piggyback(src_addr, ext[1], (ext[2] << 8) | ext[3], &event);
+    }
+
+    // Relays learn which branches have group members from the ACKs they pass on
+    if (dest_addr != get_device_id()) {
+        overhear_acks(pkt, size, ext);
+    }
+
+    // Group frames are only read by members, everyone else just forwards them
+    bool read = !floc_group_is(dest_addr) || floc_group_member(dest_addr);
+    bool valid = !read;
 
     // Determine the type of the packet
-    switch (type) {
-        case FLOC_DATA_TYPE:
-        {
-            DataPacket_t* data_pkt = (DataPacket_t*) &pkt->payload;
-            parse_floc_data_packet(header, data_pkt, size - FLOC_HEADER_COMMON_SIZE);
-            break;
-        }
-        case FLOC_COMMAND_TYPE:
-        {
-            CommandPacket_t* cmd_pkt = (CommandPacket_t*)&pkt->payload;
-            parse_floc_command_packet(header, cmd_pkt, size - FLOC_HEADER_COMMON_SIZE);
-            break;
-        }
-        case FLOC_ACK_TYPE:
-        {
-            AckPacket_t* ack_pkt = (AckPacket_t*)&pkt->payload;
-            parse_floc_acknowledgement_packet(header, ack_pkt, size - FLOC_HEADER_COMMON_SIZE);
-            break;
-        }
-        case FLOC_RESPONSE_TYPE:
-        {
-            ResponsePacket_t* resp_pkt = (ResponsePacket_t*)&pkt->payload;
-            parse_floc_response_packet(header, resp_pkt, size - FLOC_HEADER_COMMON_SIZE);
-            break;
+    if (read) {
+        switch (type) {
+            case FLOC_DATA_TYPE:
+            {
+                DataPacket_t* data_pkt = (DataPacket_t*) &pkt->payload;
+                valid = parse_floc_data_packet(header, data_pkt, size - FLOC_HEADER_COMMON_SIZE, &event);
+                break;
+            }
+            case FLOC_COMMAND_TYPE:
+            {
+                CommandPacket_t* cmd_pkt = (CommandPacket_t*)&pkt->payload;
+                valid = parse_floc_command_packet(header, cmd_pkt, size - FLOC_HEADER_COMMON_SIZE, &event);
+                break;
+            }
+            case FLOC_ACK_TYPE:
+            {
+                AckPacket_t* ack_pkt = (AckPacket_t*)&pkt->payload;
+                valid = parse_floc_acknowledgement_packet(header, ack_pkt, size - FLOC_HEADER_COMMON_SIZE, &event);
+                break;
+            }
+            case FLOC_RESPONSE_TYPE:
+            {
+                ResponsePacket_t* resp_pkt = (ResponsePacket_t*)&pkt->payload;
+                valid = parse_floc_response_packet(header, resp_pkt, size - FLOC_HEADER_COMMON_SIZE, &event);
+                break;
+            }
+            default:
+            #ifdef DEBUG_ON // DEBUG_ON
+                Serial.printf("Unknown FLOC packet type! Type: [%03u]\r\n", type);
+            #endif // DEBUG_ON
+
+                floc_metrics_drop(FLOC_DROP_MALFORMED);
+                FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, src_addr);
+                break;
         }
-        default:
-        #ifdef DEBUG_ON // DEBUG_ON
-            Serial.printf("Unknown FLOC packet type! Type: [%03u]\r\n", type);
-        #endif // DEBUG_ON
+    }
 
-            break;
+    if (!valid) {
+        return;
+    }
+
+    // Valid packets with nothing to deliver (e.g. FEC parity) leave the type unset
+    if (event.flocType != FLOC_EVENT_NONE) {
+        floc_event_push(&event);
     }
 
-    if (da.flocType >= FLOC_DATA_TYPE && da.flocType <= FLOC_RESPONSE_TYPE) // Is a valid packet
+    // Is a valid packet that still has somewhere to go
+    if (dest_addr != get_device_id() && (!floc_group_is(dest_addr) || floc_group_forward(header)))
     {
-        flocBuffer.addPacket(*pkt);
+        // Data may wait to share a frame with others to the same destination
+        if (!floc_aggregate_hold(pkt, size, ext, seq)) {
+            flocBuffer.addPacket(*pkt);
+        }
     }
 
 }
 
+void
+floc_broadcast_received(
+    uint8_t* broadcastBuffer,
+    uint8_t size
+){
+#ifdef FLOC_CAPTURE // FLOC_CAPTURE
+    floc_capture_record(FLOC_CAPTURE_LINK_BROADCAST, FLOC_CAPTURE_RX, broadcastBuffer, size);
+#endif // FLOC_CAPTURE
+
+    receive_frame(broadcastBuffer, size);
+}
+
 void
 floc_unicast_received(
     uint8_t* unicastBuffer,
     uint8_t size
 ){
-    // May not be used
+#ifdef FLOC_CAPTURE // FLOC_CAPTURE
+    floc_capture_record(FLOC_CAPTURE_LINK_UNICAST, FLOC_CAPTURE_RX, unicastBuffer, size);
+#endif // FLOC_CAPTURE
+
+    receive_frame(unicastBuffer, size);
 }
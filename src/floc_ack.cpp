@@ -0,0 +1,393 @@
+/*
+ * ACK aggregation.
+ *
+ * Held ACKs are kept in arrival order. A flush walks them once, starting a
+ * group at the first ACK for each sender and folding in every later ACK for
+ * that sender within FLOC_ACK_BITMAP_SPAN PIDs of it.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_ack.hpp"
+#include "floc_buffer.hpp"
+#include "floc_group.hpp"
+#include "floc_metrics.hpp"
+#include "floc_trace.hpp"
+#include "floc_utils.hpp"
+
+#define PID_MASK ((1 << FLOC_PID_SIZE) - 1)
+
+struct
+pending_ack {
+    uint16_t addr;
+    uint8_t pid;
+};
+
+static pending_ack pendingAcks[FLOC_ACK_PENDING];
+static uint8_t pendingCount = 0;
+static unsigned long oldestMs = 0;
+static uint16_t holdMs = FLOC_ACK_HOLD_MS;
+
+#ifdef FLOC_ACK_PIGGYBACK // FLOC_ACK_PIGGYBACK
+static bool piggybackEnabled = true;
+#else
+static bool piggybackEnabled = false;
+#endif // FLOC_ACK_PIGGYBACK
+
+void
+floc_ack_set_hold(
+    uint16_t hold_ms
+){
+    holdMs = hold_ms;
+
+    if (holdMs == 0) {
+        floc_ack_flush();
+    }
+}
+
+uint16_t
+floc_ack_hold(
+    void
+){
+    return holdMs;
+}
+
+void
+floc_ack_set_piggyback(
+    bool enable
+){
+    piggybackEnabled = enable;
+}
+
+bool
+floc_ack_piggyback(
+    void
+){
+    return piggybackEnabled;
+}
+
+void
+floc_ack_queue(
+    uint16_t dest_addr,
+    uint8_t pid
+){
+    if (holdMs == 0) {
+        floc_acknowledgement_send(TTL_START, pid, dest_addr);
+        return;
+    }
+
+    // A retransmitted command is already covered
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        if (pendingAcks[i].addr == dest_addr && pendingAcks[i].pid == pid) {
+            return;
+        }
+    }
+
+    if (pendingCount == FLOC_ACK_PENDING) {
+        floc_ack_flush();
+    }
+
+    if (pendingCount == 0) {
+        oldestMs = millis();
+    }
+
+    pendingAcks[pendingCount].addr = dest_addr;
+    pendingAcks[pendingCount].pid = pid;
+    pendingCount++;
+}
+
+uint8_t
+floc_ack_save(
+    uint8_t* out,
+    uint8_t capacity
+){
+    uint8_t size = 1 + pendingCount * 3;
+
+    if (size > capacity) {
+        return 0;
+    }
+
+    out[0] = pendingCount;
+
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        memcpy(out + 1 + i * 3, &pendingAcks[i].addr, 2);
+        out[3 + i * 3] = pendingAcks[i].pid;
+    }
+
+    return size;
+}
+
+uint8_t
+floc_ack_restore(
+    const uint8_t* in,
+    uint8_t size
+){
+    if (size < 1 || in[0] > FLOC_ACK_PENDING || size < 1 + in[0] * 3) {
+        return 0;
+    }
+
+    pendingCount = in[0];
+
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        memcpy(&pendingAcks[i].addr, in + 1 + i * 3, 2);
+        pendingAcks[i].pid = in[3 + i * 3];
+    }
+
+    // The hold time starts over, millis() has
+    oldestMs = millis();
+
+    return 1 + pendingCount * 3;
+}
+
+static void
+send_groups(
+    const AckGroup_t* groups,
+    uint8_t count
+){
+    // Nothing to share the frame with, old nodes understand this form
+    if (count == 1 && groups[0].bitmap == 0) {
+        floc_acknowledgement_send(TTL_START, groups[0].base_pid, ntohs(groups[0].addr));
+        return;
+    }
+
+    uint16_t dest_addr = ntohs(groups[0].addr);
+
+    for (uint8_t i = 1; i < count; i++) {
+        if (ntohs(groups[i].addr) != dest_addr) {
+            dest_addr = FLOC_ACK_BROADCAST;
+            break;
+        }
+    }
+
+    FlocPacket_t packet;
+
+    floc_build_header(&packet, TTL_START, FLOC_ACK_TYPE, dest_addr, false);
+
+    packet.payload.ack.header.ack_pid = FLOC_ACK_AGGREGATE | count;
+#ifdef ACK_DATA // ACK_DATA
+    packet.payload.ack.header.size = count * ACK_GROUP_SIZE;
+#endif // ACK_DATA
+    memcpy(packet.payload.ack.payload, groups, count * ACK_GROUP_SIZE);
+
+#ifdef DEBUG_ON // DEBUG_ON
+    Serial.printf("Sending %u ACK groups to %u\r\n", count, dest_addr);
+#endif // DEBUG_ON
+
+    flocBuffer.addPacket(packet);
+}
+
+void
+floc_ack_flush(
+    void
+){
+    AckGroup_t groups[FLOC_ACK_MAX_GROUPS];
+    bool grouped[FLOC_ACK_PENDING] = {};
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        if (grouped[i]) {
+            continue;
+        }
+
+        uint8_t base = pendingAcks[i].pid;
+        uint16_t bitmap = 0;
+
+        for (uint8_t j = i + 1; j < pendingCount; j++) {
+            uint8_t offset = (pendingAcks[j].pid - base) & PID_MASK;
+
+            if (grouped[j] || pendingAcks[j].addr != pendingAcks[i].addr ||
+                offset == 0 || offset > FLOC_ACK_BITMAP_SPAN) {
+                continue;
+            }
+
+            bitmap |= 1 << (offset - 1);
+            grouped[j] = true;
+        }
+
+        groups[count].addr = htons(pendingAcks[i].addr);
+        groups[count].base_pid = base;
+        groups[count].bitmap = htons(bitmap);
+        count++;
+
+        if (count == FLOC_ACK_MAX_GROUPS) {
+            send_groups(groups, count);
+            count = 0;
+        }
+    }
+
+    if (count > 0) {
+        send_groups(groups, count);
+    }
+
+    pendingCount = 0;
+}
+
+bool
+floc_ack_group_add(
+    AckGroup_t* group,
+    uint8_t pid
+){
+    if (group->base_pid == FLOC_INVALID_PID) {
+        group->base_pid = pid;
+        group->bitmap = 0;
+        return true;
+    }
+
+    uint8_t offset = (pid - group->base_pid) & PID_MASK;
+
+    if (offset == 0) {
+        return true;
+    }
+
+    if (offset > FLOC_ACK_BITMAP_SPAN) {
+        return false;
+    }
+
+    group->bitmap |= 1 << (offset - 1);
+    return true;
+}
+
+bool
+floc_ack_holding(
+    uint16_t dest_addr
+){
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        if (pendingAcks[i].addr == dest_addr) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+floc_ack_take(
+    uint16_t dest_addr,
+    AckGroup_t* group
+){
+    uint8_t kept = 0;
+
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        if (pendingAcks[i].addr == dest_addr && floc_ack_group_add(group, pendingAcks[i].pid)) {
+            continue;
+        }
+
+        pendingAcks[kept++] = pendingAcks[i];
+    }
+
+    pendingCount = kept;
+}
+
+void
+floc_ack_poll(
+    void
+){
+    if (pendingCount > 0 && millis() - oldestMs >= holdMs) {
+        floc_ack_flush();
+    }
+}
+
+uint8_t
+floc_ack_pending(
+    void
+){
+    return pendingCount;
+}
+
+static void
+ack_received(
+    uint16_t src_addr,
+    uint8_t pid,
+    const FlocEvent_t* event
+){
+    FLOC_TRACE(FLOC_TRACE_ACK, pid, src_addr);
+
+    if (!floc_group_acked(src_addr, pid)) {
+        flocBuffer.addAckID(pid);
+    }
+
+    FlocEvent_t acked = *event;
+    acked.flocType = FLOC_ACK_TYPE;
+    acked.requestPid = pid;
+
+    floc_event_push(&acked);
+}
+
+static void
+receive_group(
+    uint16_t src_addr,
+    uint8_t base_pid,
+    uint16_t bitmap,
+    const FlocEvent_t* event
+){
+    uint8_t base = base_pid & PID_MASK;
+
+    ack_received(src_addr, base, event);
+
+    for (uint8_t bit = 0; bit < FLOC_ACK_BITMAP_SPAN; bit++) {
+        if (bitmap & (1 << bit)) {
+            ack_received(src_addr, (base + 1 + bit) & PID_MASK, event);
+        }
+    }
+}
+
+bool
+floc_ack_receive(
+    const FlocHeader_t* floc_header,
+    const AckPacket_t* pkt,
+    uint8_t size,
+    const FlocEvent_t* event
+){
+    uint8_t count = pkt->header.ack_pid & FLOC_ACK_GROUPS_MASK;
+    uint8_t groups_size = count * ACK_GROUP_SIZE;
+    bool valid = count > 0 && count <= FLOC_ACK_MAX_GROUPS && size >= ACK_HEADER_SIZE + groups_size;
+
+#ifdef ACK_DATA // ACK_DATA
+    valid = valid && pkt->header.size == groups_size;
+#endif // ACK_DATA
+
+    if (!valid) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Invalid aggregated ACK: %u groups in %u bytes\r\n", count, size);
+    #endif // DEBUG_ON
+
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+        return false;
+    }
+
+    const AckGroup_t* groups = (const AckGroup_t*) pkt->payload;
+    uint16_t src_addr = ntohs(floc_header->src_addr);
+
+    for (uint8_t i = 0; i < count; i++) {
+        // Groups for other nodes are theirs to read once it is forwarded
+        if (ntohs(groups[i].addr) != get_device_id()) {
+            continue;
+        }
+
+        receive_group(src_addr, groups[i].base_pid, ntohs(groups[i].bitmap), event);
+    }
+
+    return true;
+}
+
+void
+floc_ack_receive_piggyback(
+    uint16_t src_addr,
+    uint8_t base_pid,
+    uint16_t bitmap,
+    const FlocEvent_t* event
+){
+    receive_group(src_addr, base_pid, bitmap, event);
+}
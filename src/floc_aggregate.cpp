@@ -0,0 +1,442 @@
+/*
+ * In-network aggregation.
+ *
+ * Each pending destination keeps its records already in wire format, so
+ * sending them is one copy into a frame. Overheard frames are walked before
+ * the data packet parser has validated them, so every walk goes through
+ * read_record(), whose bounds checks stop at the first record that does not
+ * fit.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_aggregate.hpp"
+#include "bloomfilter.hpp"
+#include "floc_ack.hpp"
+#include "floc_buffer.hpp"
+#include "floc_group.hpp"
+#include "floc_hop.hpp"
+#include "floc_metrics.hpp"
+#include "floc_trace.hpp"
+#include "floc_utils.hpp"
+
+struct
+aggregate_record {
+    uint16_t src;
+    uint16_t seq;
+    uint8_t ttl;
+    uint8_t size;
+    const uint8_t* payload;
+};
+
+struct
+aggregate_pending {
+    uint16_t dest;
+    uint8_t ttl;                // Highest of the records
+    uint8_t count;
+    uint8_t size;
+    unsigned long held_ms;
+    uint8_t records[MAX_DATA_PAYLOAD_SIZE];
+};
+
+static aggregate_pending pending[FLOC_AGGREGATE_PENDING];
+static uint8_t pendingCount = 0;
+static uint16_t holdMs = FLOC_AGGREGATE_HOLD_MS;
+
+static uint32_t mergedCount = 0;
+static uint32_t sentCount = 0;
+
+// Reads the record at `*at` and moves past it. Returns false at the end of
+// the records, or at one that does not fit in them.
+static bool
+read_record(
+    const uint8_t** at,
+    const uint8_t* end,
+    aggregate_record* record
+){
+    const uint8_t* p = *at;
+
+    if (end - p < FLOC_AGGREGATE_RECORD_SIZE || end - p < FLOC_AGGREGATE_RECORD_SIZE + p[5]) {
+        return false;
+    }
+
+    record->src = (p[0] << 8) | p[1];
+    record->seq = (p[2] << 8) | p[3];
+    record->ttl = p[4];
+    record->size = p[5];
+    record->payload = p + FLOC_AGGREGATE_RECORD_SIZE;
+
+    *at = record->payload + record->size;
+
+    return true;
+}
+
+void
+floc_aggregate_set_hold_ms(
+    uint16_t hold_ms
+){
+    holdMs = hold_ms;
+
+    if (holdMs == 0) {
+        floc_aggregate_flush();
+    }
+}
+
+uint16_t
+floc_aggregate_hold_ms(
+    void
+){
+    return holdMs;
+}
+
+// Forwards the one frame a window held, as it arrived
+static void
+forward_record(
+    uint16_t dest,
+    const aggregate_record* record
+){
+    FlocPacket_t packet;
+    memset(&packet, 0, sizeof(packet));
+
+    packet.header.type = FLOC_DATA_TYPE;
+    packet.header.ttl = record->ttl;
+    packet.header.nid = htons(get_network_id());
+    packet.header.pid = record->seq & FLOC_PID_MASK;
+    packet.header.dest_addr = htons(dest);
+    packet.header.src_addr = htons(record->src);
+    packet.header.last_hop_addr = htons(record->src);
+
+    packet.payload.data.header.size = record->size;
+    packet.payload.data.header.encoding = DATA_ENCODING_PLAIN;
+    memcpy(packet.payload.data.payload, record->payload, record->size);
+
+    // Records always leave room for the extension
+    if (FLOC_SEQ_EPOCH(record->seq) != 0) {
+        uint8_t* ext = packet.payload.data.payload + record->size;
+        ext[0] = FLOC_EXT_EPOCH;
+        ext[1] = FLOC_SEQ_EPOCH(record->seq);
+
+        packet.header.type = (FlocPacketType_e) (packet.header.type | FLOC_TYPE_EXT);
+    }
+
+    flocBuffer.addPacket(packet);
+}
+
+// Sends and forgets pending destination `i`
+static void
+send_pending(
+    uint8_t i
+){
+    aggregate_pending p = pending[i];
+    pending[i] = pending[--pendingCount];
+
+    if (p.count == 1) {
+        const uint8_t* at = p.records;
+        aggregate_record record;
+
+        read_record(&at, p.records + p.size, &record);
+        forward_record(p.dest, &record);
+
+        return;
+    }
+
+#ifdef DEBUG_ON // DEBUG_ON
+    Serial.printf("[AGGREGATE] %d frames for %d in one\r\n", p.count, p.dest);
+#endif // DEBUG_ON
+
+    FlocPacket_t packet;
+
+    floc_build_header(&packet, p.ttl - 1, FLOC_DATA_TYPE, p.dest, false);
+
+    packet.payload.data.header.size = p.size;
+    packet.payload.data.header.encoding = DATA_ENCODING_AGGREGATE;
+    memcpy(packet.payload.data.payload, p.records, p.size);
+
+    flocBuffer.addPacket(packet);
+
+    mergedCount += p.count;
+    sentCount++;
+}
+
+static void
+add_record(
+    uint16_t dest,
+    const aggregate_record* record
+){
+    uint8_t record_size = FLOC_AGGREGATE_RECORD_SIZE + record->size;
+    int i = -1;
+
+    for (uint8_t j = 0; j < pendingCount; j++) {
+        if (pending[j].dest == dest) {
+            i = j;
+        }
+    }
+
+    if (i >= 0 && pending[i].size + record_size > MAX_DATA_PAYLOAD_SIZE) {
+        send_pending(i);
+        i = -1;
+    }
+
+    if (i < 0) {
+        if (pendingCount == FLOC_AGGREGATE_PENDING) {
+            uint8_t oldest = 0;
+
+            for (uint8_t j = 1; j < pendingCount; j++) {
+                if ((long) (pending[j].held_ms - pending[oldest].held_ms) < 0) {
+                    oldest = j;
+                }
+            }
+
+            send_pending(oldest);
+        }
+
+        i = pendingCount++;
+        pending[i].dest = dest;
+        pending[i].ttl = 0;
+        pending[i].count = 0;
+        pending[i].size = 0;
+        pending[i].held_ms = millis();
+    }
+
+    aggregate_pending& p = pending[i];
+    uint8_t* out = p.records + p.size;
+
+    out[0] = record->src >> 8;
+    out[1] = record->src & 0xFF;
+    out[2] = record->seq >> 8;
+    out[3] = record->seq & 0xFF;
+    out[4] = record->ttl;
+    out[5] = record->size;
+    memcpy(out + FLOC_AGGREGATE_RECORD_SIZE, record->payload, record->size);
+
+    p.size += record_size;
+    p.count++;
+
+    if (record->ttl > p.ttl) {
+        p.ttl = record->ttl;
+    }
+
+    // Nothing more would fit
+    if (p.size + FLOC_AGGREGATE_RECORD_SIZE >= MAX_DATA_PAYLOAD_SIZE) {
+        send_pending(i);
+    }
+}
+
+bool
+floc_aggregate_hold(
+    const FlocPacket_t* packet,
+    uint8_t size,
+    const uint8_t* ext,
+    uint16_t seq
+){
+    uint16_t dest = ntohs(packet->header.dest_addr);
+
+    // ACKs riding along are for the destination, and need the frame they came in
+    if (holdMs == 0 || (packet->header.type & FLOC_TYPE_MASK) != FLOC_DATA_TYPE ||
+        (ext != nullptr && (ext[0] & ~FLOC_EXT_EPOCH)) ||
+        dest == FLOC_ACK_BROADCAST || floc_group_is(dest) ||
+        size < FLOC_HEADER_COMMON_SIZE + DATA_HEADER_SIZE) {
+        return false;
+    }
+
+    // Out of TTL, which the retransmission queue counts
+    if (packet->header.ttl <= 1) {
+        return false;
+    }
+
+    const DataPacket_t* data = &packet->payload.data;
+
+    if (data->header.encoding == DATA_ENCODING_PLAIN) {
+        if (data->header.size > FLOC_AGGREGATE_MAX_PAYLOAD) {
+            return false;
+        }
+
+        aggregate_record record;
+        record.src = ntohs(packet->header.src_addr);
+        record.seq = seq;
+        record.ttl = packet->header.ttl;
+        record.size = data->header.size;
+        record.payload = data->payload;
+
+        add_record(dest, &record);
+
+        return true;
+    }
+
+    if (data->header.encoding != DATA_ENCODING_AGGREGATE) {
+        return false;
+    }
+
+    // Its records are merged one by one, each as if it had come on its own
+    const uint8_t* at = data->payload;
+    const uint8_t* end = data->payload + data->header.size;
+    aggregate_record record;
+
+    while (read_record(&at, end, &record)) {
+        if (record.src == get_device_id()) {
+            continue;
+        }
+
+        if (bloom_check_packet(record.seq, dest, record.src)) {
+            floc_metrics_drop(FLOC_DROP_DUPLICATE);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_DUPLICATE, record.src);
+            continue;
+        }
+
+        maybe_reset_bloom_filter();
+        bloom_add_packet(record.seq, dest, record.src);
+
+        // The hop that merged it would have forwarded it with one less
+        if (record.ttl <= 2) {
+            floc_metrics_drop(FLOC_DROP_TTL_EXPIRED);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TTL_EXPIRED, record.src);
+            continue;
+        }
+
+        record.ttl--;
+        add_record(dest, &record);
+    }
+
+    return true;
+}
+
+void
+floc_aggregate_flush(
+    void
+){
+    while (pendingCount > 0) {
+        send_pending(0);
+    }
+}
+
+void
+floc_aggregate_poll(
+    void
+){
+    unsigned long now = millis();
+
+    for (uint8_t i = 0; i < pendingCount; ) {
+        if (now - pending[i].held_ms >= holdMs) {
+            send_pending(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+bool
+floc_aggregate_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size,
+    const FlocEvent_t* event
+){
+    const uint8_t* at = data;
+    const uint8_t* end = data + size;
+    aggregate_record record;
+
+    while (read_record(&at, end, &record)) {
+        /* Do Nothing */
+    }
+
+    if (at != end) {
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+        return false;
+    }
+
+    // Relays only forward or merge it, the records are for the destination
+    uint16_t dest = ntohs(floc_header->dest_addr);
+
+    if (dest != get_device_id()) {
+        return true;
+    }
+
+    at = data;
+
+    while (read_record(&at, end, &record)) {
+        if (bloom_check_packet(record.seq, dest, record.src)) {
+        #ifdef DEBUG_ON // DEBUG_ON
+            Serial.printf("Duplicate record from %d, dropping.\r\n", record.src);
+        #endif // DEBUG_ON
+
+            floc_metrics_drop(FLOC_DROP_DUPLICATE);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_DUPLICATE, record.src);
+            continue;
+        }
+
+        maybe_reset_bloom_filter();
+        bloom_add_packet(record.seq, dest, record.src);
+
+        FlocEvent_t delivered = *event;
+        delivered.flocType = FLOC_DATA_TYPE;
+        delivered.pid = record.seq & FLOC_PID_MASK;
+        delivered.srcAddr = record.src;
+        delivered.dataSize = record.size;
+        memcpy(delivered.data, record.payload, record.size);
+
+        floc_event_push(&delivered);
+    }
+
+    return true;
+}
+
+void
+floc_aggregate_overheard(
+    const FlocPacket_t* packet,
+    uint8_t size
+){
+    if (floc_hop_pending() == 0 || (packet->header.type & FLOC_TYPE_MASK) != FLOC_DATA_TYPE ||
+        size < FLOC_HEADER_COMMON_SIZE + DATA_HEADER_SIZE ||
+        packet->payload.data.header.encoding != DATA_ENCODING_AGGREGATE) {
+        return;
+    }
+
+    const uint8_t* at = packet->payload.data.payload;
+    const uint8_t* end = at + packet->payload.data.header.size;
+    aggregate_record record;
+
+    if (end > (const uint8_t*) packet + size) {
+        return;
+    }
+
+    // Each record reads as the frame the relay that merged it passed on
+    FlocHeader_t header = packet->header;
+
+    while (read_record(&at, end, &record)) {
+        if (record.ttl == 0) {
+            continue;
+        }
+
+        header.src_addr = htons(record.src);
+        header.pid = record.seq & FLOC_PID_MASK;
+        header.ttl = record.ttl - 1;
+
+        floc_hop_overheard(&header);
+    }
+}
+
+uint32_t
+floc_aggregate_merged(
+    void
+){
+    return mergedCount;
+}
+
+uint32_t
+floc_aggregate_sent(
+    void
+){
+    return sentCount;
+}
@@ -6,6 +6,7 @@
  * - priority 1
  * Response buffer
  * - priority 2
+ * - also our own data packets, sent once
  * Command buffer
  *  - priority 3
  *  - 5 max transmissions
@@ -32,12 +33,31 @@
 
 #include "floc_buffer.hpp"
 #include "floc_utils.hpp"
+#include "floc_ack.hpp"
+#include "floc_aggregate.hpp"
+#include "floc_compact.hpp"
+#include "floc_fec.hpp"
+#include "floc_frag.hpp"
+#include "floc_group.hpp"
+#include "floc_bulk.hpp"
+#include "floc_hop.hpp"
+#include "floc_mac.hpp"
+#include "floc_metrics.hpp"
+#include "floc_persist.hpp"
+#include "floc_request.hpp"
+#include "floc_trace.hpp"
+#include "floc_unicast.hpp"
+
+#ifdef FLOC_CAPTURE // FLOC_CAPTURE
+#include "floc_capture.hpp"
+#endif // FLOC_CAPTURE
 
 FLOCBufferManager flocBuffer;
 
 // Debug help
+template <typename Profile>
 void 
-FLOCBufferManager::printRetransmissionBuffer(
+FLOCBufferManagerT<Profile>::printRetransmissionBuffer(
     void
 ){
     Serial.printf("Retrans Buffer (%d):\r\n", retransmissionBuffer.size());
@@ -50,16 +70,17 @@ FLOCBufferManager::printRetransmissionBuffer(
     for (auto it = retransmissionBuffer.begin(); 
          it != retransmissionBuffer.end() && count < 5; 
          ++it, ++count) {
-        Serial.printf("  [%d] PID:%d TTL:%d\r\n", count, it->header.pid, it->header.ttl);
-        Serial.printf("      Src:%d Dst:%d\r\n", ntohs(it->header.src_addr), ntohs(it->header.dest_addr));
+        Serial.printf("  [%d] PID:%d TTL:%d\r\n", count, it->packet.header.pid, it->packet.header.ttl);
+        Serial.printf("      Src:%d Dst:%d\r\n", ntohs(it->packet.header.src_addr), ntohs(it->packet.header.dest_addr));
     }
     if (retransmissionBuffer.size() > 5) {
         Serial.printf("  ...+%d more\r\n", retransmissionBuffer.size() - 5);
     }
 }
 
+template <typename Profile>
 void 
-FLOCBufferManager::printResponseBuffer(
+FLOCBufferManagerT<Profile>::printResponseBuffer(
     void
 ){
     Serial.printf("Response Buffer (%d):\r\n", responseBuffer.size());
@@ -72,16 +93,17 @@ FLOCBufferManager::printResponseBuffer(
     for (auto it = responseBuffer.begin(); 
          it != responseBuffer.end() && count < 5; 
          ++it, ++count) {
-        Serial.printf("  [%d] PID:%d Type:%d\r\n", count, it->header.pid, it->header.type);
-        Serial.printf("      Src:%d Dst:%d\r\n", ntohs(it->header.src_addr), ntohs(it->header.dest_addr));
+        Serial.printf("  [%d] PID:%d Type:%d\r\n", count, it->packet.header.pid, it->packet.header.type);
+        Serial.printf("      Src:%d Dst:%d\r\n", ntohs(it->packet.header.src_addr), ntohs(it->packet.header.dest_addr));
     }
     if (responseBuffer.size() > 5) {
         Serial.printf("  ...+%d more\r\n", responseBuffer.size() - 5);
     }
 }
 
+template <typename Profile>
 void 
-FLOCBufferManager::printCommandBuffer(
+FLOCBufferManagerT<Profile>::printCommandBuffer(
     void
 ){
     Serial.printf("Command Buffer (%d):\r\n", commandBuffer.size());
@@ -94,11 +116,11 @@ FLOCBufferManager::printCommandBuffer(
     for (auto it = commandBuffer.begin(); 
          it != commandBuffer.end() && count < 5; 
          ++it, ++count) {
-        Serial.printf("  [%d] PID:%d Type:%d\r\n", count, it->header.pid, it->header.type);
-        Serial.printf("      Src:%d Dst:%d\r\n", ntohs(it->header.src_addr), ntohs(it->header.dest_addr));
+        Serial.printf("  [%d] PID:%d Type:%d\r\n", count, it->packet.header.pid, it->packet.header.type);
+        Serial.printf("      Src:%d Dst:%d\r\n", ntohs(it->packet.header.src_addr), ntohs(it->packet.header.dest_addr));
         
         // Check transmission count
-        auto tx_it = transmissionCounts.find(it->header.pid);
+        auto tx_it = transmissionCounts.find(it->seq);
         if (tx_it != transmissionCounts.end()) {
             Serial.printf("      TX:%d\r\n", tx_it->second);
         }
@@ -108,13 +130,14 @@ FLOCBufferManager::printCommandBuffer(
     }
 }
 
+template <typename Profile>
 void 
-FLOCBufferManager::printPingDevices(
+FLOCBufferManagerT<Profile>::printPingDevices(
     void
 ){
     Serial.printf("Ping Devices:\r\n");
     bool found = false;
-    for (int i = 0; i < 3; i++) {
+    for (int i = 0; i < Profile::ping_devices; i++) {
         if (pingDevice[i].devAdd != 0) {
             Serial.printf("  [%d] Dev:%d Mod:%d\r\n", 
                 i, pingDevice[i].devAdd, modemIdFromDidNid(pingDevice[i].devAdd, get_network_id()));
@@ -127,8 +150,9 @@ FLOCBufferManager::printPingDevices(
     }
 }
 
+template <typename Profile>
 void 
-FLOCBufferManager::printAckIDs(
+FLOCBufferManagerT<Profile>::printAckIDs(
     void
 ){
     Serial.printf("ACK IDs (%d):\r\n", ackIDs.size());
@@ -149,8 +173,9 @@ FLOCBufferManager::printAckIDs(
     }
 }
 
+template <typename Profile>
 void 
-FLOCBufferManager::printall(
+FLOCBufferManagerT<Profile>::printall(
     void
 ){
     Serial.printf("=== FLOC Buffers ===\r\n");
@@ -162,17 +187,20 @@ FLOCBufferManager::printall(
     Serial.printf("==================\r\n");
 }
 
+template <typename Profile>
 void
-FLOCBufferManager::addPacket(
+FLOCBufferManagerT<Profile>::addPacket(
     const FlocPacket_t& packet
 ){
-    FlocPacket_t newPacket;
-    memset(&newPacket, 0, sizeof(newPacket));
+    queue_entry entry;
+    memset(&entry, 0, sizeof(entry));
+
+    FlocPacket_t& newPacket = entry.packet;
 
     memcpy(&(newPacket.header), &(packet.header), sizeof(FlocHeader_t));
 
     size_t payload_max_size;
-    switch(packet.header.type){
+    switch(packet.header.type & FLOC_TYPE_MASK){
         case FLOC_DATA_TYPE:
             payload_max_size = sizeof(DataPacket_t);
             break;
@@ -189,14 +217,25 @@ FLOCBufferManager::addPacket(
 
     memcpy(&(newPacket.payload), &(packet.payload), payload_max_size);
 
-    // identify if the packet is a retransmission
-    if (packet.header.dest_addr != get_device_id()) {
+    // Our own frames are queued right after their pid was handed out
+    bool own = ntohs(packet.header.src_addr) == get_device_id();
+    entry.seq = own ? floc_seq_of_pid(packet.header.pid) : packet.header.pid;
+
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+    entry.timing.enqueue_ms = millis();
+    entry.timing.flags = FLOC_TIMING_ENQUEUED;
+#endif // FLOC_LATENCY
+
+    // identify if the packet is a retransmission (someone else's packet passing through)
+    if (!own) {
         if (retransmissionBuffer.size() > maxSendBuffer){
 
         #ifdef DEBUG_ON // DEBUG_ON
             Serial.printf("Retransmission buffer to full! \r\n");
         #endif // DEBUG_ON
 
+            floc_metrics_drop(FLOC_DROP_QUEUE_FULL);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_QUEUE_FULL, ntohs(packet.header.src_addr));
             return;
         }
 
@@ -205,17 +244,25 @@ FLOCBufferManager::addPacket(
         printBufferContents((uint8_t*) &newPacket, sizeof(newPacket));
     #endif // DEBUG_ON
     
-        retransmissionBuffer.push_back(newPacket);
+        retransmissionBuffer.push_back(entry);
+        floc_metrics_queue_depth(FLOC_QUEUE_RETRANSMISSION, retransmissionBuffer.size());
+        FLOC_TRACE(FLOC_TRACE_ENQUEUE, FLOC_QUEUE_RETRANSMISSION, retransmissionBuffer.size());
 
     } else if(newPacket.header.type == FLOC_COMMAND_TYPE) {
-        commandBuffer.push_back(newPacket);
+        commandBuffer.push_back(entry);
+        floc_metrics_queue_depth(FLOC_QUEUE_COMMAND, commandBuffer.size());
+        FLOC_TRACE(FLOC_TRACE_ENQUEUE, FLOC_QUEUE_COMMAND, commandBuffer.size());
 
     #ifdef DEBUG_ON // DEBUG_ON
         Serial.printf("Added to the command buffer\r\n");
     #endif // DEBUG_ON
 
-    } else if (newPacket.header.type == FLOC_RESPONSE_TYPE || newPacket.header.type == FLOC_ACK_TYPE) {
-        responseBuffer.push_back(newPacket);
+    } else if (newPacket.header.type == FLOC_RESPONSE_TYPE || newPacket.header.type == FLOC_ACK_TYPE ||
+               newPacket.header.type == FLOC_DATA_TYPE) {
+        // Sent once, nothing waits for an ACK
+        responseBuffer.push_back(entry);
+        floc_metrics_queue_depth(FLOC_QUEUE_RESPONSE, responseBuffer.size());
+        FLOC_TRACE(FLOC_TRACE_ENQUEUE, FLOC_QUEUE_RESPONSE, responseBuffer.size());
 
     #ifdef DEBUG_ON // DEBUG_ON
         Serial.printf("Added to the response buffer\r\n");
@@ -230,8 +277,9 @@ FLOCBufferManager::addPacket(
 }
 
 // check if buffer is empty
+template <typename Profile>
 int
-FLOCBufferManager::checkQueueStatus(
+FLOCBufferManagerT<Profile>::checkQueueStatus(
     void
 ){
     if(!retransmissionBuffer.empty()) {
@@ -257,17 +305,161 @@ FLOCBufferManager::checkQueueStatus(
     }
 }
 
+template <typename Profile>
+uint16_t
+FLOCBufferManagerT<Profile>::getQueueDepth(
+    FlocQueueId_e queue
+){
+    switch (queue) {
+        case FLOC_QUEUE_RETRANSMISSION:
+            return retransmissionBuffer.size();
+        case FLOC_QUEUE_RESPONSE:
+            return responseBuffer.size();
+        case FLOC_QUEUE_COMMAND:
+            return commandBuffer.size();
+        default:
+            return 0;
+    }
+}
+
+// [entries] then [queue][seq:2][transmissions][size][frame] each, then
+// [acks] and [seq:2] each. Transmissions is 0xFF for a command not yet sent.
+template <typename Profile>
+uint16_t
+FLOCBufferManagerT<Profile>::saveState(
+    uint8_t* out,
+    uint16_t capacity
+){
+    std::deque<queue_entry>* queues[FLOC_QUEUE_COUNT];
+    queues[FLOC_QUEUE_RETRANSMISSION] = &retransmissionBuffer;
+    queues[FLOC_QUEUE_RESPONSE] = &responseBuffer;
+    queues[FLOC_QUEUE_COMMAND] = &commandBuffer;
+
+    uint16_t pos = 1;
+    uint8_t entries = 0;
+
+    for (uint8_t q = 0; q < FLOC_QUEUE_COUNT; q++) {
+        for (const queue_entry& entry : *queues[q]) {
+            uint8_t size = floc_packet_size(&entry.packet);
+
+            if (pos + 5 + size > capacity) {
+                return 0;
+            }
+
+            auto tx_it = transmissionCounts.find(entry.seq);
+
+            out[pos] = q;
+            memcpy(out + pos + 1, &entry.seq, 2);
+            out[pos + 3] = tx_it != transmissionCounts.end() ? tx_it->second : 0xFF;
+            out[pos + 4] = size;
+            memcpy(out + pos + 5, &entry.packet, size);
+
+            pos += 5 + size;
+            entries++;
+        }
+    }
+
+    out[0] = entries;
+
+    if (pos + 1 + ackIDs.size() * 2 > capacity) {
+        return 0;
+    }
+
+    out[pos++] = ackIDs.size();
+
+    for (const auto& pair : ackIDs) {
+        memcpy(out + pos, &pair.first, 2);
+        pos += 2;
+    }
+
+    return pos;
+}
+
+template <typename Profile>
+uint16_t
+FLOCBufferManagerT<Profile>::restoreState(
+    const uint8_t* in,
+    uint16_t size
+){
+    std::deque<queue_entry>* queues[FLOC_QUEUE_COUNT];
+    queues[FLOC_QUEUE_RETRANSMISSION] = &retransmissionBuffer;
+    queues[FLOC_QUEUE_RESPONSE] = &responseBuffer;
+    queues[FLOC_QUEUE_COMMAND] = &commandBuffer;
+
+    // Check it all before touching anything
+    uint16_t pos = 1;
+
+    if (size < 1) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < in[0]; i++) {
+        if (pos + 5 > size || in[pos] >= FLOC_QUEUE_COUNT || in[pos + 4] > sizeof(FlocPacket_t) ||
+            pos + 5 + in[pos + 4] > size) {
+            return 0;
+        }
+
+        pos += 5 + in[pos + 4];
+    }
+
+    if (pos + 1 > size || pos + 1 + in[pos] * 2 > size) {
+        return 0;
+    }
+
+    for (uint8_t q = 0; q < FLOC_QUEUE_COUNT; q++) {
+        queues[q]->clear();
+    }
+
+    ackIDs.clear();
+    transmissionCounts.clear();
+    lastTransmitTimes.clear();
+
+    pos = 1;
+
+    for (uint8_t i = 0; i < in[0]; i++) {
+        queue_entry entry;
+        memset(&entry, 0, sizeof(entry));
+
+        memcpy(&entry.seq, in + pos + 1, 2);
+        memcpy(&entry.packet, in + pos + 5, in[pos + 4]);
+
+        if (in[pos + 3] != 0xFF) {
+            transmissionCounts[entry.seq] = in[pos + 3];
+        }
+
+        queues[in[pos]]->push_back(entry);
+        pos += 5 + in[pos + 4];
+    }
+
+    uint8_t acks = in[pos++];
+
+    for (uint8_t i = 0; i < acks; i++) {
+        uint16_t seq;
+        memcpy(&seq, in + pos, 2);
+        ackIDs[seq] = 1;
+        pos += 2;
+    }
+
+    return pos;
+}
+
+template <typename Profile>
 void
-FLOCBufferManager::addToPingList(
+FLOCBufferManagerT<Profile>::addToPingList(
     uint8_t index,
     uint16_t devAdd
 ){
+    if (index >= Profile::ping_devices) {
+        return;
+    }
+
     pingDevice[index].devAdd = devAdd;
     pingDevice[index].pingCount = 0;
 }
 
+template <typename Profile>
 bool
-FLOCBufferManager::checkPingList(
+FLOCBufferManagerT<Profile>::checkPingList(
     void
 ){
     if (pingDevice[0].devAdd != 0) {
@@ -277,26 +469,60 @@ FLOCBufferManager::checkPingList(
     return false;
 }
 
-// list of ackIDs
+// list of ackIDs. ACKs only carry the pid, so they are matched against the
+// commands we have sent and are still waiting on; any other ACK is stale.
+template <typename Profile>
 void
-FLOCBufferManager::addAckID(
+FLOCBufferManagerT<Profile>::addAckID(
     uint8_t ackID
 ){
-    ackIDs[ackID] = 1;
+    auto it = commandBuffer.begin();
+
+    for (; it != commandBuffer.end(); ++it) {
+        if (it->packet.header.pid == ackID && transmissionCounts.find(it->seq) != transmissionCounts.end()) {
+            break;
+        }
+    }
+
+    if (it == commandBuffer.end()) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("Ack ID %d matches no command in flight\r\n", ackID);
+    #endif // DEBUG_ON
+
+        return;
+    }
+
+    uint16_t seq = it->seq;
+    ackIDs[seq] = 1;
+
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+    if (it->timing.flags & FLOC_TIMING_SENT) {
+        it->timing.ack_ms = millis();
+        it->timing.flags |= FLOC_TIMING_ACKED;
+    }
+#endif // FLOC_LATENCY
+
+    // Only ACKs for a command we are still sending say anything about RTT
+    auto tx_it = lastTransmitTimes.find(seq);
+    if (tx_it != lastTransmitTimes.end()) {
+        floc_metrics_ack_rtt(millis() - tx_it->second);
+    }
+
 #ifdef DEBUG_ON // DEBUG_ON
-    Serial.printf("Ack ID %d added\r\n", ackID);
+    Serial.printf("Ack ID %d (seq %d) added\r\n", ackID, seq);
 #endif // DEBUG_ON
 
 }
 
+template <typename Profile>
 bool
-FLOCBufferManager::checkAckID(
-    uint8_t ackID
+FLOCBufferManagerT<Profile>::checkAckID(
+    uint16_t seq
 ){
-    if (ackIDs.find(ackID) != ackIDs.end()) {
-        ackIDs.erase(ackID);
+    if (ackIDs.find(seq) != ackIDs.end()) {
+        ackIDs.erase(seq);
     #ifdef DEBUG_ON // DEBUG_ON
-        Serial.printf("Ack ID %d found and removed\r\n", ackID);
+        Serial.printf("Ack seq %d found and removed\r\n", seq);
     #endif // DEBUG_ON
 
         return true;
@@ -306,13 +532,14 @@ FLOCBufferManager::checkAckID(
 }
 
 // this will send out all the pings
+template <typename Profile>
 bool
-FLOCBufferManager::pingHandler(
+FLOCBufferManagerT<Profile>::pingHandler(
     void
 ){
     static int curr_device = 0;
 
-    if (curr_device >= 3){
+    if (curr_device >= Profile::ping_devices){
         curr_device = 0;
 
         return false;
@@ -321,9 +548,16 @@ FLOCBufferManager::pingHandler(
     ping_device& dev = pingDevice[curr_device]; // Reference the real item
 
     if (dev.pingCount < maxTransmissions) {
+        // Out of ranging airtime, hold the ranging period until there is some
+        if (!floc_mac_budget_allows(FLOC_TRAFFIC_RANGING, FLOC_MAC_PING_SIZE)) {
+            return true;
+        }
+
         dev.pingCount++;
-        
+
         uint8_t modem_id = modemIdFromDidNid(get_device_id(), get_network_id());
+        FLOC_TRACE(FLOC_TRACE_PING, modem_id, dev.pingCount);
+        floc_mac_sent(FLOC_TRAFFIC_RANGING, FLOC_MAC_PING_SIZE);
         ping(modem_id);
     } else { // Maximum transmissions reached
         curr_device++;
@@ -332,12 +566,80 @@ FLOCBufferManager::pingHandler(
     return true;
 }
 
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+static void
+stampSent(
+    FlocPacketTiming_t& timing
+){
+    unsigned long now = millis();
+
+    if (!(timing.flags & FLOC_TIMING_SENT)) {
+        timing.first_tx_ms = now;
+        timing.flags |= FLOC_TIMING_SENT;
+    }
+
+    timing.last_tx_ms = now;
+}
+#endif // FLOC_LATENCY
+
+// every frame leaves the node through here
+template <typename Profile>
+void
+FLOCBufferManagerT<Profile>::transmitPacket(
+    FlocPacket_t& packet,
+    uint8_t size,
+    FlocTrafficClass_e traffic
+){
+    uint8_t* frame = (uint8_t*) &packet;
+    uint8_t compact[FLOC_MAX_SIZE];
+
+    if (floc_compact_enabled()) {
+        uint8_t header_size = floc_compact_encode(&packet.header, compact);
+        uint8_t payload_size = size - FLOC_HEADER_COMMON_SIZE;
+
+        if (header_size != 0 && header_size + payload_size <= FLOC_MAX_SIZE) {
+            memcpy(compact + header_size, &packet.payload, payload_size);
+            frame = compact;
+            size = header_size + payload_size;
+        }
+    }
+
+    // Only possible with FLOC_COMPACT_HEADER, for a header that had to be sent in full
+    if (size > FLOC_MAX_SIZE) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("[FLOCBUFF] Packet %d does not fit a full header frame, dropping\r\n", packet.header.pid);
+    #endif // DEBUG_ON
+
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(packet.header.dest_addr));
+        return;
+    }
+
+    floc_metrics_tx(packet.header.type & FLOC_TYPE_MASK);
+    FLOC_TRACE(FLOC_TRACE_TX, FLOC_TRACE_TYPE_PID(packet.header.type, packet.header.pid), size);
+
+    floc_mac_sent(traffic, size);
+
+    // A neighbor gets the frame addressed to its modem, anyone else needs a broadcast
+    if (floc_unicast_send(&packet.header, frame, size, traffic)) {
+        return;
+    }
+
+#ifdef FLOC_CAPTURE // FLOC_CAPTURE
+    floc_capture_record(FLOC_CAPTURE_LINK_BROADCAST, FLOC_CAPTURE_TX, frame, size);
+#endif // FLOC_CAPTURE
+
+    broadcast(frame, size);
+}
+
 // retransmit and remove from queue
+template <typename Profile>
 void
-FLOCBufferManager::retransmissionHandler(
+FLOCBufferManagerT<Profile>::retransmissionHandler(
     void
 ){
-    FlocPacket_t packet = retransmissionBuffer.front();
+    queue_entry& entry = retransmissionBuffer.front();
+    FlocPacket_t packet = entry.packet;
 
     if (packet.header.ttl > 1){
         packet.header.ttl--;
@@ -345,83 +647,364 @@ FLOCBufferManager::retransmissionHandler(
             Serial.printf("[FLOCBUFF] TTL Decremented to %i\r\n", packet.header.ttl);
         #endif // DEBUG_ON
 
-        uint8_t packet_size;
-        switch(packet.header.type){
-            case FLOC_DATA_TYPE:
-                packet_size = DATA_PACKET_ACTUAL_SIZE(&packet);
-                break;
-            case FLOC_COMMAND_TYPE:
-                packet_size = COMMAND_PACKET_ACTUAL_SIZE(&packet);
-                break;
-            case FLOC_ACK_TYPE:
-                packet_size = ACK_PACKET_ACTUAL_SIZE(&packet);
-                break;
-            case FLOC_RESPONSE_TYPE:
-                packet_size = RESPONSE_PACKET_ACTUAL_SIZE(&packet);
-                break;
-        }
+        uint8_t packet_size = floc_packet_size(&packet);
 
         #ifdef DEBUG_ON // DEBUG_ON
             Serial.printf("[FLOCBUFF] Retransmitting %i\r\n", packet.header.pid);
         #endif // DEBUG_ON
 
-        packet.header.last_hop_addr = get_device_id();
+        packet.header.last_hop_addr = htons(get_device_id());
 
-        broadcast((uint8_t*) &packet, packet_size);
-    } 
+        transmitPacket(packet, packet_size, FLOC_TRAFFIC_FORWARD);
+        floc_hop_forwarded(&entry.packet);
+
+    #ifdef FLOC_LATENCY // FLOC_LATENCY
+        stampSent(entry.timing);
+        floc_latency_record(ntohs(packet.header.dest_addr), &entry.timing);
+    #endif // FLOC_LATENCY
+    } else {
+        floc_metrics_drop(FLOC_DROP_TTL_EXPIRED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_TTL_EXPIRED, ntohs(packet.header.src_addr));
+    }
 
     retransmissionBuffer.pop_front(); // Remove from buffer
 }
 
-void
-FLOCBufferManager::responseHandler(
+// One of our ACK packets with nothing but the PID
+static bool
+isPlainAck(
+    const FlocPacket_t& packet
+){
+    if (packet.header.type != FLOC_ACK_TYPE || (packet.payload.ack.header.ack_pid & FLOC_ACK_AGGREGATE)) {
+        return false;
+    }
+
+#ifdef ACK_DATA // ACK_DATA
+    return packet.payload.ack.header.size == 0;
+#else
+    return true;
+#endif // ACK_DATA
+}
+
+// Response and data frames to `dest_addr` with room left for an ACK extension
+static bool
+canCarryAcks(
+    const FlocPacket_t& packet,
+    uint16_t dest_addr
+){
+    if (packet.header.type != FLOC_DATA_TYPE && packet.header.type != FLOC_RESPONSE_TYPE) {
+        return false;
+    }
+
+    return ntohs(packet.header.dest_addr) == dest_addr &&
+           floc_packet_size(&packet) + FLOC_EXT_FLAGS_SIZE + FLOC_EXT_ACKS_SIZE <= FLOC_MAX_SIZE;
+}
+
+// Moves ACKs for the packet's destination, queued or held, into an
+// extension and returns the new size
+template <typename Profile>
+uint8_t
+FLOCBufferManagerT<Profile>::attachAcks(
+    FlocPacket_t& packet,
+    uint8_t size
+){
+    uint16_t dest_addr = ntohs(packet.header.dest_addr);
+    AckGroup_t group;
+    group.base_pid = FLOC_INVALID_PID;
+    group.bitmap = 0;
+
+    for (auto it = responseBuffer.begin(); it != responseBuffer.end(); ) {
+        if (isPlainAck(it->packet) && ntohs(it->packet.header.dest_addr) == dest_addr &&
+            floc_ack_group_add(&group, it->packet.payload.ack.header.ack_pid)) {
+            it = responseBuffer.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    floc_ack_take(dest_addr, &group);
+
+    if (group.base_pid == FLOC_INVALID_PID) {
+        return size;
+    }
+
+#ifdef DEBUG_ON // DEBUG_ON
+    Serial.printf("[FLOCBUFF] ACKs %d/%04x ride along with %d\r\n", group.base_pid, group.bitmap, packet.header.pid);
+#endif // DEBUG_ON
+
+    uint8_t* ext = (uint8_t*) &packet + size;
+    ext[0] = FLOC_EXT_ACKS;
+    ext[1] = group.base_pid;
+    ext[2] = group.bitmap >> 8;
+    ext[3] = group.bitmap & 0xFF;
+
+    packet.header.type = (FlocPacketType_e) (packet.header.type | FLOC_TYPE_EXT);
+
+    return size + FLOC_EXT_FLAGS_SIZE + FLOC_EXT_ACKS_SIZE;
+}
+
+// Appends the epoch of one of our frames to its extension, starting one at
+// `base_size` if there is none yet, and returns the new size
+template <typename Profile>
+uint8_t
+FLOCBufferManagerT<Profile>::attachEpoch(
+    FlocPacket_t& packet,
+    uint8_t base_size,
+    uint8_t size,
+    uint16_t seq
+){
+    bool has_ext = size > base_size;
+    uint8_t needed = FLOC_EXT_EPOCH_SIZE + (has_ext ? 0 : FLOC_EXT_FLAGS_SIZE);
+
+    // Without room the frame goes out as epoch 0, as it would to an old node
+    if (!floc_epochs() || size + needed > FLOC_MAX_SIZE) {
+        return size;
+    }
+
+    uint8_t* frame = (uint8_t*) &packet;
+
+    if (!has_ext) {
+        frame[size++] = 0;
+        packet.header.type = (FlocPacketType_e) (packet.header.type | FLOC_TYPE_EXT);
+    }
+
+    // Epoch is the highest flag, so its field goes last
+    frame[base_size] |= FLOC_EXT_EPOCH;
+    frame[size++] = FLOC_SEQ_EPOCH(seq);
+
+    return size;
+}
+
+// Size a frame of `size` bytes goes out with once transmitPacket() has
+// compacted its header
+template <typename Profile>
+uint8_t
+FLOCBufferManagerT<Profile>::airSize(
+    const FlocPacket_t& packet,
+    uint8_t size
+){
+    uint8_t compact[FLOC_COMPACT_HEADER_MAX_SIZE];
+
+    if (floc_compact_enabled()) {
+        uint8_t header_size = floc_compact_encode(&packet.header, compact);
+        uint8_t payload_size = size - FLOC_HEADER_COMMON_SIZE;
+
+        if (header_size != 0 && header_size + payload_size <= FLOC_MAX_SIZE) {
+            return header_size + payload_size;
+        }
+    }
+
+    return size;
+}
+
+// Size `packet` goes out with once responseHandler() has added its
+// extensions, as attachAcks() and attachEpoch() would add them
+template <typename Profile>
+uint8_t
+FLOCBufferManagerT<Profile>::responseSize(
+    const FlocPacket_t& packet
+){
+    uint16_t dest_addr = ntohs(packet.header.dest_addr);
+    uint8_t size = floc_packet_size(&packet);
+    bool acks = false;
+
+    if (floc_ack_piggyback() && canCarryAcks(packet, dest_addr)) {
+        acks = floc_ack_holding(dest_addr);
+
+        for (auto it = responseBuffer.begin(); !acks && it != responseBuffer.end(); ++it) {
+            acks = isPlainAck(it->packet) && ntohs(it->packet.header.dest_addr) == dest_addr;
+        }
+    }
+
+    if (acks) {
+        size += FLOC_EXT_FLAGS_SIZE + FLOC_EXT_ACKS_SIZE;
+    }
+
+    uint8_t needed = FLOC_EXT_EPOCH_SIZE + (acks ? 0 : FLOC_EXT_FLAGS_SIZE);
+
+    if (floc_epochs() && size + needed <= FLOC_MAX_SIZE) {
+        size += needed;
+    }
+
+    return airSize(packet, size);
+}
+
+template <typename Profile>
+bool
+FLOCBufferManagerT<Profile>::responseHandler(
     void
 ){
-    FlocPacket_t packet = responseBuffer.front();
+    auto next = responseBuffer.begin();
+
+    // A queued ACK goes out with a later frame to the same node, if there is one
+    if (floc_ack_piggyback() && isPlainAck(next->packet)) {
+        uint16_t dest_addr = ntohs(next->packet.header.dest_addr);
+
+        for (auto it = next + 1; it != responseBuffer.end(); ++it) {
+            if (canCarryAcks(it->packet, dest_addr)) {
+                next = it;
+                break;
+            }
+        }
+    }
+
+    // The frame that goes out, which is not always the front one
+    if (!floc_mac_budget_allows(FLOC_TRAFFIC_RESPONSE, responseSize(next->packet))) {
+        return false;
+    }
+
+    queue_entry entry = *next;
+    responseBuffer.erase(next); // Remove from buffer
+
+    FlocPacket_t& packet = entry.packet;
+    uint8_t base_size = floc_packet_size(&packet);
+    uint8_t size = base_size;
+
+    if (floc_ack_piggyback() && canCarryAcks(packet, ntohs(packet.header.dest_addr))) {
+        size = attachAcks(packet, size);
+    }
+
+    size = attachEpoch(packet, base_size, size, entry.seq);
 
     // send packet
-    broadcast((uint8_t*) &packet, RESPONSE_PACKET_ACTUAL_SIZE(&packet));
-    responseBuffer.pop_front(); // Remove from buffer
+    transmitPacket(packet, size, FLOC_TRAFFIC_RESPONSE);
+
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+    stampSent(entry.timing);
+    floc_latency_record(ntohs(packet.header.dest_addr), &entry.timing);
+#endif // FLOC_LATENCY
+
+    return true;
+}
+
+// Size `packet` goes out with once commandHandler() has added its epoch, as
+// attachEpoch() would add it
+template <typename Profile>
+uint8_t
+FLOCBufferManagerT<Profile>::commandSize(
+    const FlocPacket_t& packet
+){
+    uint8_t size = COMMAND_PACKET_ACTUAL_SIZE(&packet);
+    uint8_t needed = FLOC_EXT_FLAGS_SIZE + FLOC_EXT_EPOCH_SIZE;
+
+    if (floc_epochs() && size + needed <= FLOC_MAX_SIZE) {
+        size += needed;
+    }
+
+    return airSize(packet, size);
 }
 
+template <typename Profile>
 void
-FLOCBufferManager::commandHandler(
+FLOCBufferManagerT<Profile>::commandHandler(
     void
 ){
     // copy the packet from the front of the queue
-    FlocPacket_t packet = commandBuffer.front();
+    queue_entry& entry = commandBuffer.front();
+    FlocPacket_t packet = entry.packet;
 
     uint8_t packet_id = packet.header.pid;
+    uint16_t seq = entry.seq;
+
+    // Acknowledged since the last send, we're done with it
+    if (checkAckID(seq)) {
+        floc_metrics_command_done(transmissionCounts[seq], true);
+        FLOC_TRACE(FLOC_TRACE_CMD_DONE, packet_id, transmissionCounts[seq] | (1 << 8));
+
+    #ifdef FLOC_LATENCY // FLOC_LATENCY
+        floc_latency_record(ntohs(packet.header.dest_addr), &entry.timing);
+    #endif // FLOC_LATENCY
+
+        commandBuffer.pop_front(); // Remove from buffer
+        transmissionCounts.erase(seq); // Remove from map
+        lastTransmitTimes.erase(seq);
+
+        return;
+    }
 
     // Check if the packet ID exists in the map, if not initialize it
-    if (transmissionCounts.find(packet_id) == transmissionCounts.end()) {
-        transmissionCounts[packet_id] = 0; // Initialize count for this packet ID
+    if (transmissionCounts.find(seq) == transmissionCounts.end()) {
+        transmissionCounts[seq] = 0; // Initialize count for this packet ID
     }
 
     // Check if the packet has been transmitted the maximum number of times
-    if(transmissionCounts[packet_id] >= maxTransmissions) {
+    if(transmissionCounts[seq] >= maxTransmissions) {
     #ifdef DEBUG_ON // DEBUG_ON
         Serial.printf("Max transmissions reached for packet ID %d\r\n", packet_id);
     #endif // DEBUG_ON
 
+        floc_metrics_command_done(transmissionCounts[seq], false);
+        FLOC_TRACE(FLOC_TRACE_CMD_DONE, packet_id, transmissionCounts[seq]);
+
+    #ifdef FLOC_LATENCY // FLOC_LATENCY
+        floc_latency_record(ntohs(packet.header.dest_addr), &entry.timing);
+    #endif // FLOC_LATENCY
+
         commandBuffer.pop_front(); // Remove from buffer
-        transmissionCounts.erase(packet_id); // Remove from map
+        transmissionCounts.erase(seq); // Remove from map
+        lastTransmitTimes.erase(seq);
+
+        // Some members may not have ACKed, which is the group's caller to judge
+        if (floc_group_is(ntohs(packet.header.dest_addr))) {
+            floc_group_command_done(packet_id);
+            return;
+        }
+
+        // Nobody is going to answer a command that never arrived
+        floc_request_complete(ntohs(packet.header.dest_addr), packet_id, FLOC_REQUEST_ERROR, nullptr, 0);
 
         floc_error_send(1, packet_id, packet.header.src_addr); // Send error packet
         return;
     }
 
-    transmissionCounts[packet_id]++; // Increment transmission count for this packet ID
+    transmissionCounts[seq]++; // Increment transmission count for this packet ID
+    lastTransmitTimes[seq] = millis();
+
+#ifdef FLOC_LATENCY // FLOC_LATENCY
+    stampSent(entry.timing);
+#endif // FLOC_LATENCY
+
+    uint8_t size = COMMAND_PACKET_ACTUAL_SIZE(&packet);
+    size = attachEpoch(packet, size, size, seq);
 
     // send packet
-    broadcast((uint8_t*) &packet, COMMAND_PACKET_ACTUAL_SIZE(&packet));
+    transmitPacket(packet, size, FLOC_TRAFFIC_COMMAND);
 }
 
 // blocking check call
+template <typename Profile>
 void
-FLOCBufferManager::queueHandler(
+FLOCBufferManagerT<Profile>::queueHandler(
     void
 ){
+    floc_request_poll();
+    floc_ack_poll();
+    floc_fec_poll();
+    floc_frag_poll();
+    floc_aggregate_poll();
+    floc_bulk_poll();
+    floc_hop_poll();
+    floc_persist_poll();
+
+    // Outside our TDMA slot nothing goes out, pings included
+    if (!floc_mac_clear_to_send()) {
+        return;
+    }
+
+    // A unicast the modem could not deliver goes out again to everyone
+    FlocUnicastFrame_t failed;
+
+    if (floc_unicast_take_failed(&failed)) {
+    #ifdef FLOC_CAPTURE // FLOC_CAPTURE
+        floc_capture_record(FLOC_CAPTURE_LINK_BROADCAST, FLOC_CAPTURE_TX, failed.frame, failed.size);
+    #endif // FLOC_CAPTURE
+
+        floc_mac_sent(failed.traffic, failed.size);
+        broadcast(failed.frame, failed.size);
+
+        return;
+    }
+
     if (checkPingList()) { // ranging period started
         if (pingHandler()) {
             return; // Continue with ranging period, don't send other packets
@@ -432,18 +1015,19 @@ FLOCBufferManager::queueHandler(
     }
 
     #ifdef DEBUG_ON // DEBUG_ON
-        flocBuffer.printall();
+        printall();
     #endif // DEBUG_ON
 
-    if(!retransmissionBuffer.empty()) {
+    // A class over its airtime budget is passed over for the next one
+    if(!retransmissionBuffer.empty() &&
+       floc_mac_budget_allows(FLOC_TRAFFIC_FORWARD, floc_packet_size(&retransmissionBuffer.front().packet))) {
         retransmissionHandler();
 
         return;
-    } else if (!responseBuffer.empty()) {
-        responseHandler();
-
+    } else if (!responseBuffer.empty() && responseHandler()) {
         return;
-    } else if (!commandBuffer.empty()) {
+    } else if (!commandBuffer.empty() &&
+               floc_mac_budget_allows(FLOC_TRAFFIC_COMMAND, commandSize(commandBuffer.front().packet))) {
         commandHandler();
 
         return;
@@ -451,3 +1035,5 @@ FLOCBufferManager::queueHandler(
         /* Do Nothing */
     }
 }
+
+template class FLOCBufferManagerT<FlocProfile>;
@@ -0,0 +1,720 @@
+/*
+ * Bulk transfer sessions.
+ *
+ * Both sides keep a ring of FLOC_BULK_MAX_WINDOW chunks indexed by sequence
+ * number. The window is kept in 1/64 frame units so that growing it by one
+ * frame per window of ACKs works in integer arithmetic at any size.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_bulk.hpp"
+#include "floc_ack.hpp"
+#include "floc_frag.hpp"
+#include "floc_buffer.hpp"
+#include "floc_group.hpp"
+#include "floc_metrics.hpp"
+#include "floc_trace.hpp"
+#include "floc_utils.hpp"
+
+#define WINDOW_UNIT 64
+
+typedef enum
+BulkSlotState_e : uint8_t {
+    SLOT_FREE = 0x0,
+    SLOT_FILLED,        // Written, never sent
+    SLOT_SENT,
+    SLOT_ACKED,
+};
+
+struct
+bulk_slot {
+    BulkSlotState_e state;
+    bool lost;              // Waiting to be resent
+    uint8_t size;
+    uint8_t tx_count;
+    uint32_t tx_order;      // Orders transmissions, to tell which frames were overtaken
+    unsigned long sent_ms;
+    uint8_t data[FLOC_BULK_CHUNK];
+};
+
+struct
+bulk_tx {
+    bool active;
+    bool closed;
+    bool fin_written;
+    bool recovering;        // The window was cut, and is not cut again until recover_seq is ACKed
+    uint16_t dest;
+    uint8_t session;
+    uint16_t base;          // Oldest unACKed
+    uint16_t next_send;     // Oldest never sent
+    uint16_t next_seq;      // Next to be written
+    uint16_t recover_seq;
+    uint16_t window;        // In WINDOW_UNIT
+    uint16_t loss_permille; // Moving average over sent frames
+    uint8_t timeouts;
+    uint32_t tx_order;
+    uint32_t acked_order;   // Latest transmission known to have arrived
+    uint32_t srtt_ms;
+    uint32_t rttvar_ms;
+    uint32_t rto_ms;
+    uint32_t frames_sent;
+    uint32_t retransmissions;
+    uint32_t bytes_acked;
+    bulk_slot slots[FLOC_BULK_MAX_WINDOW];
+};
+
+struct
+bulk_rx {
+    bool active;
+    bool finished;
+    uint16_t src;
+    uint8_t session;
+    uint16_t cum;           // Next expected
+    uint32_t have;          // Bit i: cum + 1 + i is buffered
+    uint8_t unacked;
+    unsigned long updated_ms;
+    uint8_t sizes[FLOC_BULK_MAX_WINDOW];
+    uint8_t data[FLOC_BULK_MAX_WINDOW][FLOC_BULK_CHUNK];
+};
+
+static bulk_tx txSessions[FLOC_BULK_TX_SESSIONS];
+static bulk_rx rxSessions[FLOC_BULK_RX_SESSIONS];
+static uint8_t nextSession = 0;
+
+static FlocBulkRxHandler_t rxHandler = nullptr;
+static FlocBulkTxHandler_t txHandler = nullptr;
+
+static inline uint16_t
+seq_diff(
+    uint16_t a,
+    uint16_t b
+){
+    return (a - b) & FLOC_BULK_SEQ_MASK;
+}
+
+static inline bulk_slot*
+slot_for(
+    bulk_tx* t,
+    uint16_t seq
+){
+    return &t->slots[seq % FLOC_BULK_MAX_WINDOW];
+}
+
+void
+floc_bulk_set_handlers(
+    FlocBulkRxHandler_t rx_handler,
+    FlocBulkTxHandler_t tx_handler
+){
+    rxHandler = rx_handler;
+    txHandler = tx_handler;
+}
+
+// ----- Sending -----
+
+static bulk_tx*
+find_tx(
+    uint8_t session
+){
+    for (int i = 0; i < FLOC_BULK_TX_SESSIONS; i++) {
+        if (txSessions[i].active && txSessions[i].session == session) {
+            return &txSessions[i];
+        }
+    }
+
+    return nullptr;
+}
+
+uint8_t
+floc_bulk_open(
+    uint16_t dest_addr
+){
+    // Only one receiver can acknowledge
+    if (dest_addr == FLOC_ACK_BROADCAST || floc_group_is(dest_addr)) {
+        return FLOC_BULK_INVALID;
+    }
+
+    for (int i = 0; i < FLOC_BULK_TX_SESSIONS; i++) {
+        bulk_tx* t = &txSessions[i];
+
+        if (t->active) {
+            continue;
+        }
+
+        memset(t, 0, sizeof(bulk_tx));
+        t->active = true;
+        t->dest = dest_addr;
+        t->session = nextSession;
+        t->window = FLOC_BULK_INITIAL_WINDOW * WINDOW_UNIT;
+        t->rto_ms = FLOC_BULK_INITIAL_RTO_MS;
+
+        nextSession = (nextSession + 1) & FLOC_FRAG_XFER_MASK;
+
+        return t->session;
+    }
+
+    return FLOC_BULK_INVALID;
+}
+
+uint16_t
+floc_bulk_write(
+    uint8_t session,
+    const uint8_t* data,
+    uint16_t size
+){
+    bulk_tx* t = find_tx(session);
+
+    if (t == nullptr || t->closed) {
+        return 0;
+    }
+
+    uint16_t taken = 0;
+
+    // Top up the last chunk if it has not been sent yet
+    if (t->next_seq != t->base) {
+        bulk_slot* s = slot_for(t, t->next_seq - 1);
+
+        if (s->state == SLOT_FILLED && s->size < FLOC_BULK_CHUNK) {
+            uint8_t n = FLOC_BULK_CHUNK - s->size;
+            if (n > size) {
+                n = size;
+            }
+
+            memcpy(s->data + s->size, data, n);
+            s->size += n;
+            taken += n;
+        }
+    }
+
+    while (taken < size && seq_diff(t->next_seq, t->base) < FLOC_BULK_MAX_WINDOW) {
+        bulk_slot* s = slot_for(t, t->next_seq);
+        uint16_t n = size - taken;
+        if (n > FLOC_BULK_CHUNK) {
+            n = FLOC_BULK_CHUNK;
+        }
+
+        memset(s, 0, offsetof(bulk_slot, data));
+        s->state = SLOT_FILLED;
+        s->size = n;
+        memcpy(s->data, data + taken, n);
+
+        t->next_seq = (t->next_seq + 1) & FLOC_BULK_SEQ_MASK;
+        taken += n;
+    }
+
+    return taken;
+}
+
+void
+floc_bulk_close(
+    uint8_t session
+){
+    bulk_tx* t = find_tx(session);
+
+    if (t != nullptr) {
+        t->closed = true;
+    }
+}
+
+bool
+floc_bulk_stats(
+    uint8_t session,
+    FlocBulkStats_t* out
+){
+    bulk_tx* t = find_tx(session);
+
+    if (t == nullptr) {
+        return false;
+    }
+
+    out->window = t->window / WINDOW_UNIT;
+    out->srtt_ms = t->srtt_ms;
+    out->rto_ms = t->rto_ms;
+    out->frames_sent = t->frames_sent;
+    out->retransmissions = t->retransmissions;
+    out->bytes_acked = t->bytes_acked;
+    out->loss_permille = t->loss_permille;
+
+    return true;
+}
+
+static uint16_t
+in_flight(
+    bulk_tx* t
+){
+    uint16_t n = 0;
+
+    for (uint16_t seq = t->base; seq != t->next_send; seq = (seq + 1) & FLOC_BULK_SEQ_MASK) {
+        bulk_slot* s = slot_for(t, seq);
+        n += s->state == SLOT_SENT && !s->lost;
+    }
+
+    return n;
+}
+
+// A partial chunk waits to be filled while anything is in flight
+static bool
+can_send_new(
+    bulk_tx* t
+){
+    if (t->next_send == t->next_seq || in_flight(t) * WINDOW_UNIT >= t->window) {
+        return false;
+    }
+
+    bulk_slot* s = slot_for(t, t->next_send);
+
+    return s->size == FLOC_BULK_CHUNK || t->closed || in_flight(t) == 0;
+}
+
+static bool
+first_lost(
+    bulk_tx* t,
+    uint16_t* seq
+){
+    for (uint16_t s = t->base; s != t->next_send; s = (s + 1) & FLOC_BULK_SEQ_MASK) {
+        bulk_slot* slot = slot_for(t, s);
+
+        if (slot->state == SLOT_SENT && slot->lost) {
+            *seq = s;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+send_slot(
+    bulk_tx* t,
+    uint16_t seq
+){
+    bulk_slot* s = slot_for(t, seq);
+
+    s->state = SLOT_SENT;
+    s->lost = false;
+    s->tx_count++;
+    s->tx_order = ++t->tx_order;
+    s->sent_ms = millis();
+
+    t->frames_sent++;
+    if (s->tx_count > 1) {
+        t->retransmissions++;
+    }
+
+    uint16_t unused;
+    uint16_t wire_seq = seq;
+
+    // Nothing else can go out until an ACK arrives, so ask for one now
+    if (!first_lost(t, &unused) && !can_send_new(t)) {
+        wire_seq |= FLOC_BULK_ACK_NOW;
+    }
+
+    FlocPacket_t packet;
+    uint8_t* payload = packet.payload.data.payload;
+
+    floc_build_header(&packet, TTL_START, FLOC_DATA_TYPE, t->dest, false);
+
+    packet.payload.data.header.size = FLOC_BULK_HEADER_SIZE + s->size;
+    packet.payload.data.header.encoding = DATA_ENCODING_FRAG;
+
+    payload[0] = FLOC_FRAG_KIND_BULK | (t->session << 2);
+    payload[1] = wire_seq >> 8;
+    payload[2] = wire_seq & 0xFF;
+    memcpy(payload + FLOC_BULK_HEADER_SIZE, s->data, s->size);
+
+    flocBuffer.addPacket(packet);
+}
+
+static void
+finish_tx(
+    bulk_tx* t,
+    bool delivered
+){
+    t->active = false;
+
+    if (txHandler != nullptr) {
+        txHandler(t->dest, t->session, delivered);
+    }
+}
+
+// Background noise only trims the window, sustained heavy loss halves it
+static void
+cut_window(
+    bulk_tx* t
+){
+    uint16_t cut = t->loss_permille / 2;
+    cut = cut < 31 ? 31 : (cut > 500 ? 500 : cut);
+
+    uint16_t window = (uint32_t) t->window * (1000 - cut) / 1000;
+    t->window = window > FLOC_BULK_MIN_WINDOW * WINDOW_UNIT ? window : FLOC_BULK_MIN_WINDOW * WINDOW_UNIT;
+    t->recovering = true;
+    t->recover_seq = t->next_send;
+}
+
+static void
+poll_tx(
+    bulk_tx* t,
+    unsigned long now
+){
+    // The end of the stream is an empty chunk, once there is room for it
+    if (t->closed && !t->fin_written && seq_diff(t->next_seq, t->base) < FLOC_BULK_MAX_WINDOW) {
+        bulk_slot* s = slot_for(t, t->next_seq);
+
+        memset(s, 0, offsetof(bulk_slot, data));
+        s->state = SLOT_FILLED;
+
+        t->next_seq = (t->next_seq + 1) & FLOC_BULK_SEQ_MASK;
+        t->fin_written = true;
+    }
+
+    // Retransmission timeout, measured from the oldest frame still unACKed
+    for (uint16_t seq = t->base; seq != t->next_send; seq = (seq + 1) & FLOC_BULK_SEQ_MASK) {
+        bulk_slot* s = slot_for(t, seq);
+
+        if (s->state != SLOT_SENT || s->lost) {
+            continue;
+        }
+
+        if (now - s->sent_ms < t->rto_ms) {
+            break;
+        }
+
+        if (++t->timeouts > FLOC_BULK_MAX_TIMEOUTS) {
+            finish_tx(t, false);
+            return;
+        }
+
+        // Resending just the oldest frame asks for an ACK that shows what else is missing
+        s->lost = true;
+        t->loss_permille += (1000 - t->loss_permille) / 16;
+
+        cut_window(t);
+        t->rto_ms = t->rto_ms * 2 < FLOC_BULK_MAX_RTO_MS ? t->rto_ms * 2 : FLOC_BULK_MAX_RTO_MS;
+        break;
+    }
+
+    uint16_t seq;
+
+    while (flocBuffer.getQueueDepth(FLOC_QUEUE_RESPONSE) < FLOC_BULK_QUEUE_AHEAD) {
+        if (first_lost(t, &seq)) {
+            send_slot(t, seq);
+        } else if (can_send_new(t)) {
+            seq = t->next_send;
+            t->next_send = (t->next_send + 1) & FLOC_BULK_SEQ_MASK;
+            send_slot(t, seq);
+        } else {
+            break;
+        }
+    }
+}
+
+static void
+ack_slot(
+    bulk_tx* t,
+    bulk_slot* s,
+    unsigned long now
+){
+    if (s->state != SLOT_SENT) {
+        return;
+    }
+
+    s->state = SLOT_ACKED;
+    s->lost = false;
+    t->bytes_acked += s->size;
+    t->loss_permille -= t->loss_permille / 16;
+
+    if (s->tx_order > t->acked_order) {
+        t->acked_order = s->tx_order;
+    }
+
+    // Only frames sent once give an unambiguous round trip
+    if (s->tx_count == 1) {
+        uint32_t rtt = now - s->sent_ms;
+
+        if (t->srtt_ms == 0) {
+            t->srtt_ms = rtt;
+            t->rttvar_ms = rtt / 2;
+        } else {
+            uint32_t err = rtt > t->srtt_ms ? rtt - t->srtt_ms : t->srtt_ms - rtt;
+            t->rttvar_ms = (3 * t->rttvar_ms + err) / 4;
+            t->srtt_ms = (7 * t->srtt_ms + rtt) / 8;
+        }
+    }
+
+    // One more frame per window's worth of ACKs
+    if (t->window < FLOC_BULK_MAX_WINDOW * WINDOW_UNIT) {
+        t->window += WINDOW_UNIT * WINDOW_UNIT / t->window;
+    }
+}
+
+static void
+receive_ack(
+    uint16_t src,
+    uint8_t session,
+    const uint8_t* data,
+    uint8_t size
+){
+    bulk_tx* t = find_tx(session);
+
+    if (t == nullptr || t->dest != src || size != FLOC_BULK_ACK_SIZE) {
+        return;
+    }
+
+    uint16_t cum = ((data[1] << 8) | data[2]) & FLOC_BULK_SEQ_MASK;
+    uint32_t bitmap = ((uint32_t) data[3] << 24) | ((uint32_t) data[4] << 16) | (data[5] << 8) | data[6];
+    uint16_t outstanding = seq_diff(t->next_send, t->base);
+    unsigned long now = millis();
+    uint32_t acked_before = t->bytes_acked;
+    uint32_t order_before = t->acked_order;
+
+    if (seq_diff(cum, t->base) > outstanding) {
+        return;     // Stale, or not ours
+    }
+
+    for (uint16_t seq = t->base; seq != cum; seq = (seq + 1) & FLOC_BULK_SEQ_MASK) {
+        ack_slot(t, slot_for(t, seq), now);
+    }
+
+    for (int i = 0; i < 32; i++) {
+        uint16_t seq = (cum + 1 + i) & FLOC_BULK_SEQ_MASK;
+
+        if ((bitmap & (1UL << i)) && seq_diff(seq, t->base) < outstanding) {
+            ack_slot(t, slot_for(t, seq), now);
+        }
+    }
+
+    while (t->base != t->next_send && slot_for(t, t->base)->state == SLOT_ACKED) {
+        slot_for(t, t->base)->state = SLOT_FREE;
+        t->base = (t->base + 1) & FLOC_BULK_SEQ_MASK;
+    }
+
+    if (t->bytes_acked != acked_before || t->acked_order != order_before) {
+        t->timeouts = 0;
+
+        uint32_t rto = t->srtt_ms + 4 * t->rttvar_ms;
+        t->rto_ms = rto < FLOC_BULK_MIN_RTO_MS ? FLOC_BULK_MIN_RTO_MS : (rto > FLOC_BULK_MAX_RTO_MS ? FLOC_BULK_MAX_RTO_MS : rto);
+    }
+
+    if (t->recovering && seq_diff(t->base, t->recover_seq) <= seq_diff(t->next_send, t->recover_seq)) {
+        t->recovering = false;
+    }
+
+    // Anything sent before a frame that arrived, and not ACKed itself, was lost
+    bool loss = false;
+
+    for (uint16_t seq = t->base; seq != t->next_send; seq = (seq + 1) & FLOC_BULK_SEQ_MASK) {
+        bulk_slot* s = slot_for(t, seq);
+
+        if (s->state == SLOT_SENT && !s->lost && s->tx_order < t->acked_order) {
+            s->lost = true;
+            t->loss_permille += (1000 - t->loss_permille) / 16;
+            loss = true;
+        }
+    }
+
+    if (loss && !t->recovering) {
+        cut_window(t);
+    }
+
+    if (t->fin_written && t->base == t->next_seq) {
+        finish_tx(t, true);
+    }
+}
+
+// ----- Receiving -----
+
+static void
+send_ack(
+    bulk_rx* r
+){
+    FlocPacket_t packet;
+    uint8_t* payload = packet.payload.data.payload;
+
+    floc_build_header(&packet, TTL_START, FLOC_DATA_TYPE, r->src, false);
+
+    packet.payload.data.header.size = FLOC_BULK_ACK_SIZE;
+    packet.payload.data.header.encoding = DATA_ENCODING_FRAG;
+
+    payload[0] = FLOC_FRAG_KIND_BULK_ACK | (r->session << 2);
+    payload[1] = r->cum >> 8;
+    payload[2] = r->cum & 0xFF;
+    payload[3] = (r->have >> 24) & 0xFF;
+    payload[4] = (r->have >> 16) & 0xFF;
+    payload[5] = (r->have >> 8) & 0xFF;
+    payload[6] = r->have & 0xFF;
+
+    flocBuffer.addPacket(packet);
+
+    r->unacked = 0;
+}
+
+static bulk_rx*
+find_rx(
+    uint16_t src,
+    uint8_t session
+){
+    bulk_rx* slot = nullptr;
+
+    for (int i = 0; i < FLOC_BULK_RX_SESSIONS; i++) {
+        bulk_rx* r = &rxSessions[i];
+
+        if (r->active && r->src == src && r->session == session) {
+            return r;
+        }
+
+        // Finished sessions only linger to re-ACK, any new session takes priority
+        if (!r->active || (r->finished && (slot == nullptr || slot->active))) {
+            slot = r;
+        }
+    }
+
+    if (slot == nullptr) {
+        return nullptr;
+    }
+
+    memset(slot, 0, offsetof(bulk_rx, data));
+    slot->active = true;
+    slot->src = src;
+    slot->session = session;
+
+    return slot;
+}
+
+static void
+deliver(
+    bulk_rx* r,
+    const uint8_t* data,
+    uint8_t size
+){
+    if (size == 0) {
+        r->finished = true;
+    }
+
+    if (rxHandler != nullptr) {
+        rxHandler(r->src, r->session, data, size);
+    }
+}
+
+static bool
+receive_data(
+    uint16_t src,
+    uint8_t session,
+    const uint8_t* data,
+    uint8_t size
+){
+    if (size < FLOC_BULK_HEADER_SIZE || size > FLOC_BULK_HEADER_SIZE + FLOC_BULK_CHUNK) {
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, src);
+        return false;
+    }
+
+    bulk_rx* r = find_rx(src, session);
+
+    if (r == nullptr) {
+        floc_metrics_drop(FLOC_DROP_QUEUE_FULL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_QUEUE_FULL, src);
+        return true;
+    }
+
+    uint16_t wire_seq = (data[1] << 8) | data[2];
+    uint16_t seq = wire_seq & FLOC_BULK_SEQ_MASK;
+    const uint8_t* chunk = data + FLOC_BULK_HEADER_SIZE;
+    uint8_t chunk_size = size - FLOC_BULK_HEADER_SIZE;
+    uint16_t d = seq_diff(seq, r->cum);
+    bool ack = (wire_seq & FLOC_BULK_ACK_NOW) != 0;
+
+    r->updated_ms = millis();
+
+    if (r->finished || d >= FLOC_BULK_MAX_WINDOW) {
+        // Already delivered, or a sender that lost our ACKs
+        ack = true;
+    } else if (d == 0) {
+        // In order, straight from the frame
+        deliver(r, chunk, chunk_size);
+        r->cum = (r->cum + 1) & FLOC_BULK_SEQ_MASK;
+
+        while ((r->have & 1) && !r->finished) {
+            uint8_t index = r->cum % FLOC_BULK_MAX_WINDOW;
+
+            deliver(r, r->data[index], r->sizes[index]);
+            r->have >>= 1;
+            r->cum = (r->cum + 1) & FLOC_BULK_SEQ_MASK;
+        }
+
+        r->have >>= 1;
+        ack = ack || r->finished || (r->have != 0);
+    } else {
+        uint8_t index = seq % FLOC_BULK_MAX_WINDOW;
+
+        bool duplicate = (r->have & (1UL << (d - 1))) != 0;
+        bool after_gap = d == 1 || !(r->have & (1UL << (d - 2)));
+
+        if (!duplicate) {
+            memcpy(r->data[index], chunk, chunk_size);
+            r->sizes[index] = chunk_size;
+            r->have |= 1UL << (d - 1);
+        }
+
+        // A new gap or a repeat, let the sender know right away
+        ack = ack || duplicate || after_gap;
+    }
+
+    if (ack || ++r->unacked >= FLOC_BULK_ACK_EVERY) {
+        send_ack(r);
+    }
+
+    return true;
+}
+
+bool
+floc_bulk_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size
+){
+    uint16_t src = ntohs(floc_header->src_addr);
+    uint8_t kind = data[0] & 0x3;
+    uint8_t session = data[0] >> 2;
+
+    if (kind == FLOC_FRAG_KIND_BULK_ACK) {
+        receive_ack(src, session, data, size);
+        return true;
+    }
+
+    return receive_data(src, session, data, size);
+}
+
+// ----- Housekeeping -----
+
+void
+floc_bulk_poll(
+    void
+){
+    unsigned long now = millis();
+
+    for (int i = 0; i < FLOC_BULK_RX_SESSIONS; i++) {
+        bulk_rx* r = &rxSessions[i];
+
+        if (r->active && now - r->updated_ms >= FLOC_BULK_RX_TIMEOUT_MS) {
+            r->active = false;
+        }
+    }
+
+    for (int i = 0; i < FLOC_BULK_TX_SESSIONS; i++) {
+        if (txSessions[i].active) {
+            poll_tx(&txSessions[i], now);
+        }
+    }
+}
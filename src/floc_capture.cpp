@@ -0,0 +1,104 @@
+/*
+ * Frame capture.
+ *
+ * The capture buffer is owned by the application (a RAM array, a PSRAM
+ * region, an mmap'd file on Linux). Records are appended until it is full;
+ * after that they are counted as dropped rather than wrapping, so the start
+ * of an incident is never overwritten.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc.hpp"
+#include "floc_capture.hpp"
+
+static uint8_t* capture_buf = nullptr;
+static uint32_t capture_capacity = 0;
+static uint32_t capture_length = 0;
+static uint32_t capture_dropped = 0;
+
+bool
+floc_capture_begin(
+    uint8_t* buf,
+    uint32_t capacity
+){
+    if (buf == nullptr || capacity < FLOC_CAPTURE_FILE_HEADER_SIZE) {
+        return false;
+    }
+
+    FlocCaptureFileHeader_t* header = (FlocCaptureFileHeader_t*) buf;
+
+    memcpy(header->magic, FLOC_CAPTURE_MAGIC, FLOC_CAPTURE_MAGIC_SIZE);
+    header->version = FLOC_CAPTURE_VERSION;
+    header->res = 0;
+    header->network_id = get_network_id();
+    header->device_id = get_device_id();
+
+    capture_buf = buf;
+    capture_capacity = capacity;
+    capture_length = FLOC_CAPTURE_FILE_HEADER_SIZE;
+    capture_dropped = 0;
+
+    return true;
+}
+
+void
+floc_capture_end(
+    void
+){
+    capture_buf = nullptr;
+    capture_capacity = 0;
+}
+
+void
+floc_capture_record(
+    FlocCaptureLink_e link,
+    FlocCaptureDirection_e direction,
+    const uint8_t* frame,
+    uint8_t size
+){
+    if (capture_buf == nullptr) {
+        return;
+    }
+
+    if (capture_capacity - capture_length < FLOC_CAPTURE_RECORD_HEADER_SIZE + size) {
+        capture_dropped++;
+        return;
+    }
+
+    FlocCaptureRecordHeader_t* record = (FlocCaptureRecordHeader_t*) (capture_buf + capture_length);
+
+    record->timestamp_ms = millis();
+    record->link = link;
+    record->direction = direction;
+    record->size = size;
+
+    memcpy(record + 1, frame, size);
+
+    capture_length += FLOC_CAPTURE_RECORD_HEADER_SIZE + size;
+}
+
+uint32_t
+floc_capture_length(
+    void
+){
+    return capture_length;
+}
+
+uint32_t
+floc_capture_dropped(
+    void
+){
+    return capture_dropped;
+}
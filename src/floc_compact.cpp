@@ -0,0 +1,212 @@
+/*
+ * Compact header codec.
+ *
+ * Bytes are assembled by hand rather than through a packed bitfield struct
+ * so the layout does not depend on the compiler.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_compact.hpp"
+#include "floc_utils.hpp"
+
+#define UNUSED_ADDRESS 0xFFFF
+
+#ifdef FLOC_COMPACT_HEADER // FLOC_COMPACT_HEADER
+static bool compactEnabled = true;
+#else
+static bool compactEnabled = false;
+#endif // FLOC_COMPACT_HEADER
+
+static uint16_t addressTable[FLOC_COMPACT_ADDRESSES];
+static uint8_t addressCount = 0;    // 0 means identity mapping
+
+void
+floc_compact_enable(
+    bool enable
+){
+    compactEnabled = enable;
+}
+
+bool
+floc_compact_enabled(
+    void
+){
+    return compactEnabled;
+}
+
+bool
+floc_compact_set_address(
+    uint8_t short_addr,
+    uint16_t device_id
+){
+    if (short_addr >= FLOC_COMPACT_ADDRESSES || device_id == 0xFFFF) {
+        return false;
+    }
+
+    // Entries between the old end of the table and this one stay unused
+    while (addressCount <= short_addr) {
+        addressTable[addressCount++] = UNUSED_ADDRESS;
+    }
+
+    addressTable[short_addr] = device_id;
+
+    return true;
+}
+
+void
+floc_compact_clear_addresses(
+    void
+){
+    addressCount = 0;
+}
+
+uint8_t
+floc_compact_nid_hash(
+    uint16_t nid
+){
+    return (nid ^ (nid >> 4) ^ (nid >> 8) ^ (nid >> 12)) & 0xF;
+}
+
+bool
+floc_compact_is_compact(
+    const uint8_t* frame,
+    uint8_t size
+){
+    return size > 3 && ((frame[3] & 0x3) & FLOC_RES_COMPACT);
+}
+
+static bool
+to_short(
+    uint16_t addr,
+    uint8_t* short_addr
+){
+    if (addr == 0xFFFF) {
+        *short_addr = FLOC_COMPACT_BROADCAST;
+        return true;
+    }
+
+    if (addressCount == 0) {
+        *short_addr = addr;
+        return addr < FLOC_COMPACT_BROADCAST;
+    }
+
+    for (uint8_t i = 0; i < addressCount; i++) {
+        if (addressTable[i] == addr) {
+            *short_addr = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool
+to_full(
+    uint8_t short_addr,
+    uint16_t* addr
+){
+    if (short_addr == FLOC_COMPACT_BROADCAST) {
+        *addr = 0xFFFF;
+        return true;
+    }
+
+    if (addressCount == 0) {
+        *addr = short_addr;
+        return true;
+    }
+
+    if (short_addr >= addressCount || addressTable[short_addr] == UNUSED_ADDRESS) {
+        return false;
+    }
+
+    *addr = addressTable[short_addr];
+
+    return true;
+}
+
+uint8_t
+floc_compact_encode(
+    const FlocHeader_t* header,
+    uint8_t* out
+){
+    uint16_t src_addr = ntohs(header->src_addr);
+    uint16_t last_hop_addr = ntohs(header->last_hop_addr);
+    uint8_t dest, src, last_hop;
+
+    if (!to_short(ntohs(header->dest_addr), &dest) || !to_short(src_addr, &src)) {
+        return 0;
+    }
+
+    bool first_hop = last_hop_addr == src_addr;
+
+    if (!first_hop && !to_short(last_hop_addr, &last_hop)) {
+        return 0;
+    }
+
+    out[0] = (header->type & 0xF) | (header->ttl << 4);
+    out[1] = floc_compact_nid_hash(ntohs(header->nid)) | (first_hop ? 0 : FLOC_COMPACT_LAST_HOP);
+    out[2] = dest;
+    out[3] = ((header->res | FLOC_RES_COMPACT) & 0x3) | (header->pid << 2);
+    out[4] = src;
+
+    if (first_hop) {
+        return FLOC_COMPACT_HEADER_MIN_SIZE;
+    }
+
+    out[5] = last_hop;
+
+    return FLOC_COMPACT_HEADER_MAX_SIZE;
+}
+
+uint8_t
+floc_compact_decode(
+    const uint8_t* frame,
+    uint8_t size,
+    FlocHeader_t* header
+){
+    if (size < FLOC_COMPACT_HEADER_MIN_SIZE) {
+        return 0;
+    }
+
+    bool first_hop = !(frame[1] & FLOC_COMPACT_LAST_HOP);
+    uint8_t header_size = first_hop ? FLOC_COMPACT_HEADER_MIN_SIZE : FLOC_COMPACT_HEADER_MAX_SIZE;
+    uint16_t dest_addr, src_addr, last_hop_addr;
+
+    if (size < header_size) {
+        return 0;
+    }
+
+    if (!to_full(frame[2], &dest_addr) || !to_full(frame[4], &src_addr)) {
+        return 0;
+    }
+
+    if (first_hop) {
+        last_hop_addr = src_addr;
+    } else if (!to_full(frame[5], &last_hop_addr)) {
+        return 0;
+    }
+
+    memset(header, 0, sizeof(FlocHeader_t));
+    header->type = (FlocPacketType_e) (frame[0] & 0xF);
+    header->ttl = frame[0] >> 4;
+    header->nid = htons(get_network_id());
+    header->res = frame[3] & 0x3 & ~FLOC_RES_COMPACT;
+    header->pid = frame[3] >> 2;
+    header->dest_addr = htons(dest_addr);
+    header->src_addr = htons(src_addr);
+    header->last_hop_addr = htons(last_hop_addr);
+
+    return header_size;
+}
@@ -0,0 +1,114 @@
+/*
+ * Command dispatch table.
+ *
+ * The built-in commands are registered lazily on first use rather than by
+ * a static constructor, so applications may register from their own static
+ * constructors without depending on initialisation order.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_dispatch.hpp"
+#include "floc_telemetry.hpp"
+
+static FlocCommandEntry_t commandTable[256];
+static bool commandTableReady = false;
+
+static void
+handle_telemetry(
+    const FlocCommandContext_t* ctx
+){
+    floc_telemetry_send(ctx->src_addr, ctx->pid);
+}
+
+static void
+handle_status(
+    const FlocCommandContext_t* ctx
+){
+    floc_status_query(ctx->src_addr, ctx->pid);
+}
+
+static void
+set_entry(
+    uint8_t command_type,
+    FlocCommandHandler_t handler,
+    uint8_t flags,
+    uint8_t min_size,
+    uint8_t max_size,
+    uint8_t priority
+){
+    FlocCommandEntry_t* entry = &commandTable[command_type];
+
+    entry->handler = handler;
+    entry->flags = flags | FLOC_DISPATCH_REGISTERED;
+    entry->min_size = min_size;
+    entry->max_size = max_size;
+    entry->priority = priority;
+}
+
+static void
+register_builtins(
+    void
+){
+    commandTableReady = true;
+
+    set_entry(COMMAND_TYPE_1, nullptr, FLOC_DISPATCH_NEEDS_ACK, 0, MAX_COMMAND_PAYLOAD_SIZE, 0);
+    set_entry(COMMAND_TYPE_2, nullptr, FLOC_DISPATCH_NEEDS_ACK, 0, MAX_COMMAND_PAYLOAD_SIZE, 0);
+    set_entry(COMMAND_TYPE_TELEMETRY, handle_telemetry, FLOC_DISPATCH_NEEDS_ACK, 0, 0, 0);
+    set_entry(COMMAND_TYPE_STATUS, handle_status, FLOC_DISPATCH_NEEDS_ACK, 0, 0, 0);
+}
+
+bool
+floc_dispatch_register(
+    CommandType_e command_type,
+    FlocCommandHandler_t handler,
+    uint8_t flags,
+    uint8_t min_size,
+    uint8_t max_size,
+    uint8_t priority
+){
+    if (min_size > max_size || max_size > MAX_COMMAND_PAYLOAD_SIZE) {
+        return false;
+    }
+
+    if (!commandTableReady) {
+        register_builtins();
+    }
+
+    set_entry(command_type, handler, flags, min_size, max_size, priority);
+
+    return true;
+}
+
+void
+floc_dispatch_unregister(
+    CommandType_e command_type
+){
+    if (!commandTableReady) {
+        register_builtins();
+    }
+
+    memset(&commandTable[command_type], 0, sizeof(FlocCommandEntry_t));
+}
+
+const FlocCommandEntry_t*
+floc_dispatch_lookup(
+    uint8_t command_type
+){
+    if (!commandTableReady) {
+        register_builtins();
+    }
+
+    return &commandTable[command_type];
+}
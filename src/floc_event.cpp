@@ -0,0 +1,120 @@
+/*
+ * Parsed-packet event ring.
+ *
+ * `head` is only written by the producer and `tail` only by the consumer.
+ * An event is fully copied into its slot before `head` moves past it.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_event.hpp"
+#include "floc_metrics.hpp"
+
+static FlocEvent_t eventRing[FLOC_EVENT_QUEUE_DEPTH];
+static volatile uint8_t eventHead = 0;  // Next slot to write
+static volatile uint8_t eventTail = 0;  // Next slot to read
+static uint32_t eventDropped = 0;
+static FlocEventHandler_t eventHandler = nullptr;
+
+bool
+floc_event_push(
+    const FlocEvent_t* event
+){
+    uint8_t head = eventHead;
+
+    if ((uint8_t) (head - eventTail) >= FLOC_EVENT_QUEUE_DEPTH) {
+        eventDropped++;
+        floc_metrics_drop(FLOC_DROP_QUEUE_FULL);
+        return false;
+    }
+
+    FlocEvent_t* slot = &eventRing[head & (FLOC_EVENT_QUEUE_DEPTH - 1)];
+
+    // Only the used part of the payload is copied
+    memcpy(slot, event, offsetof(FlocEvent_t, data) + event->dataSize);
+
+    eventHead = head + 1;
+
+    return true;
+}
+
+bool
+floc_event_pop(
+    FlocEvent_t* event
+){
+    uint8_t tail = eventTail;
+
+    if (tail == eventHead) {
+        return false;
+    }
+
+    const FlocEvent_t* slot = &eventRing[tail & (FLOC_EVENT_QUEUE_DEPTH - 1)];
+    memcpy(event, slot, offsetof(FlocEvent_t, data) + slot->dataSize);
+
+    eventTail = tail + 1;
+
+    return true;
+}
+
+uint8_t
+floc_event_count(
+    void
+){
+    return eventHead - eventTail;
+}
+
+void
+floc_event_set_handler(
+    FlocEventHandler_t handler
+){
+    eventHandler = handler;
+}
+
+uint8_t
+floc_event_dispatch(
+    void
+){
+    if (eventHandler == nullptr) {
+        return 0;
+    }
+
+    uint8_t handled = 0;
+
+    // Handle in place, the slot is not released until the handler returns
+    while (eventTail != eventHead) {
+        uint8_t tail = eventTail;
+
+        eventHandler(&eventRing[tail & (FLOC_EVENT_QUEUE_DEPTH - 1)]);
+        eventTail = tail + 1;
+        handled++;
+    }
+
+    return handled;
+}
+
+uint32_t
+floc_event_dropped(
+    void
+){
+    return eventDropped;
+}
+
+void
+floc_event_clear(
+    void
+){
+    eventTail = eventHead;
+    eventDropped = 0;
+}
@@ -0,0 +1,579 @@
+/*
+ * Erasure coding across groups of data packets.
+ *
+ * GF(2^8) with the polynomial 0x11D. The log/exp tables are built on first
+ * use (768 bytes) rather than stored, and every multiply is two lookups.
+ * The generator rows for parity shard j are 1 / ((k + j) ^ i), a Cauchy
+ * matrix, so every square submatrix is invertible and any k of the k + m
+ * shards rebuild the group.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_fec.hpp"
+#include "floc_ack.hpp"
+#include "floc_buffer.hpp"
+#include "floc_group.hpp"
+#include "floc_metrics.hpp"
+#include "floc_trace.hpp"
+#include "floc_utils.hpp"
+
+// ----- GF(2^8) -----
+
+static uint8_t gfExp[512];
+static uint8_t gfLog[256];
+static bool gfReady = false;
+
+static void
+gf_init(
+    void
+){
+    uint16_t x = 1;
+
+    for (int i = 0; i < 255; i++) {
+        gfExp[i] = x;
+        gfLog[x] = i;
+
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11D;
+        }
+    }
+
+    // Doubled so a sum of two logs never needs a modulo
+    for (int i = 255; i < 512; i++) {
+        gfExp[i] = gfExp[i - 255];
+    }
+
+    gfReady = true;
+}
+
+static inline uint8_t
+gf_mul(
+    uint8_t a,
+    uint8_t b
+){
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+
+    return gfExp[gfLog[a] + gfLog[b]];
+}
+
+static inline uint8_t
+gf_inv(
+    uint8_t a
+){
+    return gfExp[255 - gfLog[a]];
+}
+
+// dst ^= c * src
+static void
+gf_mul_add(
+    uint8_t* dst,
+    const uint8_t* src,
+    uint8_t c,
+    uint8_t len
+){
+    if (c == 0) {
+        return;
+    }
+
+    uint8_t log_c = gfLog[c];
+
+    for (uint8_t i = 0; i < len; i++) {
+        if (src[i] != 0) {
+            dst[i] ^= gfExp[log_c + gfLog[src[i]]];
+        }
+    }
+}
+
+static inline uint8_t
+cauchy(
+    uint8_t k,
+    uint8_t parity_row,
+    uint8_t data_col
+){
+    return gf_inv((k + parity_row) ^ data_col);
+}
+
+// ----- Codec -----
+
+void
+floc_fec_encode(
+    const uint8_t* const* data,
+    uint8_t k,
+    uint8_t m,
+    uint8_t len,
+    uint8_t* const* parity
+){
+    if (!gfReady) {
+        gf_init();
+    }
+
+    for (uint8_t j = 0; j < m; j++) {
+        memset(parity[j], 0, len);
+
+        for (uint8_t i = 0; i < k; i++) {
+            gf_mul_add(parity[j], data[i], cauchy(k, j, i), len);
+        }
+    }
+}
+
+bool
+floc_fec_decode(
+    uint8_t* const* shards,
+    uint16_t present,
+    uint8_t k,
+    uint8_t m,
+    uint8_t len
+){
+    if (k > FLOC_FEC_MAX_K || m > FLOC_FEC_MAX_M || len > FLOC_FEC_MAX_SHARD) {
+        return false;
+    }
+
+    if (!gfReady) {
+        gf_init();
+    }
+
+    uint8_t missing[FLOC_FEC_MAX_M];
+    uint8_t rows[FLOC_FEC_MAX_M];
+    uint8_t e = 0;
+    uint8_t r = 0;
+
+    for (uint8_t i = 0; i < k; i++) {
+        if (!(present & (1 << i))) {
+            if (e == m) {
+                return false;
+            }
+            missing[e++] = i;
+        }
+    }
+
+    if (e == 0) {
+        return true;
+    }
+
+    for (uint8_t j = 0; j < m && r < e; j++) {
+        if (present & (1 << (k + j))) {
+            rows[r++] = j;
+        }
+    }
+
+    if (r < e) {
+        return false;
+    }
+
+    // Invert the e x e submatrix for the missing columns, Gauss-Jordan on [A | I]
+    uint8_t a[FLOC_FEC_MAX_M][2 * FLOC_FEC_MAX_M];
+
+    for (uint8_t i = 0; i < e; i++) {
+        for (uint8_t c = 0; c < e; c++) {
+            a[i][c] = cauchy(k, rows[i], missing[c]);
+            a[i][e + c] = (i == c) ? 1 : 0;
+        }
+    }
+
+    for (uint8_t c = 0; c < e; c++) {
+        uint8_t pivot = c;
+        while (a[pivot][c] == 0) {
+            pivot++;
+        }
+
+        if (pivot != c) {
+            for (uint8_t x = 0; x < 2 * e; x++) {
+                uint8_t t = a[c][x];
+                a[c][x] = a[pivot][x];
+                a[pivot][x] = t;
+            }
+        }
+
+        uint8_t scale = gf_inv(a[c][c]);
+        for (uint8_t x = 0; x < 2 * e; x++) {
+            a[c][x] = gf_mul(a[c][x], scale);
+        }
+
+        for (uint8_t i = 0; i < e; i++) {
+            uint8_t factor = a[i][c];
+            if (i == c || factor == 0) {
+                continue;
+            }
+
+            for (uint8_t x = 0; x < 2 * e; x++) {
+                a[i][x] ^= gf_mul(factor, a[c][x]);
+            }
+        }
+    }
+
+    // Parity minus the contribution of the data we have leaves only the missing shards
+    uint8_t syndromes[FLOC_FEC_MAX_M][FLOC_FEC_MAX_SHARD];
+
+    for (uint8_t i = 0; i < e; i++) {
+        memcpy(syndromes[i], shards[k + rows[i]], len);
+
+        for (uint8_t d = 0; d < k; d++) {
+            if (present & (1 << d)) {
+                gf_mul_add(syndromes[i], shards[d], cauchy(k, rows[i], d), len);
+            }
+        }
+    }
+
+    for (uint8_t c = 0; c < e; c++) {
+        uint8_t* out = shards[missing[c]];
+        memset(out, 0, len);
+
+        for (uint8_t i = 0; i < e; i++) {
+            gf_mul_add(out, syndromes[i], a[c][e + i], len);
+        }
+    }
+
+    return true;
+}
+
+// ----- Sending -----
+
+static uint8_t txK = 4;
+static uint8_t txM = 2;
+static uint8_t txGroup = 0;
+static uint8_t txCount = 0;     // Data packets in the current group
+static uint8_t txLen = 0;       // Longest shard in the current group
+static uint16_t txDest = 0;
+static unsigned long txStarted = 0;
+static uint8_t txShards[FLOC_FEC_MAX_K][FLOC_FEC_MAX_SHARD];
+
+bool
+floc_fec_configure(
+    uint8_t k,
+    uint8_t m
+){
+    if (k == 0 || k > FLOC_FEC_MAX_K || m == 0 || m > FLOC_FEC_MAX_M) {
+        return false;
+    }
+
+    floc_fec_flush();
+
+    txK = k;
+    txM = m;
+
+    return true;
+}
+
+static uint8_t
+queue_fec_packet(
+    uint16_t dest_addr,
+    const uint8_t* fec_header,
+    uint8_t fec_header_size,
+    const uint8_t* body,
+    uint8_t body_size
+){
+    FlocPacket_t packet;
+
+    floc_build_header(&packet, TTL_START, FLOC_DATA_TYPE, dest_addr, false);
+
+    packet.payload.data.header.size = fec_header_size + body_size;
+    packet.payload.data.header.encoding = DATA_ENCODING_FEC;
+
+    memcpy(packet.payload.data.payload, fec_header, fec_header_size);
+    memcpy(packet.payload.data.payload + fec_header_size, body, body_size);
+
+    flocBuffer.addPacket(packet);
+
+    return packet.header.pid;
+}
+
+uint8_t
+floc_fec_send(
+    uint16_t dest_addr,
+    const uint8_t* payload,
+    uint8_t size
+){
+    if (size > FLOC_FEC_MAX_PAYLOAD) {
+        return FLOC_INVALID_PID;
+    }
+
+    if (txCount > 0 && dest_addr != txDest) {
+        floc_fec_flush();
+    }
+
+    if (txCount == 0) {
+        txDest = dest_addr;
+        txStarted = millis();
+    }
+
+    uint8_t* shard = txShards[txCount];
+    memset(shard, 0, FLOC_FEC_MAX_SHARD);
+    shard[0] = size;
+    memcpy(shard + 1, payload, size);
+
+    if (size + 1 > txLen) {
+        txLen = size + 1;
+    }
+
+    uint8_t fec_header[FLOC_FEC_DATA_HEADER_SIZE] = { txGroup, txCount };
+    uint8_t pid = queue_fec_packet(dest_addr, fec_header, sizeof(fec_header), payload, size);
+
+    if (++txCount == txK) {
+        floc_fec_flush();
+    }
+
+    return pid;
+}
+
+void
+floc_fec_flush(
+    void
+){
+    if (txCount == 0) {
+        return;
+    }
+
+    const uint8_t* data[FLOC_FEC_MAX_K];
+    uint8_t parity_buf[FLOC_FEC_MAX_M][FLOC_FEC_MAX_SHARD];
+    uint8_t* parity[FLOC_FEC_MAX_M];
+
+    for (uint8_t i = 0; i < txCount; i++) {
+        data[i] = txShards[i];
+    }
+
+    for (uint8_t j = 0; j < FLOC_FEC_MAX_M; j++) {
+        parity[j] = parity_buf[j];
+    }
+
+    floc_fec_encode(data, txCount, txM, txLen, parity);
+
+    for (uint8_t j = 0; j < txM; j++) {
+        uint8_t fec_header[FLOC_FEC_PARITY_HEADER_SIZE] = {
+            txGroup,
+            (uint8_t) (FLOC_FEC_PARITY_FLAG | j),
+            (uint8_t) (txCount | (txM << 4)),
+        };
+
+        queue_fec_packet(txDest, fec_header, sizeof(fec_header), parity[j], txLen);
+    }
+
+    txGroup++;
+    txCount = 0;
+    txLen = 0;
+}
+
+void
+floc_fec_poll(
+    void
+){
+    if (txCount > 0 && millis() - txStarted >= FLOC_FEC_FLUSH_MS) {
+        floc_fec_flush();
+    }
+}
+
+// ----- Receiving -----
+
+struct
+fec_group {
+    bool active;
+    bool done;
+    uint16_t src;
+    uint8_t group;
+    uint8_t k;              // 0 until a parity packet tells us
+    uint8_t m;
+    uint8_t len;            // Parity shard length
+    uint16_t present;       // Data shards by index, parity shards from FLOC_FEC_MAX_K
+    unsigned long updated_ms;
+    uint8_t shards[FLOC_FEC_MAX_K + FLOC_FEC_MAX_M][FLOC_FEC_MAX_SHARD];
+};
+
+static fec_group rxGroups[FLOC_FEC_RX_GROUPS];
+
+static fec_group*
+find_group(
+    uint16_t src,
+    uint8_t group
+){
+    unsigned long now = millis();
+    fec_group* oldest = &rxGroups[0];
+
+    for (int i = 0; i < FLOC_FEC_RX_GROUPS; i++) {
+        fec_group* g = &rxGroups[i];
+
+        if (g->active && g->src == src && g->group == group) {
+            if (now - g->updated_ms < FLOC_FEC_GROUP_TIMEOUT_MS) {
+                return g;
+            }
+            oldest = g;
+            break;
+        }
+
+        if (!g->active) {
+            oldest = g;
+        } else if (oldest->active && g->updated_ms < oldest->updated_ms) {
+            oldest = g;
+        }
+    }
+
+    // Shards are zero padded, so a reused slot is cleared
+    memset(oldest, 0, sizeof(fec_group));
+    oldest->active = true;
+    oldest->src = src;
+    oldest->group = group;
+
+    return oldest;
+}
+
+// Rebuild missing data shards once k shards are in, and deliver them.
+static void
+try_recover(
+    fec_group* g,
+    const FlocEvent_t* template_event
+){
+    if (g->done || g->k == 0) {
+        return;
+    }
+
+    uint16_t data_mask = (1 << g->k) - 1;
+    uint8_t have = 0;
+
+    for (uint8_t i = 0; i < g->k; i++) {
+        have += (g->present >> i) & 1;
+    }
+
+    if (have == g->k) {
+        g->done = true;
+        return;
+    }
+
+    for (uint8_t j = 0; j < g->m; j++) {
+        have += (g->present >> (FLOC_FEC_MAX_K + j)) & 1;
+    }
+
+    if (have < g->k) {
+        return;
+    }
+
+    uint8_t* shards[FLOC_FEC_MAX_K + FLOC_FEC_MAX_M];
+    uint16_t present = g->present & data_mask;
+
+    for (uint8_t i = 0; i < g->k; i++) {
+        shards[i] = g->shards[i];
+    }
+
+    for (uint8_t j = 0; j < g->m; j++) {
+        shards[g->k + j] = g->shards[FLOC_FEC_MAX_K + j];
+        if (g->present & (1 << (FLOC_FEC_MAX_K + j))) {
+            present |= 1 << (g->k + j);
+        }
+    }
+
+    if (!floc_fec_decode(shards, present, g->k, g->m, g->len)) {
+        return;
+    }
+
+    g->done = true;
+
+    for (uint8_t i = 0; i < g->k; i++) {
+        if (g->present & (1 << i)) {
+            continue;
+        }
+
+        uint8_t size = g->shards[i][0];
+        if (size > FLOC_FEC_MAX_PAYLOAD) {
+            continue;
+        }
+
+        FlocEvent_t recovered = *template_event;
+        recovered.flocType = FLOC_DATA_TYPE;
+        recovered.pid = FLOC_INVALID_PID;   // Never received, so it has no packet ID
+        recovered.dataSize = size;
+        memcpy(recovered.data, g->shards[i] + 1, size);
+
+        floc_event_push(&recovered);
+    }
+}
+
+bool
+floc_fec_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size,
+    FlocEvent_t* event
+){
+    if (size < FLOC_FEC_DATA_HEADER_SIZE) {
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+        return false;
+    }
+
+    // Relays only forward, decoding happens at the destination: us, every
+    // node for a broadcast, or every member for a group
+    uint16_t dest = ntohs(floc_header->dest_addr);
+
+    if (dest != get_device_id() && dest != FLOC_ACK_BROADCAST && !floc_group_member(dest)) {
+        return true;
+    }
+
+    uint8_t group_id = data[0];
+    uint8_t index = data[1];
+    fec_group* g = find_group(ntohs(floc_header->src_addr), group_id);
+
+    g->updated_ms = millis();
+
+    if (index & FLOC_FEC_PARITY_FLAG) {
+        uint8_t j = index & ~FLOC_FEC_PARITY_FLAG;
+
+        if (size < FLOC_FEC_PARITY_HEADER_SIZE + 1) {
+            floc_metrics_drop(FLOC_DROP_MALFORMED);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+            return false;
+        }
+
+        uint8_t k = data[2] & 0xF;
+        uint8_t m = data[2] >> 4;
+        uint8_t len = size - FLOC_FEC_PARITY_HEADER_SIZE;
+
+        if (k == 0 || k > FLOC_FEC_MAX_K || m == 0 || m > FLOC_FEC_MAX_M || j >= m ||
+            len > FLOC_FEC_MAX_SHARD || (g->k != 0 && (g->k != k || g->m != m || g->len != len))) {
+            floc_metrics_drop(FLOC_DROP_MALFORMED);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+            return false;
+        }
+
+        g->k = k;
+        g->m = m;
+        g->len = len;
+        g->present |= 1 << (FLOC_FEC_MAX_K + j);
+        memcpy(g->shards[FLOC_FEC_MAX_K + j], data + FLOC_FEC_PARITY_HEADER_SIZE, len);
+    } else {
+        uint8_t payload_size = size - FLOC_FEC_DATA_HEADER_SIZE;
+
+        if (index >= FLOC_FEC_MAX_K || payload_size > FLOC_FEC_MAX_PAYLOAD) {
+            floc_metrics_drop(FLOC_DROP_MALFORMED);
+            FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, ntohs(floc_header->src_addr));
+            return false;
+        }
+
+        bool duplicate = g->present & (1 << index);
+
+        g->present |= 1 << index;
+        g->shards[index][0] = payload_size;
+        memcpy(g->shards[index] + 1, data + FLOC_FEC_DATA_HEADER_SIZE, payload_size);
+
+        if (!duplicate) {
+            event->flocType = FLOC_DATA_TYPE;
+            event->dataSize = payload_size;
+            memcpy(event->data, data + FLOC_FEC_DATA_HEADER_SIZE, payload_size);
+        }
+    }
+
+    try_recover(g, event);
+
+    return true;
+}
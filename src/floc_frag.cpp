@@ -0,0 +1,550 @@
+/*
+ * Fragmentation and reassembly.
+ *
+ * Incoming transfers get a contiguous region of fragPool, first fit, for as
+ * many fragments as the transfer announces. With only FLOC_FRAG_RX_SESSIONS
+ * regions there is nothing to gain from a smarter allocator.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_frag.hpp"
+#include "floc_ack.hpp"
+#include "floc_bulk.hpp"
+#include "floc_buffer.hpp"
+#include "floc_group.hpp"
+#include "floc_metrics.hpp"
+#include "floc_trace.hpp"
+#include "floc_utils.hpp"
+
+#define FRAG_BITMAP_SIZE (FLOC_FRAG_MAX_FRAGMENTS / 8)
+
+struct
+frag_rx {
+    bool active;
+    uint16_t src;
+    uint8_t xfer;
+    uint16_t count;
+    uint16_t received;
+    uint8_t last_size;      // Bytes in the last fragment, once it has arrived
+    uint16_t offset;        // Into fragPool
+    unsigned long updated_ms;
+    uint8_t have[FRAG_BITMAP_SIZE];
+};
+
+struct
+frag_tx {
+    bool active;
+    bool waiting;           // Everything sent, waiting for a NACK
+    uint16_t dest;
+    uint8_t xfer;
+    const uint8_t* data;    // The caller's buffer
+    uint16_t size;
+    uint16_t count;
+    uint16_t next;          // Next fragment of the first pass
+    uint8_t probes;
+    unsigned long waiting_ms;
+    uint8_t repair[FRAG_BITMAP_SIZE];
+};
+
+struct
+frag_done {
+    bool used;
+    uint16_t src;
+    uint8_t xfer;
+};
+
+static uint8_t fragPool[FLOC_FRAG_POOL_SIZE];
+static frag_rx rxSessions[FLOC_FRAG_RX_SESSIONS];
+static frag_tx txSessions[FLOC_FRAG_TX_SESSIONS];
+static frag_done doneHistory[FLOC_FRAG_DONE_HISTORY];
+static uint8_t doneNext = 0;
+static uint8_t nextXfer = 0;
+
+static FlocFragRxHandler_t rxHandler = nullptr;
+static FlocFragTxHandler_t txHandler = nullptr;
+
+static inline bool
+bit_test(
+    const uint8_t* bitmap,
+    uint16_t index
+){
+    return bitmap[index / 8] & (1 << (index % 8));
+}
+
+static inline void
+bit_set(
+    uint8_t* bitmap,
+    uint16_t index
+){
+    bitmap[index / 8] |= 1 << (index % 8);
+}
+
+void
+floc_frag_set_handlers(
+    FlocFragRxHandler_t rx_handler,
+    FlocFragTxHandler_t tx_handler
+){
+    rxHandler = rx_handler;
+    txHandler = tx_handler;
+}
+
+// ----- Sending -----
+
+static void
+send_fragment(
+    const frag_tx* t,
+    uint16_t index
+){
+    FlocPacket_t packet;
+    uint16_t offset = index * FLOC_FRAG_CHUNK;
+    uint16_t remaining = t->size - offset;
+    uint8_t chunk = remaining < FLOC_FRAG_CHUNK ? remaining : FLOC_FRAG_CHUNK;
+    uint8_t* payload = packet.payload.data.payload;
+
+    floc_build_header(&packet, TTL_START, FLOC_DATA_TYPE, t->dest, false);
+
+    packet.payload.data.header.size = FLOC_FRAG_HEADER_SIZE + chunk;
+    packet.payload.data.header.encoding = DATA_ENCODING_FRAG;
+
+    payload[0] = FLOC_FRAG_KIND_DATA | (t->xfer << 2);
+    payload[1] = index;
+    payload[2] = t->count - 1;
+    memcpy(payload + FLOC_FRAG_HEADER_SIZE, t->data + offset, chunk);
+
+    flocBuffer.addPacket(packet);
+}
+
+// Repairs first, then the rest of the first pass. Returns false when there is nothing to send.
+static bool
+next_fragment(
+    frag_tx* t,
+    uint16_t* index
+){
+    for (uint16_t i = 0; i < t->count; i++) {
+        if (bit_test(t->repair, i)) {
+            t->repair[i / 8] &= ~(1 << (i % 8));
+            *index = i;
+            return true;
+        }
+    }
+
+    if (t->next < t->count) {
+        *index = t->next++;
+        return true;
+    }
+
+    return false;
+}
+
+static void
+finish_tx(
+    frag_tx* t,
+    bool delivered
+){
+    t->active = false;
+
+    if (txHandler != nullptr) {
+        txHandler(t->dest, t->xfer, delivered);
+    }
+}
+
+uint8_t
+floc_frag_send(
+    uint16_t dest_addr,
+    const uint8_t* data,
+    uint16_t size
+){
+    // Only one receiver can answer with NACKs
+    if (size == 0 || size > FLOC_FRAG_MAX_SIZE ||
+        dest_addr == FLOC_ACK_BROADCAST || floc_group_is(dest_addr)) {
+        return FLOC_FRAG_INVALID;
+    }
+
+    for (int i = 0; i < FLOC_FRAG_TX_SESSIONS; i++) {
+        frag_tx* t = &txSessions[i];
+
+        if (t->active) {
+            continue;
+        }
+
+        memset(t, 0, sizeof(frag_tx));
+        t->active = true;
+        t->dest = dest_addr;
+        t->xfer = nextXfer;
+        t->data = data;
+        t->size = size;
+        t->count = (size + FLOC_FRAG_CHUNK - 1) / FLOC_FRAG_CHUNK;
+
+        nextXfer = (nextXfer + 1) & FLOC_FRAG_XFER_MASK;
+
+        floc_frag_poll();
+
+        return t->xfer;
+    }
+
+    return FLOC_FRAG_INVALID;
+}
+
+static void
+poll_tx(
+    frag_tx* t,
+    unsigned long now
+){
+    uint16_t index;
+
+    while (flocBuffer.getQueueDepth(FLOC_QUEUE_RESPONSE) < FLOC_FRAG_QUEUE_AHEAD) {
+        if (!next_fragment(t, &index)) {
+            break;
+        }
+
+        send_fragment(t, index);
+        t->waiting = false;
+    }
+
+    bool repairs = false;
+    for (int i = 0; i < FRAG_BITMAP_SIZE && !repairs; i++) {
+        repairs = t->repair[i] != 0;
+    }
+
+    if (repairs || t->next < t->count) {
+        return;
+    }
+
+    // The probe timer starts once the last fragment has actually left
+    if (!t->waiting) {
+        if (flocBuffer.getQueueDepth(FLOC_QUEUE_RESPONSE) == 0) {
+            t->waiting = true;
+            t->waiting_ms = now;
+        }
+        return;
+    }
+
+    if (now - t->waiting_ms < FLOC_FRAG_PROBE_MS) {
+        return;
+    }
+
+    if (t->probes >= FLOC_FRAG_MAX_PROBES) {
+        finish_tx(t, false);
+        return;
+    }
+
+    // Receiving the last fragment makes the receiver report what it is missing
+    t->probes++;
+    t->waiting = false;
+    send_fragment(t, t->count - 1);
+}
+
+// ----- Receiving -----
+
+static void
+send_nack(
+    uint16_t dest_addr,
+    uint8_t xfer,
+    const frag_rx* r    // nullptr once complete
+){
+    FlocPacket_t packet;
+    uint8_t* payload = packet.payload.data.payload;
+    uint8_t size = 1;
+
+    floc_build_header(&packet, TTL_START, FLOC_DATA_TYPE, dest_addr, false);
+
+    payload[0] = FLOC_FRAG_KIND_NACK | (xfer << 2);
+
+    if (r != nullptr) {
+        uint8_t bytes = (r->count + 7) / 8;
+
+        for (uint8_t i = 0; i < bytes; i++) {
+            payload[1 + i] = ~r->have[i];
+        }
+
+        // Bits past the last fragment stay clear
+        if (r->count % 8) {
+            payload[bytes] &= (1 << (r->count % 8)) - 1;
+        }
+
+        size += bytes;
+    }
+
+    packet.payload.data.header.size = size;
+    packet.payload.data.header.encoding = DATA_ENCODING_FRAG;
+
+    flocBuffer.addPacket(packet);
+}
+
+static bool
+recently_done(
+    uint16_t src,
+    uint8_t xfer
+){
+    for (int i = 0; i < FLOC_FRAG_DONE_HISTORY; i++) {
+        if (doneHistory[i].used && doneHistory[i].src == src && doneHistory[i].xfer == xfer) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// First fit over the regions held by active sessions
+static bool
+reserve(
+    uint16_t need,
+    uint16_t* offset
+){
+    uint16_t candidate = 0;
+    bool moved = true;
+
+    while (moved) {
+        moved = false;
+
+        for (int i = 0; i < FLOC_FRAG_RX_SESSIONS; i++) {
+            const frag_rx* r = &rxSessions[i];
+            uint16_t end = r->offset + r->count * FLOC_FRAG_CHUNK;
+
+            if (r->active && candidate < end && r->offset < candidate + need) {
+                candidate = end;
+                moved = true;
+            }
+        }
+    }
+
+    if (candidate + need > FLOC_FRAG_POOL_SIZE) {
+        return false;
+    }
+
+    *offset = candidate;
+    return true;
+}
+
+static frag_rx*
+find_rx(
+    uint16_t src,
+    uint8_t xfer,
+    uint16_t count
+){
+    frag_rx* slot = nullptr;
+
+    for (int i = 0; i < FLOC_FRAG_RX_SESSIONS; i++) {
+        frag_rx* r = &rxSessions[i];
+
+        if (r->active && r->src == src && r->xfer == xfer) {
+            if (r->count == count) {
+                return r;
+            }
+
+            // A reused transfer ID, the old transfer is not coming back
+            r->active = false;
+        }
+
+        if (!r->active && slot == nullptr) {
+            slot = r;
+        }
+    }
+
+    uint16_t offset;
+    if (slot == nullptr || !reserve(count * FLOC_FRAG_CHUNK, &offset)) {
+        return nullptr;
+    }
+
+    memset(slot, 0, sizeof(frag_rx));
+    slot->active = true;
+    slot->src = src;
+    slot->xfer = xfer;
+    slot->count = count;
+    slot->offset = offset;
+
+    return slot;
+}
+
+static void
+receive_nack(
+    uint16_t src,
+    uint8_t xfer,
+    const uint8_t* bitmap,
+    uint8_t bytes
+){
+    for (int i = 0; i < FLOC_FRAG_TX_SESSIONS; i++) {
+        frag_tx* t = &txSessions[i];
+
+        if (!t->active || t->dest != src || t->xfer != xfer) {
+            continue;
+        }
+
+        if (bytes == 0) {
+            finish_tx(t, true);
+            return;
+        }
+
+        memset(t->repair, 0, sizeof(t->repair));
+        memcpy(t->repair, bitmap, bytes < (t->count + 7) / 8 ? bytes : (t->count + 7) / 8);
+
+        if (t->count % 8) {
+            t->repair[(t->count - 1) / 8] &= (1 << (t->count % 8)) - 1;
+        }
+
+        t->probes = 0;
+        t->waiting = false;
+        return;
+    }
+}
+
+bool
+floc_frag_receive(
+    const FlocHeader_t* floc_header,
+    const uint8_t* data,
+    uint8_t size
+){
+    uint16_t src = ntohs(floc_header->src_addr);
+
+    if (size < 1) {
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, src);
+        return false;
+    }
+
+    uint8_t kind = data[0] & 0x3;
+    uint8_t xfer = data[0] >> 2;
+
+    // Relays only forward, reassembly happens at the destination
+    if (ntohs(floc_header->dest_addr) != get_device_id()) {
+        return true;
+    }
+
+    if (kind == FLOC_FRAG_KIND_BULK || kind == FLOC_FRAG_KIND_BULK_ACK) {
+        return floc_bulk_receive(floc_header, data, size);
+    }
+
+    if (kind == FLOC_FRAG_KIND_NACK) {
+        receive_nack(src, xfer, data + 1, size - 1);
+        return true;
+    }
+
+    if (kind != FLOC_FRAG_KIND_DATA || size < FLOC_FRAG_HEADER_SIZE + 1) {
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, src);
+        return false;
+    }
+
+    uint16_t index = data[1];
+    uint16_t count = data[2] + 1;
+    uint8_t chunk = size - FLOC_FRAG_HEADER_SIZE;
+    bool last = index == count - 1;
+
+    if (index >= count || chunk > FLOC_FRAG_CHUNK || (!last && chunk != FLOC_FRAG_CHUNK)) {
+        floc_metrics_drop(FLOC_DROP_MALFORMED);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_MALFORMED, src);
+        return false;
+    }
+
+    // Our completion NACK was lost and the sender is probing
+    if (recently_done(src, xfer)) {
+        if (last) {
+            send_nack(src, xfer, nullptr);
+        }
+        return true;
+    }
+
+    frag_rx* r = find_rx(src, xfer, count);
+
+    if (r == nullptr) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("No room to reassemble transfer %u from %u\r\n", xfer, src);
+    #endif // DEBUG_ON
+
+        floc_metrics_drop(FLOC_DROP_QUEUE_FULL);
+        FLOC_TRACE(FLOC_TRACE_DROP, FLOC_DROP_QUEUE_FULL, src);
+        return true;
+    }
+
+    r->updated_ms = millis();
+
+    if (!bit_test(r->have, index)) {
+        memcpy(fragPool + r->offset + index * FLOC_FRAG_CHUNK, data + FLOC_FRAG_HEADER_SIZE, chunk);
+        bit_set(r->have, index);
+        r->received++;
+
+        if (last) {
+            r->last_size = chunk;
+        }
+    }
+
+    if (r->received == count) {
+        r->active = false;
+
+        doneHistory[doneNext].used = true;
+        doneHistory[doneNext].src = src;
+        doneHistory[doneNext].xfer = xfer;
+        doneNext = (doneNext + 1) % FLOC_FRAG_DONE_HISTORY;
+
+        send_nack(src, xfer, nullptr);
+
+        if (rxHandler != nullptr) {
+            rxHandler(src, xfer, fragPool + r->offset, (count - 1) * FLOC_FRAG_CHUNK + r->last_size);
+        }
+    } else if (last) {
+        send_nack(src, xfer, r);
+    }
+
+    return true;
+}
+
+// ----- Housekeeping -----
+
+void
+floc_frag_poll(
+    void
+){
+    unsigned long now = millis();
+
+    for (int i = 0; i < FLOC_FRAG_RX_SESSIONS; i++) {
+        frag_rx* r = &rxSessions[i];
+
+        if (r->active && now - r->updated_ms >= FLOC_FRAG_RX_TIMEOUT_MS) {
+            r->active = false;
+        }
+    }
+
+    for (int i = 0; i < FLOC_FRAG_TX_SESSIONS; i++) {
+        if (txSessions[i].active) {
+            poll_tx(&txSessions[i], now);
+        }
+    }
+}
+
+uint8_t
+floc_frag_tx_active(
+    void
+){
+    uint8_t n = 0;
+
+    for (int i = 0; i < FLOC_FRAG_TX_SESSIONS; i++) {
+        n += txSessions[i].active;
+    }
+
+    return n;
+}
+
+uint8_t
+floc_frag_rx_active(
+    void
+){
+    uint8_t n = 0;
+
+    for (int i = 0; i < FLOC_FRAG_RX_SESSIONS; i++) {
+        n += rxSessions[i].active;
+    }
+
+    return n;
+}
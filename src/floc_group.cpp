@@ -0,0 +1,378 @@
+/*
+ * Multicast groups.
+ *
+ * A route entry is one of: members heard beyond us, a command probe waiting
+ * for its ACK, or neither (forward and find out). Collections match ACKs by
+ * pid alone, like the command queue does.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_group.hpp"
+#include "floc_buffer.hpp"
+#include "floc_utils.hpp"
+
+static uint32_t memberBits[FLOC_GROUP_COUNT / 32];
+
+struct
+group_route {
+    uint16_t group;
+    bool heard;                 // A member ACKed through us at heard_ms
+    bool probing;               // A command went out at probed_ms, no ACK yet
+    unsigned long heard_ms;
+    unsigned long probed_ms;
+    unsigned long used_ms;
+};
+
+static group_route routes[FLOC_GROUP_ROUTES];
+static uint8_t routeCount = 0;
+
+struct
+group_forward {
+    uint16_t commander;
+    uint8_t pid;
+    uint16_t group;
+};
+
+static group_forward forwards[FLOC_GROUP_FORWARDS];
+static uint8_t forwardCount = 0;
+static uint8_t forwardNext = 0;
+
+struct
+group_collect {
+    FlocGroupResult_t result;
+    uint8_t expected_count;     // 0 when collecting whoever answers
+    uint16_t expected[FLOC_GROUP_MAX_MEMBERS];
+    FlocGroupCallback_t callback;
+    void* ctx;
+};
+
+static group_collect collects[FLOC_GROUP_COLLECTS];
+static uint8_t collectCount = 0;
+
+static uint32_t prunedCount = 0;
+
+bool
+floc_group_join(
+    uint16_t group_addr
+){
+    if (!floc_group_is(group_addr)) {
+        return false;
+    }
+
+    uint8_t g = group_addr - FLOC_GROUP_FIRST;
+    memberBits[g >> 5] |= 1UL << (g & 31);
+
+    return true;
+}
+
+void
+floc_group_leave(
+    uint16_t group_addr
+){
+    if (!floc_group_is(group_addr)) {
+        return;
+    }
+
+    uint8_t g = group_addr - FLOC_GROUP_FIRST;
+    memberBits[g >> 5] &= ~(1UL << (g & 31));
+}
+
+bool
+floc_group_member(
+    uint16_t group_addr
+){
+    if (!floc_group_is(group_addr)) {
+        return false;
+    }
+
+    uint8_t g = group_addr - FLOC_GROUP_FIRST;
+
+    return (memberBits[g >> 5] >> (g & 31)) & 1;
+}
+
+static group_route*
+find_route(
+    uint16_t group,
+    bool add
+){
+    for (uint8_t i = 0; i < routeCount; i++) {
+        if (routes[i].group == group) {
+            return &routes[i];
+        }
+    }
+
+    if (!add) {
+        return nullptr;
+    }
+
+    uint8_t i = routeCount;
+
+    if (routeCount < FLOC_GROUP_ROUTES) {
+        routeCount++;
+    } else {
+        i = 0;
+
+        for (uint8_t j = 1; j < routeCount; j++) {
+            if ((long) (routes[j].used_ms - routes[i].used_ms) < 0) {
+                i = j;
+            }
+        }
+    }
+
+    memset(&routes[i], 0, sizeof(routes[i]));
+    routes[i].group = group;
+
+    return &routes[i];
+}
+
+bool
+floc_group_forward(
+    const FlocHeader_t* header
+){
+    uint16_t group = ntohs(header->dest_addr);
+    bool command = (header->type & FLOC_TYPE_MASK) == FLOC_COMMAND_TYPE;
+    unsigned long now = millis();
+
+    group_route* r = find_route(group, true);
+    r->used_ms = now;
+
+    if (r->heard && now - r->heard_ms >= FLOC_GROUP_ROUTE_TIMEOUT_MS) {
+        r->heard = false;
+    }
+
+    if (r->probing && now - r->probed_ms >= FLOC_GROUP_ROUTE_TIMEOUT_MS) {
+        r->probing = false;
+    }
+
+    if (!r->heard && r->probing && now - r->probed_ms >= FLOC_GROUP_ACK_WAIT_MS) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("[GROUP] No members of %04X beyond us, not forwarding\r\n", group);
+    #endif // DEBUG_ON
+
+        prunedCount++;
+        return false;
+    }
+
+    if (!command) {
+        return true;
+    }
+
+    if (!r->heard && !r->probing) {
+        r->probing = true;
+        r->probed_ms = now;
+    }
+
+    // Its ACKs tell us whether anyone beyond us is in the group
+    group_forward& f = forwards[forwardNext];
+    f.commander = ntohs(header->src_addr);
+    f.pid = header->pid;
+    f.group = group;
+
+    forwardNext = (forwardNext + 1) % FLOC_GROUP_FORWARDS;
+
+    if (forwardCount < FLOC_GROUP_FORWARDS) {
+        forwardCount++;
+    }
+
+    return true;
+}
+
+static void
+ack_overheard(
+    uint16_t commander,
+    uint8_t pid
+){
+    for (uint8_t i = 0; i < forwardCount; i++) {
+        if (forwards[i].commander != commander || forwards[i].pid != pid) {
+            continue;
+        }
+
+        group_route* r = find_route(forwards[i].group, false);
+
+        if (r != nullptr) {
+            r->heard = true;
+            r->probing = false;
+            r->heard_ms = millis();
+        }
+    }
+}
+
+void
+floc_group_ack_overheard(
+    uint16_t commander,
+    uint8_t base_pid,
+    uint16_t bitmap
+){
+    if (forwardCount == 0) {
+        return;
+    }
+
+    base_pid &= FLOC_PID_MASK;
+    ack_overheard(commander, base_pid);
+
+    for (uint8_t bit = 0; bitmap != 0; bit++, bitmap >>= 1) {
+        if (bitmap & 1) {
+            ack_overheard(commander, (base_pid + 1 + bit) & FLOC_PID_MASK);
+        }
+    }
+}
+
+uint32_t
+floc_group_pruned(
+    void
+){
+    return prunedCount;
+}
+
+static int
+find_collect(
+    uint8_t pid
+){
+    for (uint8_t i = 0; i < collectCount; i++) {
+        if (collects[i].result.pid == pid) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Reports and forgets collection `i`
+static void
+finish_collect(
+    uint8_t i
+){
+    group_collect c = collects[i];
+    collects[i] = collects[--collectCount];
+
+#ifdef DEBUG_ON // DEBUG_ON
+    Serial.printf("[GROUP] Command %d to %04X ACKed by %d\r\n", c.result.pid, c.result.group_addr, c.result.acked_count);
+#endif // DEBUG_ON
+
+    if (c.callback != nullptr) {
+        c.callback(&c.result, c.ctx);
+    }
+}
+
+uint8_t
+floc_group_command_send(
+    uint16_t group_addr,
+    CommandType_e command_type,
+    const uint8_t* payload,
+    uint8_t size,
+    const uint16_t* members,
+    uint8_t member_count,
+    FlocGroupCallback_t callback,
+    void* ctx
+){
+    if (!floc_group_is(group_addr) || collectCount == FLOC_GROUP_COLLECTS ||
+        member_count > FLOC_GROUP_MAX_MEMBERS) {
+        return FLOC_INVALID_PID;
+    }
+
+    uint8_t pid = floc_command_send(group_addr, command_type, payload, size);
+
+    if (pid == FLOC_INVALID_PID) {
+        return FLOC_INVALID_PID;
+    }
+
+    // The PID came back around while an old collection was still open
+    int old = find_collect(pid);
+
+    if (old >= 0) {
+        finish_collect(old);
+    }
+
+    group_collect& c = collects[collectCount++];
+    memset(&c, 0, sizeof(c));
+
+    c.result.group_addr = group_addr;
+    c.result.pid = pid;
+    c.expected_count = member_count;
+    c.callback = callback;
+    c.ctx = ctx;
+
+    if (member_count > 0) {
+        memcpy(c.expected, members, member_count * sizeof(uint16_t));
+    }
+
+    return pid;
+}
+
+bool
+floc_group_acked(
+    uint16_t src_addr,
+    uint8_t pid
+){
+    int i = find_collect(pid);
+
+    if (i < 0) {
+        return false;
+    }
+
+    FlocGroupResult_t& result = collects[i].result;
+
+    for (uint8_t j = 0; j < result.acked_count; j++) {
+        if (result.acked[j] == src_addr) {
+            return true;
+        }
+    }
+
+    if (collects[i].expected_count > 0) {
+        bool expected = false;
+
+        for (uint8_t j = 0; j < collects[i].expected_count; j++) {
+            expected = expected || collects[i].expected[j] == src_addr;
+        }
+
+        if (!expected) {
+            return true;
+        }
+    }
+
+    if (result.acked_count < FLOC_GROUP_MAX_MEMBERS) {
+        result.acked[result.acked_count++] = src_addr;
+    }
+
+    if (collects[i].expected_count == 0 || result.acked_count < collects[i].expected_count) {
+        return true;
+    }
+
+    // Everyone has it, the command queue can stop sending it
+    result.complete = true;
+    flocBuffer.addAckID(pid);
+
+    finish_collect(i);
+
+    return true;
+}
+
+void
+floc_group_command_done(
+    uint8_t pid
+){
+    int i = find_collect(pid);
+
+    if (i >= 0) {
+        finish_collect(i);
+    }
+}
+
+uint8_t
+floc_group_collecting(
+    void
+){
+    return collectCount;
+}
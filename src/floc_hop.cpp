@@ -0,0 +1,190 @@
+/*
+ * Implicit hop ACKs.
+ *
+ * A watched frame that has already been re-forwarded keeps its slot until
+ * its second timeout, so the re-forward is not watched again.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_hop.hpp"
+#include "floc_buffer.hpp"
+#include "floc_unicast.hpp"
+#include "floc_utils.hpp"
+
+struct
+hop_watch {
+    FlocPacket_t packet;        // As received, so it can be queued again
+    unsigned long sent_ms;
+    bool reforwarded;
+};
+
+static hop_watch watches[FLOC_HOP_PENDING];
+static uint8_t watchCount = 0;
+static uint32_t timeoutMs = FLOC_HOP_TIMEOUT_MS;
+
+static uint32_t confirmedCount = 0;
+static uint32_t reforwardedCount = 0;
+
+void
+floc_hop_set_timeout(
+    uint32_t timeout_ms
+){
+    timeoutMs = timeout_ms;
+
+    if (timeoutMs == 0) {
+        watchCount = 0;
+    }
+}
+
+uint32_t
+floc_hop_timeout(
+    void
+){
+    return timeoutMs;
+}
+
+static int
+find_watch(
+    uint16_t src_addr,
+    uint8_t pid
+){
+    for (uint8_t i = 0; i < watchCount; i++) {
+        const FlocHeader_t* header = &watches[i].packet.header;
+
+        if (header->pid == pid && ntohs(header->src_addr) == src_addr) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void
+remove_watch(
+    uint8_t i
+){
+    watches[i] = watches[--watchCount];
+}
+
+void
+floc_hop_forwarded(
+    const FlocPacket_t* packet
+){
+    uint16_t dest_addr = ntohs(packet->header.dest_addr);
+
+    // The next hop gets our copy with one less TTL, and needs more than 1 to forward it
+    if (timeoutMs == 0 || packet->header.ttl <= 2 || floc_neighbor_known(dest_addr)) {
+        return;
+    }
+
+    int i = find_watch(ntohs(packet->header.src_addr), packet->header.pid);
+
+    if (i >= 0) {
+        return;
+    }
+
+    if (watchCount == FLOC_HOP_PENDING) {
+        uint8_t oldest = 0;
+
+        for (uint8_t j = 1; j < watchCount; j++) {
+            if ((long) (watches[j].sent_ms - watches[oldest].sent_ms) < 0) {
+                oldest = j;
+            }
+        }
+
+        remove_watch(oldest);
+    }
+
+    hop_watch& w = watches[watchCount++];
+    w.packet = *packet;
+    w.sent_ms = millis();
+    w.reforwarded = false;
+}
+
+void
+floc_hop_overheard(
+    const FlocHeader_t* header
+){
+    if (watchCount == 0 || ntohs(header->nid) != get_network_id()) {
+        return;
+    }
+
+    uint16_t last_hop_addr = ntohs(header->last_hop_addr);
+    int i = find_watch(ntohs(header->src_addr), header->pid);
+
+    if (i < 0 || last_hop_addr == get_device_id() || header->ttl >= watches[i].packet.header.ttl - 1) {
+        return;
+    }
+
+#ifdef DEBUG_ON // DEBUG_ON
+    Serial.printf("[HOP] %d forwarded %d, hop ACKed\r\n", last_hop_addr, header->pid);
+#endif // DEBUG_ON
+
+    confirmedCount++;
+    remove_watch(i);
+}
+
+void
+floc_hop_poll(
+    void
+){
+    unsigned long now = millis();
+
+    for (uint8_t i = 0; i < watchCount; ) {
+        hop_watch& w = watches[i];
+
+        if (now - w.sent_ms < timeoutMs) {
+            i++;
+            continue;
+        }
+
+        if (w.reforwarded) {
+            remove_watch(i);
+            continue;
+        }
+
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("[HOP] Nobody forwarded %d, sending it again\r\n", w.packet.header.pid);
+    #endif // DEBUG_ON
+
+        w.reforwarded = true;
+        w.sent_ms = now;
+        reforwardedCount++;
+
+        flocBuffer.addPacket(w.packet);
+        i++;
+    }
+}
+
+uint8_t
+floc_hop_pending(
+    void
+){
+    return watchCount;
+}
+
+uint32_t
+floc_hop_confirmed(
+    void
+){
+    return confirmedCount;
+}
+
+uint32_t
+floc_hop_reforwarded(
+    void
+){
+    return reforwardedCount;
+}
@@ -0,0 +1,163 @@
+/*
+ * Latency aggregation.
+ *
+ * Samples are stored as saturating 16-bit milliseconds (about 65 s), which
+ * covers any realistic acoustic round trip and halves the RAM cost.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_latency.hpp"
+
+struct
+latency_destination {
+    bool used;
+    uint16_t addr;
+    unsigned long last_used_ms;
+    uint16_t count[FLOC_LATENCY_STAGE_COUNT];   // Total samples seen, saturating
+    uint8_t next[FLOC_LATENCY_STAGE_COUNT];     // Ring slot the next sample goes in
+    uint16_t samples[FLOC_LATENCY_STAGE_COUNT][FLOC_LATENCY_SAMPLES];
+};
+
+static latency_destination destinations[FLOC_LATENCY_DESTINATIONS];
+
+static latency_destination*
+find_destination(
+    uint16_t dest_addr,
+    bool create
+){
+    latency_destination* oldest = &destinations[0];
+
+    for (int i = 0; i < FLOC_LATENCY_DESTINATIONS; i++) {
+        latency_destination* d = &destinations[i];
+
+        if (d->used && d->addr == dest_addr) {
+            return d;
+        }
+
+        if (!d->used) {
+            oldest = d;
+        } else if (oldest->used && d->last_used_ms < oldest->last_used_ms) {
+            oldest = d;
+        }
+    }
+
+    if (!create) {
+        return nullptr;
+    }
+
+    memset(oldest, 0, sizeof(latency_destination));
+    oldest->used = true;
+    oldest->addr = dest_addr;
+
+    return oldest;
+}
+
+static void
+add_sample(
+    latency_destination* d,
+    FlocLatencyStage_e stage,
+    unsigned long ms
+){
+    uint16_t value = ms > 0xFFFF ? 0xFFFF : (uint16_t) ms;
+
+    d->samples[stage][d->next[stage]] = value;
+    d->next[stage] = (d->next[stage] + 1) % FLOC_LATENCY_SAMPLES;
+
+    if (d->count[stage] < 0xFFFF) {
+        d->count[stage]++;
+    }
+}
+
+void
+floc_latency_record(
+    uint16_t dest_addr,
+    const FlocPacketTiming_t* timing
+){
+    if (!(timing->flags & FLOC_TIMING_ENQUEUED) || !(timing->flags & FLOC_TIMING_SENT)) {
+        return;
+    }
+
+    latency_destination* d = find_destination(dest_addr, true);
+    d->last_used_ms = millis();
+
+    add_sample(d, FLOC_LATENCY_QUEUEING, timing->first_tx_ms - timing->enqueue_ms);
+    add_sample(d, FLOC_LATENCY_SERVICE, timing->last_tx_ms - timing->first_tx_ms);
+
+    if (timing->flags & FLOC_TIMING_ACKED) {
+        add_sample(d, FLOC_LATENCY_RTT, timing->ack_ms - timing->last_tx_ms);
+    }
+}
+
+bool
+floc_latency_stats(
+    uint16_t dest_addr,
+    FlocLatencyStage_e stage,
+    FlocLatencyStats_t* out
+){
+    latency_destination* d = find_destination(dest_addr, false);
+
+    if (d == nullptr || d->count[stage] == 0) {
+        return false;
+    }
+
+    uint16_t n = d->count[stage] < FLOC_LATENCY_SAMPLES ? d->count[stage] : FLOC_LATENCY_SAMPLES;
+    uint16_t sorted[FLOC_LATENCY_SAMPLES];
+
+    // Insertion sort, n is small
+    for (uint16_t i = 0; i < n; i++) {
+        uint16_t v = d->samples[stage][i];
+        uint16_t j = i;
+
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+
+    out->count = d->count[stage];
+    out->p50_ms = sorted[(n - 1) * 50 / 100];
+    out->p90_ms = sorted[(n - 1) * 90 / 100];
+    out->p99_ms = sorted[(n - 1) * 99 / 100];
+    out->max_ms = sorted[n - 1];
+
+    return true;
+}
+
+bool
+floc_latency_destination(
+    uint8_t index,
+    uint16_t* dest_addr
+){
+    for (int i = 0; i < FLOC_LATENCY_DESTINATIONS; i++) {
+        if (!destinations[i].used) {
+            continue;
+        }
+
+        if (index-- == 0) {
+            *dest_addr = destinations[i].addr;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+floc_latency_reset(
+    void
+){
+    memset(destinations, 0, sizeof(destinations));
+}
@@ -0,0 +1,272 @@
+/*
+ * Channel access: airtime estimates and TDMA slot timing.
+ *
+ * The slot check is plain arithmetic on millis(), so it costs the same
+ * every loop and can be evaluated for any node and time by the host
+ * simulator. Budget buckets count airtime in microseconds and are only
+ * refilled when looked at.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+
+#include "floc_mac.hpp"
+
+#define NO_SLOT 0xFF
+
+static uint32_t bitrateBps = FLOC_MAC_BITRATE_BPS;
+static uint16_t preambleMs = FLOC_MAC_PREAMBLE_MS;
+
+static FlocTdmaConfig_t tdma = { FLOC_TDMA_OFF, 0, 0, 0 };
+static uint32_t guardMs = 0;
+static uint8_t slotOverride = NO_SLOT;
+
+static unsigned long busyUntilMs = 0;
+
+struct
+airtime_bucket {
+    uint16_t share_permille;    // FLOC_MAC_UNLIMITED: no bucket
+    int32_t depth_us;
+    int32_t tokens_us;
+    unsigned long updated_ms;
+};
+
+static airtime_bucket buckets[FLOC_TRAFFIC_CLASS_COUNT];
+
+void
+floc_mac_set_modem(
+    uint32_t bitrate_bps,
+    uint16_t preamble_ms
+){
+    bitrateBps = bitrate_bps > 0 ? bitrate_bps : 1;
+    preambleMs = preamble_ms;
+}
+
+uint32_t
+floc_mac_airtime_ms(
+    uint8_t size
+){
+    return preambleMs + ((uint32_t) size * 8 * 1000 + bitrateBps - 1) / bitrateBps;
+}
+
+bool
+floc_tdma_configure(
+    const FlocTdmaConfig_t* config
+){
+    if (config->slots == FLOC_TDMA_OFF) {
+        tdma.slots = FLOC_TDMA_OFF;
+        return true;
+    }
+
+    uint32_t guard = ((uint32_t) config->max_range_m * 1000 + FLOC_MAC_SOUND_SPEED_MPS - 1) / FLOC_MAC_SOUND_SPEED_MPS;
+
+    if (config->slot_ms < floc_mac_airtime_ms(FLOC_MAX_SIZE) + guard) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("TDMA slot of %u ms is too short\r\n", config->slot_ms);
+    #endif // DEBUG_ON
+
+        return false;
+    }
+
+    tdma = *config;
+    guardMs = guard;
+
+    return true;
+}
+
+bool
+floc_tdma_enabled(
+    void
+){
+    return tdma.slots != FLOC_TDMA_OFF;
+}
+
+uint32_t
+floc_tdma_guard_ms(
+    void
+){
+    return guardMs;
+}
+
+void
+floc_tdma_set_slot(
+    uint8_t slot
+){
+    slotOverride = slot;
+}
+
+uint8_t
+floc_tdma_slot(
+    void
+){
+    if (tdma.slots == FLOC_TDMA_OFF) {
+        return 0;
+    }
+
+    if (slotOverride < tdma.slots) {
+        return slotOverride;
+    }
+
+    return get_device_id() % tdma.slots;
+}
+
+uint32_t
+floc_tdma_wait_ms(
+    uint32_t now_ms,
+    uint8_t slot,
+    uint8_t size
+){
+    if (tdma.slots == FLOC_TDMA_OFF) {
+        return 0;
+    }
+
+    int32_t superframe_ms = (int32_t) (tdma.slots * tdma.slot_ms);
+    int32_t t = (int32_t) (now_ms - tdma.epoch_ms) % superframe_ms;
+
+    if (t < 0) {
+        t += superframe_ms;
+    }
+
+    int32_t start = (int32_t) (slot * tdma.slot_ms);
+    int32_t latest = start + (int32_t) (tdma.slot_ms - guardMs - floc_mac_airtime_ms(size));
+
+    if (t >= start && t <= latest) {
+        return 0;
+    }
+
+    if (t < start) {
+        return start - t;
+    }
+
+    return superframe_ms - t + start;
+}
+
+bool
+floc_mac_clear_to_send(
+    void
+){
+    if (tdma.slots == FLOC_TDMA_OFF) {
+        return true;
+    }
+
+    unsigned long now = millis();
+
+    // Still on the air with the last frame
+    if ((long) (now - busyUntilMs) < 0) {
+        return false;
+    }
+
+    // The next frame is not known yet, so the slot must have room for the largest
+    return floc_tdma_wait_ms(now, floc_tdma_slot(), FLOC_MAX_SIZE) == 0;
+}
+
+void
+floc_mac_set_budget(
+    FlocTrafficClass_e traffic,
+    uint16_t share_permille,
+    uint32_t burst_ms
+){
+    if (traffic >= FLOC_TRAFFIC_CLASS_COUNT) {
+        return;
+    }
+
+    airtime_bucket* b = &buckets[traffic];
+
+    b->share_permille = share_permille < 1000 ? share_permille : 1000;
+    b->depth_us = (int32_t) (burst_ms < INT32_MAX / 1000 ? burst_ms * 1000 : INT32_MAX);
+    b->tokens_us = b->depth_us;
+    b->updated_ms = millis();
+}
+
+static airtime_bucket*
+refill(
+    FlocTrafficClass_e traffic
+){
+    airtime_bucket* b = &buckets[traffic];
+
+    if (b->share_permille == FLOC_MAC_UNLIMITED) {
+        return nullptr;
+    }
+
+    unsigned long now = millis();
+    uint64_t earned_us = (uint64_t) (now - b->updated_ms) * b->share_permille;
+
+    b->tokens_us = earned_us >= (uint64_t) (b->depth_us - b->tokens_us) ? b->depth_us : b->tokens_us + (int32_t) earned_us;
+    b->updated_ms = now;
+
+    return b;
+}
+
+static bool
+covers(
+    FlocTrafficClass_e traffic,
+    int32_t cost_us
+){
+    airtime_bucket* b = refill(traffic);
+
+    // A full bucket pays for any frame, even one larger than the burst
+    return b == nullptr || b->tokens_us >= cost_us || b->tokens_us == b->depth_us;
+}
+
+bool
+floc_mac_budget_allows(
+    FlocTrafficClass_e traffic,
+    uint8_t size
+){
+    if (traffic >= FLOC_TRAFFIC_ALL) {
+        return false;
+    }
+
+    int32_t cost_us = (int32_t) floc_mac_airtime_ms(size) * 1000;
+
+    return covers(traffic, cost_us) && covers(FLOC_TRAFFIC_ALL, cost_us);
+}
+
+int32_t
+floc_mac_budget_ms(
+    FlocTrafficClass_e traffic
+){
+    if (traffic >= FLOC_TRAFFIC_CLASS_COUNT) {
+        return 0;
+    }
+
+    airtime_bucket* b = refill(traffic);
+
+    return b == nullptr ? INT32_MAX : b->tokens_us / 1000;
+}
+
+static void
+charge(
+    FlocTrafficClass_e traffic,
+    int32_t cost_us
+){
+    airtime_bucket* b = refill(traffic);
+
+    if (b != nullptr) {
+        b->tokens_us -= cost_us;
+    }
+}
+
+void
+floc_mac_sent(
+    FlocTrafficClass_e traffic,
+    uint8_t size
+){
+    uint32_t airtime = floc_mac_airtime_ms(size);
+
+    busyUntilMs = millis() + airtime;
+
+    if (traffic < FLOC_TRAFFIC_ALL) {
+        charge(traffic, (int32_t) airtime * 1000);
+        charge(FLOC_TRAFFIC_ALL, (int32_t) airtime * 1000);
+    }
+}
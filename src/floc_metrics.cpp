@@ -0,0 +1,121 @@
+/*
+ * Protocol metrics.
+ *
+ * The counters are written only from the loop context; readers on other
+ * contexts go through floc_metrics_snapshot(), which retries if an update
+ * was in flight while it copied.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_metrics.hpp"
+
+FlocMetrics_t flocMetrics;
+volatile uint32_t flocMetricsSeq = 0;
+
+void
+floc_metrics_command_done(
+    int transmissions,
+    bool acked
+){
+    floc_metrics_write_begin();
+
+    if (acked) {
+        flocMetrics.command_acked++;
+
+        int bucket = transmissions - 1;
+        if (bucket < 0) {
+            bucket = 0;
+        } else if (bucket >= FLOC_METRICS_RETRY_BUCKETS) {
+            bucket = FLOC_METRICS_RETRY_BUCKETS - 1;
+        }
+
+        flocMetrics.retries[bucket]++;
+    } else {
+        flocMetrics.command_failed++;
+    }
+
+    floc_metrics_write_end();
+}
+
+void
+floc_metrics_ack_rtt(
+    unsigned long rtt_ms
+){
+    // Bucket i holds RTTs below FLOC_METRICS_RTT_BASE_MS << i; the last one is open-ended.
+    uint8_t bucket = 0;
+    unsigned long limit = FLOC_METRICS_RTT_BASE_MS;
+
+    while (bucket < FLOC_METRICS_RTT_BUCKETS - 1 && rtt_ms >= limit) {
+        bucket++;
+        limit <<= 1;
+    }
+
+    floc_metrics_write_begin();
+    flocMetrics.ack_rtt[bucket]++;
+    floc_metrics_write_end();
+}
+
+bool
+floc_metrics_snapshot(
+    FlocMetrics_t* out
+){
+    for (int tries = 0; tries < FLOC_METRICS_SNAPSHOT_TRIES; tries++) {
+        uint32_t start = flocMetricsSeq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (start & 1) { // Update in progress
+            continue;
+        }
+
+        memcpy(out, &flocMetrics, sizeof(FlocMetrics_t));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (flocMetricsSeq == start) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+floc_metrics_reset(
+    void
+){
+    floc_metrics_write_begin();
+    memset(&flocMetrics, 0, sizeof(flocMetrics));
+    floc_metrics_write_end();
+}
+
+uint16_t
+floc_metrics_serialize(
+    uint8_t* buf,
+    uint16_t capacity
+){
+    uint16_t total = 2 + sizeof(FlocMetrics_t);
+
+    if (capacity < total) {
+        return 0;
+    }
+
+    if (!floc_metrics_snapshot((FlocMetrics_t*) (buf + 2))) {
+        return 0;
+    }
+
+    buf[0] = FLOC_METRICS_VERSION;
+    buf[1] = sizeof(FlocMetrics_t);
+
+    return total;
+}
@@ -0,0 +1,439 @@
+/*
+ * Warm restart from a snapshot in non-volatile storage.
+ *
+ * A snapshot is serialized into `staging` in one go, which only copies RAM,
+ * and then trickles out to the store. While it does, the live state moves
+ * on; the snapshot is as of the moment it was taken.
+ *
+ * Body: [next seq:2][buffer state size:2][buffer state][held ACKs]
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_persist.hpp"
+#include "floc_ack.hpp"
+#include "floc_buffer.hpp"
+#include "floc_utils.hpp"
+
+#ifdef __linux__ // __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // __linux__
+
+#define NO_SLOT 0xFF
+
+static const FlocPersistStore_t* store = nullptr;
+
+static uint8_t staging[FLOC_PERSIST_SLOT_SIZE];
+static uint16_t stagedSize = 0;     // Header included
+static uint16_t writtenSize = 0;    // Body bytes written so far
+static uint8_t writeSlot = NO_SLOT; // Slot being written, NO_SLOT when idle
+
+static uint8_t newestSlot = NO_SLOT;
+static uint32_t generation = 0;
+static uint16_t savedSeq = 0;       // The counter value a restore would resume from
+static uint16_t stagedSeq = 0;      // savedSeq once the snapshot being written is
+static unsigned long lastSnapshotMs = 0;
+static bool requested = false;
+
+// Reads and checks a slot's header, and its body into `staging` if `load`
+static bool
+read_slot(
+    uint8_t slot,
+    FlocPersistHeader_t* header,
+    bool load
+){
+    if (!store->read(store->ctx, slot, 0, (uint8_t*) header, FLOC_PERSIST_HEADER_SIZE)) {
+        return false;
+    }
+
+    if (header->magic != FLOC_PERSIST_MAGIC || header->version != FLOC_PERSIST_VERSION ||
+        header->size > FLOC_PERSIST_SLOT_SIZE - FLOC_PERSIST_HEADER_SIZE) {
+        return false;
+    }
+
+    if (!load) {
+        return true;
+    }
+
+    uint8_t* body = staging + FLOC_PERSIST_HEADER_SIZE;
+
+    return store->read(store->ctx, slot, FLOC_PERSIST_HEADER_SIZE, body, header->size) &&
+           floc_crc16(body, header->size) == header->crc;
+}
+
+// Finds the newest valid slot, loading it into `staging`
+static uint8_t
+find_newest(
+    FlocPersistHeader_t* newest
+){
+    FlocPersistHeader_t headers[FLOC_PERSIST_SLOTS];
+    bool valid[FLOC_PERSIST_SLOTS];
+
+    for (uint8_t slot = 0; slot < FLOC_PERSIST_SLOTS; slot++) {
+        valid[slot] = read_slot(slot, &headers[slot], false);
+    }
+
+    // Newest first; a slot whose body fails its CRC falls back to the other
+    for (uint8_t tries = 0; tries < FLOC_PERSIST_SLOTS; tries++) {
+        uint8_t best = NO_SLOT;
+
+        for (uint8_t slot = 0; slot < FLOC_PERSIST_SLOTS; slot++) {
+            if (valid[slot] && (best == NO_SLOT || (int32_t) (headers[slot].generation - headers[best].generation) > 0)) {
+                best = slot;
+            }
+        }
+
+        if (best == NO_SLOT) {
+            return NO_SLOT;
+        }
+
+        if (read_slot(best, &headers[best], true)) {
+            *newest = headers[best];
+            return best;
+        }
+
+        valid[best] = false;
+    }
+
+    return NO_SLOT;
+}
+
+void
+floc_persist_begin(
+    const FlocPersistStore_t* new_store
+){
+    store = new_store;
+    writeSlot = NO_SLOT;
+    newestSlot = NO_SLOT;
+    generation = 0;
+    lastSnapshotMs = millis();
+
+    FlocPersistHeader_t header;
+    newestSlot = find_newest(&header);
+
+    if (newestSlot != NO_SLOT) {
+        generation = header.generation;
+    } else {
+        requested = true;
+    }
+}
+
+void
+floc_persist_end(
+    void
+){
+    store = nullptr;
+    writeSlot = NO_SLOT;
+}
+
+bool
+floc_persist_restore(
+    void
+){
+    if (store == nullptr) {
+        return false;
+    }
+
+    FlocPersistHeader_t header;
+    uint8_t slot = find_newest(&header);
+
+    if (slot == NO_SLOT) {
+        return false;
+    }
+
+    const uint8_t* body = staging + FLOC_PERSIST_HEADER_SIZE;
+    uint16_t seq, buffer_size;
+
+    if (header.size < 4) {
+        return false;
+    }
+
+    memcpy(&seq, body, 2);
+    memcpy(&buffer_size, body + 2, 2);
+
+    if (4 + buffer_size > header.size ||
+        flocBuffer.restoreState(body + 4, buffer_size) == 0) {
+        return false;
+    }
+
+    uint16_t ack_size = header.size - 4 - buffer_size;
+
+    if (ack_size > 0) {
+        floc_ack_restore(body + 4 + buffer_size, ack_size > 0xFF ? 0xFF : ack_size);
+    }
+
+    floc_set_next_seq(seq);
+
+    newestSlot = slot;
+    generation = header.generation;
+    savedSeq = seq;
+    lastSnapshotMs = millis();
+
+#ifdef DEBUG_ON // DEBUG_ON
+    Serial.printf("[PERSIST] Restored snapshot %u, next seq %u\r\n", generation, seq);
+#endif // DEBUG_ON
+
+    // Reserve the next block of sequence numbers before using any of it
+    requested = true;
+
+    return true;
+}
+
+void
+floc_persist_request(
+    void
+){
+    requested = true;
+}
+
+static bool
+take_snapshot(
+    void
+){
+    uint8_t* body = staging + FLOC_PERSIST_HEADER_SIZE;
+    uint16_t capacity = FLOC_PERSIST_SLOT_SIZE - FLOC_PERSIST_HEADER_SIZE;
+
+    uint16_t seq = (floc_next_seq() + FLOC_PERSIST_SEQ_RESERVE) & FLOC_SEQ_MASK;
+    uint16_t buffer_size = flocBuffer.saveState(body + 4, capacity - 4);
+
+    if (buffer_size == 0) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("[PERSIST] Queues do not fit a snapshot\r\n");
+    #endif // DEBUG_ON
+
+        return false;
+    }
+
+    uint16_t capacity_left = capacity - 4 - buffer_size;
+    uint8_t ack_size = floc_ack_save(body + 4 + buffer_size, capacity_left > 0xFF ? 0xFF : capacity_left);
+
+    memcpy(body, &seq, 2);
+    memcpy(body + 2, &buffer_size, 2);
+
+    FlocPersistHeader_t header;
+    header.magic = FLOC_PERSIST_MAGIC;
+    header.version = FLOC_PERSIST_VERSION;
+    header.res = 0;
+    header.size = 4 + buffer_size + ack_size;
+    header.generation = generation + 1;
+    header.crc = floc_crc16(body, header.size);
+
+    memcpy(staging, &header, FLOC_PERSIST_HEADER_SIZE);
+
+    stagedSize = FLOC_PERSIST_HEADER_SIZE + header.size;
+    writtenSize = 0;
+    stagedSeq = seq;
+
+    return true;
+}
+
+void
+floc_persist_poll(
+    void
+){
+    if (store == nullptr) {
+        return;
+    }
+
+    if (writeSlot == NO_SLOT) {
+        // Half the reserved sequence numbers used, save before running out. A
+        // snapshot that failed to write reserved nothing, so this retries it.
+        uint16_t used = (floc_next_seq() - (savedSeq - FLOC_PERSIST_SEQ_RESERVE)) & FLOC_SEQ_MASK;
+        bool low_on_seq = generation > 0 && used >= FLOC_PERSIST_SEQ_RESERVE / 2;
+
+        if (!requested && !low_on_seq && millis() - lastSnapshotMs < FLOC_PERSIST_INTERVAL_MS) {
+            return;
+        }
+
+        requested = false;
+        lastSnapshotMs = millis();
+
+        if (!take_snapshot()) {
+            return;
+        }
+
+        writeSlot = newestSlot == 0 ? 1 : 0;
+
+        if (store->erase != nullptr && !store->erase(store->ctx, writeSlot)) {
+            writeSlot = NO_SLOT;
+        }
+
+        return;
+    }
+
+    uint16_t body_size = stagedSize - FLOC_PERSIST_HEADER_SIZE;
+
+    if (writtenSize < body_size) {
+        uint16_t chunk = body_size - writtenSize < FLOC_PERSIST_CHUNK ? body_size - writtenSize : FLOC_PERSIST_CHUNK;
+        uint16_t offset = FLOC_PERSIST_HEADER_SIZE + writtenSize;
+
+        if (!store->write(store->ctx, writeSlot, offset, staging + offset, chunk)) {
+            writeSlot = NO_SLOT;
+            return;
+        }
+
+        writtenSize += chunk;
+        return;
+    }
+
+    // The header makes the snapshot valid, so it goes last
+    if (store->write(store->ctx, writeSlot, 0, staging, FLOC_PERSIST_HEADER_SIZE)) {
+        if (store->sync != nullptr) {
+            store->sync(store->ctx);
+        }
+
+        newestSlot = writeSlot;
+        generation++;
+        savedSeq = stagedSeq;
+    }
+
+    writeSlot = NO_SLOT;
+}
+
+bool
+floc_persist_busy(
+    void
+){
+    return writeSlot != NO_SLOT;
+}
+
+uint32_t
+floc_persist_generation(
+    void
+){
+    return generation;
+}
+
+#ifdef __linux__ // __linux__
+static uint8_t* mapped = nullptr;
+static int mappedFd = -1;
+
+#define MAPPED_SIZE (FLOC_PERSIST_SLOTS * FLOC_PERSIST_SLOT_SIZE)
+
+static bool
+mmap_read(
+    void* ctx,
+    uint8_t slot,
+    uint16_t offset,
+    uint8_t* data,
+    uint16_t size
+){
+    (void) ctx;
+
+    if (mapped == nullptr || offset + size > FLOC_PERSIST_SLOT_SIZE) {
+        return false;
+    }
+
+    memcpy(data, mapped + slot * FLOC_PERSIST_SLOT_SIZE + offset, size);
+    return true;
+}
+
+static bool
+mmap_write(
+    void* ctx,
+    uint8_t slot,
+    uint16_t offset,
+    const uint8_t* data,
+    uint16_t size
+){
+    (void) ctx;
+
+    if (mapped == nullptr || offset + size > FLOC_PERSIST_SLOT_SIZE) {
+        return false;
+    }
+
+    memcpy(mapped + slot * FLOC_PERSIST_SLOT_SIZE + offset, data, size);
+    return true;
+}
+
+// The old header must not survive into a half-written slot
+static bool
+mmap_erase(
+    void* ctx,
+    uint8_t slot
+){
+    (void) ctx;
+
+    if (mapped == nullptr) {
+        return false;
+    }
+
+    memset(mapped + slot * FLOC_PERSIST_SLOT_SIZE, 0, FLOC_PERSIST_HEADER_SIZE);
+    return true;
+}
+
+// The kernel writes the pages back in its own time
+static void
+mmap_sync(
+    void* ctx
+){
+    (void) ctx;
+
+    msync(mapped, MAPPED_SIZE, MS_ASYNC);
+}
+
+bool
+floc_persist_mmap_open(
+    const char* path,
+    FlocPersistStore_t* out
+){
+    floc_persist_mmap_close();
+
+    mappedFd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (mappedFd < 0) {
+        return false;
+    }
+
+    void* map = MAP_FAILED;
+
+    if (ftruncate(mappedFd, MAPPED_SIZE) == 0) {
+        map = mmap(nullptr, MAPPED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mappedFd, 0);
+    }
+
+    if (map == MAP_FAILED) {
+        close(mappedFd);
+        mappedFd = -1;
+        return false;
+    }
+
+    mapped = (uint8_t*) map;
+
+    out->ctx = nullptr;
+    out->read = mmap_read;
+    out->write = mmap_write;
+    out->erase = mmap_erase;
+    out->sync = mmap_sync;
+
+    return true;
+}
+
+void
+floc_persist_mmap_close(
+    void
+){
+    if (mapped != nullptr) {
+        msync(mapped, MAPPED_SIZE, MS_SYNC);
+        munmap(mapped, MAPPED_SIZE);
+        mapped = nullptr;
+    }
+
+    if (mappedFd >= 0) {
+        close(mappedFd);
+        mappedFd = -1;
+    }
+}
+#endif // __linux__
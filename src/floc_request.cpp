@@ -0,0 +1,181 @@
+/*
+ * Request/response correlation table.
+ *
+ * Slots are indexed by PID. floc_request_poll() only scans the table when
+ * the earliest deadline has passed, so it is cheap to call every loop.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_request.hpp"
+
+struct
+pending_request {
+    bool active;
+    uint16_t peer;
+    unsigned long deadline_ms;
+    FlocResponseCallback_t callback;
+    void* ctx;
+};
+
+static pending_request requests[FLOC_PID_SPACE];
+static uint8_t requestsPending = 0;
+static unsigned long nextDeadline = 0;
+
+static void
+finish(
+    pending_request* r,
+    uint8_t pid,
+    FlocRequestResult_e result
+){
+    r->active = false;
+    requestsPending--;
+
+    r->callback(r->peer, pid, result, nullptr, 0, r->ctx);
+}
+
+void
+floc_request_track(
+    uint16_t peer,
+    uint8_t pid,
+    uint32_t timeout_ms,
+    FlocResponseCallback_t callback,
+    void* ctx
+){
+    pid &= FLOC_PID_SPACE - 1;
+    pending_request* r = &requests[pid];
+
+    if (r->active) {
+        finish(r, pid, FLOC_REQUEST_TIMEOUT);
+    }
+
+    r->active = true;
+    r->peer = peer;
+    r->deadline_ms = millis() + timeout_ms;
+    r->callback = callback;
+    r->ctx = ctx;
+
+    if (requestsPending == 0 || (long) (r->deadline_ms - nextDeadline) < 0) {
+        nextDeadline = r->deadline_ms;
+    }
+
+    requestsPending++;
+}
+
+bool
+floc_request_complete(
+    uint16_t peer,
+    uint8_t request_pid,
+    FlocRequestResult_e result,
+    const uint8_t* data,
+    uint8_t size
+){
+    request_pid &= FLOC_PID_SPACE - 1;
+    pending_request* r = &requests[request_pid];
+
+    if (!r->active || r->peer != peer) {
+        return false;
+    }
+
+    if (r->callback(peer, request_pid, result, data, size, r->ctx)) {
+        r->active = false;
+        requestsPending--;
+    }
+
+    return true;
+}
+
+uint8_t
+floc_command_request(
+    uint16_t dest_addr,
+    CommandType_e command_type,
+    const uint8_t* payload,
+    uint8_t size,
+    uint32_t timeout_ms,
+    FlocResponseCallback_t callback,
+    void* ctx
+){
+    uint8_t pid = floc_command_send(dest_addr, command_type, payload, size);
+
+    if (pid != FLOC_INVALID_PID) {
+        floc_request_track(dest_addr, pid, timeout_ms, callback, ctx);
+    }
+
+    return pid;
+}
+
+uint8_t
+floc_status_request(
+    uint16_t dest_addr,
+    FlocResponseCallback_t callback,
+    void* ctx
+){
+    return floc_command_request(dest_addr, COMMAND_TYPE_STATUS, nullptr, 0, FLOC_STATUS_TIMEOUT_MS, callback, ctx);
+}
+
+void
+floc_request_cancel(
+    uint16_t peer,
+    uint8_t pid
+){
+    pid &= FLOC_PID_SPACE - 1;
+    pending_request* r = &requests[pid];
+
+    if (r->active && r->peer == peer) {
+        r->active = false;
+        requestsPending--;
+    }
+}
+
+void
+floc_request_poll(
+    void
+){
+    if (requestsPending == 0) {
+        return;
+    }
+
+    unsigned long now = millis();
+
+    if ((long) (now - nextDeadline) < 0) {
+        return;
+    }
+
+    // Recomputed below; callbacks may track new requests while we scan
+    nextDeadline = now + 0x7FFFFFFF;
+
+    for (uint8_t pid = 0; pid < FLOC_PID_SPACE; pid++) {
+        pending_request* r = &requests[pid];
+
+        if (!r->active) {
+            continue;
+        }
+
+        if ((long) (now - r->deadline_ms) >= 0) {
+            finish(r, pid, FLOC_REQUEST_TIMEOUT);
+            continue;
+        }
+
+        if ((long) (r->deadline_ms - nextDeadline) < 0) {
+            nextDeadline = r->deadline_ms;
+        }
+    }
+}
+
+uint8_t
+floc_request_pending(
+    void
+){
+    return requestsPending;
+}
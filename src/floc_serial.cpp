@@ -0,0 +1,303 @@
+/*
+ * Serial framing between the Nest and its Burd.
+ *
+ * Records are appended to `frame` after room for the prefix and batch
+ * header. A lone record sits right after them, so writing the prefix into
+ * the byte before it turns it into a plain frame without moving it.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_serial.hpp"
+#include "floc_utils.hpp"
+
+#define RECORDS_OFFSET  (SERIAL_FLOC_PRE_SIZE + SERIAL_FLOC_HEADER_SIZE)
+#define RECORDS_MAX     (SERIAL_FLOC_BATCH_MAX_SIZE - SERIAL_FLOC_CRC_SIZE)
+
+static SerialFlocPacketDirection_e direction = SERIAL_NEST_TO_BURD_TYPE;
+static FlocSerialWrite_t writeFrame = nullptr;
+static void* writeCtx = nullptr;
+static uint16_t batchMs = FLOC_SERIAL_BATCH_MS;
+
+static uint8_t frame[SERIAL_FLOC_FRAME_MAX_SIZE];
+static uint8_t recordsSize = 0;
+static uint8_t recordCount = 0;
+static unsigned long heldSinceMs = 0;
+
+static uint32_t framesSent = 0;
+static uint32_t packetsSent = 0;
+static uint32_t rejectedCount = 0;
+
+void
+floc_serial_begin(
+    SerialFlocPacketDirection_e new_direction,
+    FlocSerialWrite_t write,
+    void* ctx
+){
+    direction = new_direction;
+    writeFrame = write;
+    writeCtx = ctx;
+    recordsSize = 0;
+    recordCount = 0;
+}
+
+void
+floc_serial_set_batch_ms(
+    uint16_t batch_ms
+){
+    batchMs = batch_ms;
+
+    if (batchMs == 0) {
+        floc_serial_flush();
+    }
+}
+
+uint16_t
+floc_serial_batch_ms(
+    void
+){
+    return batchMs;
+}
+
+void
+floc_serial_flush(
+    void
+){
+    if (recordCount == 0) {
+        return;
+    }
+
+    if (writeFrame != nullptr) {
+        if (recordCount == 1) {
+            frame[RECORDS_OFFSET - SERIAL_FLOC_PRE_SIZE] = direction;
+            writeFrame(writeCtx, frame + RECORDS_OFFSET - SERIAL_FLOC_PRE_SIZE, SERIAL_FLOC_PRE_SIZE + recordsSize);
+        } else {
+            SerialFlocHeader_t* header = (SerialFlocHeader_t*) (frame + SERIAL_FLOC_PRE_SIZE);
+            header->type = SERIAL_BATCH_TYPE;
+            header->size = recordsSize + SERIAL_FLOC_CRC_SIZE;
+
+            uint16_t crc = htons(floc_crc16(frame + SERIAL_FLOC_PRE_SIZE, SERIAL_FLOC_HEADER_SIZE + recordsSize));
+
+            frame[0] = direction;
+            memcpy(frame + RECORDS_OFFSET + recordsSize, &crc, SERIAL_FLOC_CRC_SIZE);
+            writeFrame(writeCtx, frame, RECORDS_OFFSET + recordsSize + SERIAL_FLOC_CRC_SIZE);
+        }
+
+        framesSent++;
+        packetsSent += recordCount;
+    }
+
+    recordsSize = 0;
+    recordCount = 0;
+}
+
+static bool
+add_record(
+    SerialFlocPacketType_e type,
+    uint16_t dest_addr,
+    const uint8_t* packet,
+    uint8_t size
+){
+    uint8_t addr_size = type == SERIAL_UNICAST_TYPE ? sizeof(dest_addr) : 0;
+
+    if (size > FLOC_MAX_SIZE) {
+        return false;
+    }
+
+    uint8_t record_size = SERIAL_FLOC_HEADER_SIZE + addr_size + size;
+
+    if (recordsSize + record_size > RECORDS_MAX) {
+        floc_serial_flush();
+    }
+
+    uint8_t* record = frame + RECORDS_OFFSET + recordsSize;
+    SerialFlocHeader_t* header = (SerialFlocHeader_t*) record;
+    header->type = type;
+    header->size = addr_size + size;
+
+    if (addr_size > 0) {
+        dest_addr = htons(dest_addr);
+        memcpy(record + SERIAL_FLOC_HEADER_SIZE, &dest_addr, addr_size);
+    }
+
+    memcpy(record + SERIAL_FLOC_HEADER_SIZE + addr_size, packet, size);
+
+    if (recordCount++ == 0) {
+        heldSinceMs = millis();
+    }
+
+    recordsSize += record_size;
+
+    if (batchMs == 0) {
+        floc_serial_flush();
+    }
+
+    return true;
+}
+
+bool
+floc_serial_send_broadcast(
+    const uint8_t* packet,
+    uint8_t size
+){
+    return add_record(SERIAL_BROADCAST_TYPE, 0, packet, size);
+}
+
+bool
+floc_serial_send_unicast(
+    uint16_t dest_addr,
+    const uint8_t* packet,
+    uint8_t size
+){
+    return add_record(SERIAL_UNICAST_TYPE, dest_addr, packet, size);
+}
+
+void
+floc_serial_poll(
+    void
+){
+    if (recordCount > 0 && millis() - heldSinceMs >= batchMs) {
+        floc_serial_flush();
+    }
+}
+
+uint32_t
+floc_serial_frames_sent(
+    void
+){
+    return framesSent;
+}
+
+uint32_t
+floc_serial_packets_sent(
+    void
+){
+    return packetsSent;
+}
+
+uint16_t
+floc_serial_frame_size(
+    const uint8_t* buf,
+    uint16_t size
+){
+    if (size < RECORDS_OFFSET) {
+        return 0;
+    }
+
+    const SerialFlocHeader_t* header = (const SerialFlocHeader_t*) (buf + SERIAL_FLOC_PRE_SIZE);
+
+    return RECORDS_OFFSET + header->size;
+}
+
+static bool
+reject(
+    void
+){
+    rejectedCount++;
+    return false;
+}
+
+bool
+floc_serial_open(
+    FlocSerialReader_t* reader,
+    const uint8_t* frame,
+    uint16_t size
+){
+    uint16_t frame_size = floc_serial_frame_size(frame, size);
+
+    if (frame_size == 0 || frame_size > size ||
+        (frame[0] != SERIAL_NEST_TO_BURD_TYPE && frame[0] != SERIAL_BURD_TO_NEST_TYPE)) {
+        return reject();
+    }
+
+    const SerialFlocHeader_t* header = (const SerialFlocHeader_t*) (frame + SERIAL_FLOC_PRE_SIZE);
+
+    switch (header->type) {
+        case SERIAL_BROADCAST_TYPE:
+        case SERIAL_UNICAST_TYPE:
+            // A plain frame reads as a batch of its own header and payload
+            reader->next = frame + SERIAL_FLOC_PRE_SIZE;
+            reader->end = frame + frame_size;
+            return true;
+
+        case SERIAL_BATCH_TYPE: {
+            if (header->size < SERIAL_FLOC_CRC_SIZE) {
+                return reject();
+            }
+
+            const uint8_t* crc_at = frame + frame_size - SERIAL_FLOC_CRC_SIZE;
+            uint16_t crc;
+            memcpy(&crc, crc_at, SERIAL_FLOC_CRC_SIZE);
+
+            if (ntohs(crc) != floc_crc16(frame + SERIAL_FLOC_PRE_SIZE, crc_at - frame - SERIAL_FLOC_PRE_SIZE)) {
+                return reject();
+            }
+
+            reader->next = frame + RECORDS_OFFSET;
+            reader->end = crc_at;
+            return true;
+        }
+
+        default:
+            return reject();
+    }
+}
+
+bool
+floc_serial_next(
+    FlocSerialReader_t* reader,
+    FlocSerialRecord_t* record
+){
+    while (reader->end - reader->next >= (long) SERIAL_FLOC_HEADER_SIZE) {
+        const SerialFlocHeader_t* header = (const SerialFlocHeader_t*) reader->next;
+        const uint8_t* payload = reader->next + SERIAL_FLOC_HEADER_SIZE;
+
+        if (reader->end - payload < header->size) {
+            break;
+        }
+
+        reader->next = payload + header->size;
+
+        if (header->type == SERIAL_BROADCAST_TYPE) {
+            record->type = SERIAL_BROADCAST_TYPE;
+            record->dest_addr = 0;
+            record->packet = payload;
+            record->size = header->size;
+            return true;
+        }
+
+        if (header->type == SERIAL_UNICAST_TYPE && header->size >= sizeof(uint16_t)) {
+            uint16_t dest_addr;
+            memcpy(&dest_addr, payload, sizeof(dest_addr));
+
+            record->type = SERIAL_UNICAST_TYPE;
+            record->dest_addr = ntohs(dest_addr);
+            record->packet = payload + sizeof(dest_addr);
+            record->size = header->size - sizeof(dest_addr);
+            return true;
+        }
+
+        // Records of a type we do not know are skipped
+    }
+
+    reader->next = reader->end;
+    return false;
+}
+
+uint32_t
+floc_serial_rejected(
+    void
+){
+    return rejectedCount;
+}
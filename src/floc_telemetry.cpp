@@ -0,0 +1,352 @@
+/*
+ * Remote telemetry.
+ *
+ * Node side: answer COMMAND_TYPE_TELEMETRY with the current metrics.
+ * Gateway side: request telemetry, decode the parts and keep the latest
+ * snapshot per node so the fleet can be summarised without recovering
+ * buoys.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc.hpp"
+#include "floc_buffer.hpp"
+#include "floc_metrics.hpp"
+#include "floc_request.hpp"
+#include "floc_telemetry.hpp"
+#include "bloomfilter.hpp"
+
+static_assert(FLOC_TM_RETRIES_LAST - FLOC_TM_RETRIES_FIRST + 1 == FLOC_METRICS_RETRY_BUCKETS, "retry buckets out of sync");
+static_assert(FLOC_TM_RTT_LAST - FLOC_TM_RTT_FIRST + 1 == FLOC_METRICS_RTT_BUCKETS, "RTT buckets out of sync");
+static_assert(FLOC_TM_DROP_MALFORMED - FLOC_TM_DROP_TOO_SMALL + 1 == FLOC_DROP_REASON_COUNT, "drop reasons out of sync");
+static_assert(FLOC_TM_FIELD_COUNT <= 64, "present mask is 64 bits");
+
+static FlocTelemetryNode_t fleet[FLOC_TELEMETRY_FLEET_SIZE];
+static uint8_t fleet_count = 0;
+
+// ----- Encoding -----
+
+static uint8_t
+varint_size(
+    uint32_t value
+){
+    uint8_t n = 1;
+
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+static uint8_t
+varint_put(
+    uint8_t* buf,
+    uint32_t value
+){
+    uint8_t n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (uint8_t) value;
+
+    return n;
+}
+
+static int
+varint_get(
+    const uint8_t* buf,
+    uint8_t size,
+    uint32_t* value
+){
+    uint32_t result = 0;
+
+    for (uint8_t i = 0; i < size && i < 5; i++) {
+        result |= (uint32_t) (buf[i] & 0x7F) << (7 * i);
+
+        if ((buf[i] & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+void
+floc_telemetry_collect(
+    FlocTelemetry_t* out
+){
+    FlocMetrics_t m;
+
+    memset(out, 0, sizeof(FlocTelemetry_t));
+
+    if (!floc_metrics_snapshot(&m)) {
+        return;
+    }
+
+    uint32_t* v = out->values;
+
+    for (int i = 0; i < FLOC_METRICS_PACKET_TYPES; i++) {
+        v[FLOC_TM_RX_DATA + i] = m.rx[i];
+        v[FLOC_TM_TX_DATA + i] = m.tx[i];
+    }
+
+    for (int i = 0; i < FLOC_DROP_REASON_COUNT; i++) {
+        v[FLOC_TM_DROP_TOO_SMALL + i] = m.drops[i];
+    }
+
+    for (int i = 0; i < FLOC_QUEUE_COUNT; i++) {
+        v[FLOC_TM_QUEUE_RETRANSMISSION + i] = flocBuffer.getQueueDepth((FlocQueueId_e) i);
+        v[FLOC_TM_HWM_RETRANSMISSION + i] = m.queue_hwm[i];
+    }
+
+    v[FLOC_TM_COMMAND_ACKED] = m.command_acked;
+    v[FLOC_TM_COMMAND_FAILED] = m.command_failed;
+
+    for (int i = 0; i < FLOC_METRICS_RETRY_BUCKETS; i++) {
+        v[FLOC_TM_RETRIES_FIRST + i] = m.retries[i];
+    }
+
+    for (int i = 0; i < FLOC_METRICS_RTT_BUCKETS; i++) {
+        v[FLOC_TM_RTT_FIRST + i] = m.ack_rtt[i];
+    }
+
+    v[FLOC_TM_DEDUP_FP_PERMILLE] = bloom_false_positive_permille();
+    v[FLOC_TM_UPTIME_S] = millis() / 1000;
+
+    out->present = (FLOC_TM_FIELD_COUNT == 64) ? ~0ULL : ((1ULL << FLOC_TM_FIELD_COUNT) - 1);
+}
+
+uint8_t
+floc_telemetry_encode(
+    const FlocTelemetry_t* telemetry,
+    uint8_t part,
+    uint8_t* field,
+    uint8_t* buf,
+    uint8_t capacity
+){
+    if (capacity < FLOC_TELEMETRY_PART_HEADER + 5 || *field >= FLOC_TM_FIELD_COUNT) {
+        return 0;
+    }
+
+    uint8_t first = *field;
+    uint8_t len = FLOC_TELEMETRY_PART_HEADER;
+
+    while (*field < FLOC_TM_FIELD_COUNT) {
+        uint32_t value = telemetry->values[*field];
+
+        if (len + varint_size(value) > capacity) {
+            break;
+        }
+
+        len += varint_put(buf + len, value);
+        (*field)++;
+    }
+
+    buf[0] = FLOC_TELEMETRY_VERSION;
+    buf[1] = (part & 0x7F) | (*field >= FLOC_TM_FIELD_COUNT ? FLOC_TELEMETRY_LAST_PART : 0);
+    buf[2] = first;
+
+    return len;
+}
+
+void
+floc_telemetry_send(
+    uint16_t dest_addr,
+    uint8_t request_pid
+){
+    FlocTelemetry_t telemetry;
+    floc_telemetry_collect(&telemetry);
+
+    uint8_t field = 0;
+    uint8_t part = 0;
+
+    while (field < FLOC_TM_FIELD_COUNT) {
+        FlocPacket_t packet;
+
+        floc_build_header(&packet, TTL_START, FLOC_RESPONSE_TYPE, dest_addr, false);
+
+        uint8_t size = floc_telemetry_encode(&telemetry, part++, &field,
+                                             packet.payload.response.payload, MAX_RESPONSE_PAYLOAD_SIZE);
+        if (size == 0) {
+            break;
+        }
+
+        packet.payload.response.header.request_pid = request_pid;
+        packet.payload.response.header.size = size;
+
+        flocBuffer.addPacket(packet);
+    }
+}
+
+// ----- Decoding -----
+
+static bool
+telemetry_part(
+    uint16_t peer,
+    uint8_t pid,
+    FlocRequestResult_e result,
+    const uint8_t* data,
+    uint8_t size,
+    void* ctx
+){
+    (void) pid;
+    (void) ctx;
+
+    if (result != FLOC_REQUEST_OK || !floc_telemetry_fleet_ingest(peer, data, size)) {
+        return true;
+    }
+
+    // Keep waiting until the last part
+    return (data[1] & FLOC_TELEMETRY_LAST_PART) != 0;
+}
+
+void
+floc_telemetry_request(
+    uint16_t dest_addr
+){
+    floc_command_request(dest_addr, COMMAND_TYPE_TELEMETRY, nullptr, 0, FLOC_TELEMETRY_TIMEOUT_MS, telemetry_part, nullptr);
+}
+
+bool
+floc_telemetry_decode(
+    const uint8_t* buf,
+    uint8_t size,
+    FlocTelemetry_t* out,
+    bool* last_part
+){
+    if (size < FLOC_TELEMETRY_PART_HEADER || buf[0] != FLOC_TELEMETRY_VERSION) {
+        return false;
+    }
+
+    uint8_t field = buf[2];
+    uint8_t offset = FLOC_TELEMETRY_PART_HEADER;
+
+    while (offset < size) {
+        if (field >= FLOC_TM_FIELD_COUNT) {
+            return false;
+        }
+
+        uint32_t value;
+        int n = varint_get(buf + offset, size - offset, &value);
+        if (n < 0) {
+            return false;
+        }
+
+        out->values[field] = value;
+        out->present |= 1ULL << field;
+
+        offset += n;
+        field++;
+    }
+
+    if (last_part != nullptr) {
+        *last_part = (buf[1] & FLOC_TELEMETRY_LAST_PART) != 0;
+    }
+
+    return true;
+}
+
+bool
+floc_telemetry_fleet_ingest(
+    uint16_t src_addr,
+    const uint8_t* data,
+    uint8_t size
+){
+    FlocTelemetryNode_t* node = nullptr;
+
+    for (uint8_t i = 0; i < fleet_count; i++) {
+        if (fleet[i].addr == src_addr) {
+            node = &fleet[i];
+            break;
+        }
+    }
+
+    if (node == nullptr) {
+        if (fleet_count >= FLOC_TELEMETRY_FLEET_SIZE) {
+            // Replace the node we have heard from least recently
+            node = &fleet[0];
+            for (uint8_t i = 1; i < fleet_count; i++) {
+                if (fleet[i].updated_ms < node->updated_ms) {
+                    node = &fleet[i];
+                }
+            }
+        } else {
+            node = &fleet[fleet_count++];
+        }
+
+        memset(node, 0, sizeof(FlocTelemetryNode_t));
+        node->addr = src_addr;
+    }
+
+    if (!floc_telemetry_decode(data, size, &node->telemetry, nullptr)) {
+        return false;
+    }
+
+    node->updated_ms = millis();
+
+    return true;
+}
+
+const FlocTelemetryNode_t*
+floc_telemetry_fleet_node(
+    uint8_t index
+){
+    if (index >= fleet_count) {
+        return nullptr;
+    }
+
+    return &fleet[index];
+}
+
+uint8_t
+floc_telemetry_fleet_size(
+    void
+){
+    return fleet_count;
+}
+
+void
+floc_telemetry_fleet_total(
+    FlocTelemetry_t* out
+){
+    memset(out, 0, sizeof(FlocTelemetry_t));
+
+    for (uint8_t n = 0; n < fleet_count; n++) {
+        const FlocTelemetry_t* t = &fleet[n].telemetry;
+
+        for (uint8_t f = 0; f < FLOC_TM_FIELD_COUNT; f++) {
+            if ((t->present & (1ULL << f)) == 0) {
+                continue;
+            }
+
+            bool is_max = (f >= FLOC_TM_QUEUE_RETRANSMISSION && f <= FLOC_TM_HWM_COMMAND) ||
+                          f == FLOC_TM_DEDUP_FP_PERMILLE || f == FLOC_TM_UPTIME_S;
+
+            if (is_max) {
+                if (t->values[f] > out->values[f]) {
+                    out->values[f] = t->values[f];
+                }
+            } else {
+                out->values[f] += t->values[f];
+            }
+
+            out->present |= 1ULL << f;
+        }
+    }
+}
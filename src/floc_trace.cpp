@@ -0,0 +1,126 @@
+/*
+ * Binary trace ring.
+ *
+ * The writer only bumps `head`; the reader remembers how far it has drained
+ * in `tail`. If the writer laps the reader, the oldest records are counted
+ * as lost instead of being handed out half-overwritten.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include "floc_trace.hpp"
+
+static FlocTraceRecord_t trace_ring[FLOC_TRACE_DEPTH];
+static uint32_t trace_head = 0; // Next record to write
+static uint32_t trace_tail = 0; // Next record to drain
+static uint32_t trace_lost = 0;
+
+void
+floc_trace_write(
+    uint8_t event,
+    uint8_t a,
+    uint16_t b
+){
+    FlocTraceRecord_t* record = &trace_ring[trace_head & (FLOC_TRACE_DEPTH - 1)];
+
+    record->timestamp_us = micros();
+    record->event = event;
+    record->a = a;
+    record->b = b;
+
+    trace_head++;
+}
+
+// Skip anything the writer has already overwritten.
+static void
+trace_catch_up(
+    void
+){
+    if (trace_head - trace_tail > FLOC_TRACE_DEPTH) {
+        trace_lost += trace_head - trace_tail - FLOC_TRACE_DEPTH;
+        trace_tail = trace_head - FLOC_TRACE_DEPTH;
+    }
+}
+
+uint16_t
+floc_trace_drain(
+    uint8_t* buf,
+    uint16_t capacity
+){
+    if (capacity < sizeof(FlocTraceDumpHeader_t)) {
+        return 0;
+    }
+
+    trace_catch_up();
+
+    uint32_t available = trace_head - trace_tail;
+    uint32_t room = (capacity - sizeof(FlocTraceDumpHeader_t)) / sizeof(FlocTraceRecord_t);
+    uint16_t count = available < room ? available : room;
+
+    FlocTraceDumpHeader_t* header = (FlocTraceDumpHeader_t*) buf;
+    header->magic = FLOC_TRACE_MAGIC;
+    header->version = FLOC_TRACE_VERSION;
+    header->count = count;
+    header->lost = trace_lost;
+
+    uint8_t* out = buf + sizeof(FlocTraceDumpHeader_t);
+    for (uint16_t i = 0; i < count; i++) {
+        memcpy(out, &trace_ring[(trace_tail + i) & (FLOC_TRACE_DEPTH - 1)], sizeof(FlocTraceRecord_t));
+        out += sizeof(FlocTraceRecord_t);
+    }
+
+    trace_tail += count;
+    trace_lost = 0;
+
+    return out - buf;
+}
+
+void
+floc_trace_dump_serial(
+    void
+){
+    trace_catch_up();
+
+    FlocTraceDumpHeader_t header;
+    header.magic = FLOC_TRACE_MAGIC;
+    header.version = FLOC_TRACE_VERSION;
+    header.count = trace_head - trace_tail;
+    header.lost = trace_lost;
+
+    Serial.write((const uint8_t*) &header, sizeof(header));
+
+    // At most two contiguous runs: up to the end of the ring, then from the start
+    while (trace_tail != trace_head) {
+        uint32_t index = trace_tail & (FLOC_TRACE_DEPTH - 1);
+        uint32_t run = FLOC_TRACE_DEPTH - index;
+
+        if (run > trace_head - trace_tail) {
+            run = trace_head - trace_tail;
+        }
+
+        Serial.write((const uint8_t*) &trace_ring[index], run * sizeof(FlocTraceRecord_t));
+        trace_tail += run;
+    }
+
+    trace_lost = 0;
+}
+
+void
+floc_trace_reset(
+    void
+){
+    trace_head = 0;
+    trace_tail = 0;
+    trace_lost = 0;
+}
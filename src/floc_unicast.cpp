@@ -0,0 +1,216 @@
+/*
+ * Unicast to neighbors.
+ *
+ * The modem handles one unicast at a time and reports on it before the
+ * next, so only the last frame sent is kept for its delivery report.
+ */
+
+#include <Arduino.h>
+
+#ifdef min // min
+#undef min
+#endif //min
+
+#ifdef max //min
+#undef max
+#endif //min
+
+#include <stdint.h>
+#include <string.h>
+
+#include <nmv3_api.hpp>
+
+#include "floc_unicast.hpp"
+#include "floc_ack.hpp"
+#include "floc_buffer.hpp"
+#include "floc_capture.hpp"
+#include "floc_trace.hpp"
+#include "floc_utils.hpp"
+
+struct
+neighbor {
+    uint16_t addr;
+    unsigned long heard_ms;
+};
+
+static neighbor neighbors[FLOC_NEIGHBOR_MAX];
+static uint8_t neighborCount = 0;
+
+struct
+unicast_in_flight {
+    bool pending;
+    bool failed;                // Waiting for queueHandler() to broadcast it
+    uint8_t modem_id;
+    uint8_t type;
+    uint8_t pid;
+    uint16_t src_addr;
+    uint16_t dest_addr;
+    FlocUnicastFrame_t sent;
+};
+
+static unicast_in_flight inFlight;
+
+#ifdef FLOC_UNICAST // FLOC_UNICAST
+static bool unicastEnabled = true;
+#else
+static bool unicastEnabled = false;
+#endif // FLOC_UNICAST
+
+void
+floc_unicast_set_enabled(
+    bool enable
+){
+    unicastEnabled = enable;
+}
+
+bool
+floc_unicast_enabled(
+    void
+){
+    return unicastEnabled;
+}
+
+static int
+find_neighbor(
+    uint16_t addr
+){
+    for (uint8_t i = 0; i < neighborCount; i++) {
+        if (neighbors[i].addr == addr) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void
+floc_neighbor_heard(
+    uint16_t addr
+){
+    int i = find_neighbor(addr);
+
+    if (i < 0) {
+        if (neighborCount < FLOC_NEIGHBOR_MAX) {
+            i = neighborCount++;
+        } else {
+            i = 0;
+
+            for (uint8_t j = 1; j < neighborCount; j++) {
+                if ((long) (neighbors[j].heard_ms - neighbors[i].heard_ms) < 0) {
+                    i = j;
+                }
+            }
+        }
+
+        neighbors[i].addr = addr;
+    }
+
+    neighbors[i].heard_ms = millis();
+}
+
+bool
+floc_neighbor_known(
+    uint16_t addr
+){
+    int i = find_neighbor(addr);
+
+    return i >= 0 && millis() - neighbors[i].heard_ms < FLOC_NEIGHBOR_TIMEOUT_MS;
+}
+
+void
+floc_neighbor_forget(
+    uint16_t addr
+){
+    int i = find_neighbor(addr);
+
+    if (i >= 0) {
+        neighbors[i] = neighbors[--neighborCount];
+    }
+}
+
+uint8_t
+floc_neighbor_count(
+    void
+){
+    return neighborCount;
+}
+
+bool
+floc_unicast_send(
+    const FlocHeader_t* header,
+    uint8_t* frame,
+    uint8_t size,
+    FlocTrafficClass_e traffic
+){
+    uint16_t dest_addr = ntohs(header->dest_addr);
+
+    if (!unicastEnabled || dest_addr == FLOC_ACK_BROADCAST || !floc_neighbor_known(dest_addr)) {
+        return false;
+    }
+
+    // A report that never came is given up on
+    inFlight.pending = true;
+    inFlight.failed = false;
+    inFlight.modem_id = modemIdFromDidNid(dest_addr, get_network_id());
+    inFlight.type = header->type & FLOC_TYPE_MASK;
+    inFlight.pid = header->pid;
+    inFlight.src_addr = ntohs(header->src_addr);
+    inFlight.dest_addr = dest_addr;
+    inFlight.sent.traffic = traffic;
+    inFlight.sent.size = size;
+    memcpy(inFlight.sent.frame, frame, size);
+
+#ifdef FLOC_CAPTURE // FLOC_CAPTURE
+    floc_capture_record(FLOC_CAPTURE_LINK_UNICAST, FLOC_CAPTURE_TX, frame, size);
+#endif // FLOC_CAPTURE
+
+    unicast(inFlight.modem_id, frame, size);
+
+    return true;
+}
+
+void
+floc_unicast_delivered(
+    uint8_t modem_id,
+    bool delivered
+){
+    if (!inFlight.pending || modem_id != inFlight.modem_id) {
+        return;
+    }
+
+    inFlight.pending = false;
+
+    if (!delivered) {
+    #ifdef DEBUG_ON // DEBUG_ON
+        Serial.printf("[UNICAST] %d did not get %d, broadcasting instead\r\n", inFlight.dest_addr, inFlight.pid);
+    #endif // DEBUG_ON
+
+        floc_neighbor_forget(inFlight.dest_addr);
+
+        // Commands are retried by the command queue anyway
+        inFlight.failed = inFlight.type != FLOC_COMMAND_TYPE;
+        return;
+    }
+
+    floc_neighbor_heard(inFlight.dest_addr);
+
+    // The destination has our command, which is all its ACK would tell us
+    if (inFlight.type == FLOC_COMMAND_TYPE && inFlight.src_addr == get_device_id()) {
+        FLOC_TRACE(FLOC_TRACE_ACK, inFlight.pid, inFlight.dest_addr);
+        flocBuffer.addAckID(inFlight.pid);
+    }
+}
+
+bool
+floc_unicast_take_failed(
+    FlocUnicastFrame_t* out
+){
+    if (!inFlight.failed) {
+        return false;
+    }
+
+    inFlight.failed = false;
+    *out = inFlight.sent;
+
+    return true;
+}